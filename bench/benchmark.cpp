@@ -6,6 +6,7 @@
 #include <fstream>
 #include <memory>
 #include <sstream>
+#include <vector>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -17,21 +18,10 @@ void save_screenshot(absim::arduboy_t const& a, std::string const& fname)
     stbi_write_png(fname.c_str(), 128, 64, 1, a.display.filtered_pixels.data(), 128 * 1);
 }
 
-static void bench(benchmark::State& state, std::string const& fname, bool prof = false)
-{
-    constexpr uint64_t MS = 1'000'000'000ull;
-
-    //auto arduboy = std::make_unique<absim::arduboy_t>();
-    {
-        std::string path = std::string(ARDENS_BENCHMARK_DIR) + "/" + fname;
-        std::ifstream f(path, std::ios::binary);
-        if(!f.good())
-            exit(1);
-        if("" != arduboy.load_file(path.c_str(), f))
-            return;
-    }
+constexpr uint64_t MS = 1'000'000'000ull;
 
-    std::stringstream ss;
+static void set_bench_inputs()
+{
     uint8_t pinf = 0xf0;
     uint8_t pine = 0x40;
     uint8_t pinb = 0x10;
@@ -42,30 +32,363 @@ static void bench(benchmark::State& state, std::string const& fname, bool prof =
     arduboy.cpu.data[0x23] = pinb;
     arduboy.cpu.data[0x2c] = pine;
     arduboy.cpu.data[0x2f] = pinf;
+}
+
+// load the game and run it for a while to get past the title screen
+static bool load_bench_game(std::string const& fname)
+{
+    std::string path = std::string(ARDENS_BENCHMARK_DIR) + "/" + fname;
+    std::ifstream f(path, std::ios::binary);
+    if(!f.good())
+        exit(1);
+    if("" != arduboy.load_file(path.c_str(), f))
+        return false;
+    set_bench_inputs();
     arduboy.advance(2000 * MS);
+    return true;
+}
+
+// add the counter increments from a to b into t
+static void add_stats(absim::cpu_stats_t& t, absim::cpu_stats_t const& a, absim::cpu_stats_t const& b)
+{
+    t.unmerged_instrs += b.unmerged_instrs - a.unmerged_instrs;
+    t.merged_instrs += b.merged_instrs - a.merged_instrs;
+    t.merged_batches += b.merged_batches - a.merged_batches;
+    t.merged_exit_io += b.merged_exit_io - a.merged_exit_io;
+    t.merged_exit_deadline += b.merged_exit_deadline - a.merged_exit_deadline;
+    t.merged_exit_limit += b.merged_exit_limit - a.merged_exit_limit;
+    for(size_t i = 0; i < t.queue_pops.size(); ++i)
+        t.queue_pops[i] += b.queue_pops[i] - a.queue_pops[i];
+}
+
+// emulation throughput: rates are per second of benchmark time, the rest
+// are per iteration (100 ms emulated)
+static void set_throughput_counters(
+    benchmark::State& state, uint64_t cycles, absim::cpu_stats_t const& s)
+{
+    using benchmark::Counter;
+    double instrs = double(s.unmerged_instrs + s.merged_instrs);
+    state.counters["cycles_per_second"] = Counter(double(cycles), Counter::kIsRate);
+    state.counters["instrs_per_second"] = Counter(instrs, Counter::kIsRate);
+    state.counters["merged_fraction"] = instrs != 0 ? double(s.merged_instrs) / instrs : 0.0;
+    state.counters["merged_batches"] = Counter(double(s.merged_batches), Counter::kAvgIterations);
+    state.counters["merged_exit_io"] = Counter(double(s.merged_exit_io), Counter::kAvgIterations);
+    state.counters["merged_exit_deadline"] = Counter(double(s.merged_exit_deadline), Counter::kAvgIterations);
+    state.counters["merged_exit_limit"] = Counter(double(s.merged_exit_limit), Counter::kAvgIterations);
+    for(size_t i = 1; i < s.queue_pops.size(); ++i)
+    {
+        if(s.queue_pops[i] == 0) continue;
+        state.counters[std::string("pq_") + absim::PQUEUE_TYPE_NAMES[i]] =
+            Counter(double(s.queue_pops[i]), Counter::kAvgIterations);
+    }
+}
+
+static void bench(benchmark::State& state, std::string const& fname, bool prof = false, bool breakpoint = false)
+{
+    //auto arduboy = std::make_unique<absim::arduboy_t>();
+    if(!load_bench_game(fname))
+        return;
+
+    std::stringstream ss;
     arduboy.save_savestate(ss);
     save_screenshot(arduboy, fname + ".pre.png");
 
+    uint64_t cycles = 0;
+    absim::cpu_stats_t stats;
+
     for(auto _ : state)
     {
         state.PauseTiming();
         ss.seekg(0);
         if("" != arduboy.load_savestate(ss))
             break;
-        arduboy.fxport_reg = 0x2b;
-        arduboy.fxport_mask = 1 << 1;
-        arduboy.display.enable_filter = true;
-        arduboy.cpu.data[0x23] = pinb;
-        arduboy.cpu.data[0x2c] = pine;
-        arduboy.cpu.data[0x2f] = pinf;
+        set_bench_inputs();
         state.ResumeTiming();
         arduboy.profiler_enabled = prof;
+#ifndef ARDENS_NO_DEBUGGER
+        // a breakpoint on the last instruction, which is never reached
+        arduboy.allow_nonstep_breakpoints = breakpoint;
+        arduboy.breakpoints.reset();
+        if(breakpoint)
+            arduboy.breakpoints.set(arduboy.breakpoints.size() - 1);
+#endif
+        uint64_t c0 = arduboy.cpu.cycle_count;
+        auto s0 = arduboy.cpu.stats;
         arduboy.advance(100 * MS);
+        cycles += arduboy.cpu.cycle_count - c0;
+        add_stats(stats, s0, arduboy.cpu.stats);
     }
 
+    set_throughput_counters(state, cycles, stats);
     save_screenshot(arduboy, fname + ".post.png");
 }
 
+// savestate throughput: items/s is save or load operations per second
+static void bench_savestate(benchmark::State& state, std::string const& fname, bool flat, bool load)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    std::vector<uint8_t> buf(arduboy.savestate_flat_size());
+    std::stringstream ss;
+    if(flat)
+        arduboy.save_savestate_flat(buf.data(), buf.size());
+    else
+        arduboy.save_savestate(ss);
+    size_t bytes = flat ? buf.size() : ss.str().size();
+
+    for(auto _ : state)
+    {
+        std::string err;
+        if(flat && load)
+            err = arduboy.load_savestate_flat(buf.data(), buf.size());
+        else if(flat)
+            err = arduboy.save_savestate_flat(buf.data(), buf.size());
+        else if(load)
+        {
+            ss.seekg(0);
+            err = arduboy.load_savestate(ss);
+        }
+        else
+        {
+            ss.str("");
+            err = arduboy.save_savestate(ss);
+        }
+        if(!err.empty())
+        {
+            state.SkipWithError(err.c_str());
+            break;
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations() * bytes));
+}
+
+// decode and merge the whole program: items/s is instructions per second
+static void bench_decode(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    for(auto _ : state)
+    {
+        arduboy.cpu.decode();
+        arduboy.cpu.merge_instrs();
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * arduboy.cpu.decoded_prog.size());
+}
+
+// display refresh of one frame: items/s is display rows per second
+static void bench_display_rows(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    auto& d = arduboy.display;
+    d.enable_filter = false;
+    uint64_t frame_ps = uint64_t(1e12 / d.refresh_rate());
+
+    for(auto _ : state)
+    {
+        d.advance_extern(frame_ps);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * (d.mux_ratio + 1));
+}
+
+// moving-average filter over the pixel history: bytes/s is history read
+static void bench_display_filter(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    auto& d = arduboy.display;
+    for(auto _ : state)
+    {
+        d.filter_pixels();
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations() * sizeof(d.pixels)));
+}
+
+// streaming FX reads: bytes/s is data bytes clocked out of the chip
+static void bench_fx_read(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    auto& fx = arduboy.fx;
+    size_t sector = 0;
+    while(sector < fx.sectors.size() && !fx.sectors[sector])
+        ++sector;
+    if(sector >= fx.sectors.size())
+    {
+        state.SkipWithError("game has no FX data");
+        return;
+    }
+
+    // read data command, 24-bit address, then the streamed bytes
+    constexpr size_t READ_BYTES = 16 * 1024;
+    uint32_t addr = uint32_t(sector * fx.SECTOR_BYTES);
+    std::vector<uint8_t> tx(4 + READ_BYTES);
+    std::vector<uint8_t> rx(tx.size());
+    tx[0] = 0x03;
+    tx[1] = uint8_t(addr >> 16);
+    tx[2] = uint8_t(addr >> 8);
+    tx[3] = uint8_t(addr >> 0);
+
+    for(auto _ : state)
+    {
+        fx.spi_transfer(tx.data(), rx.data(), tx.size());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations() * READ_BYTES));
+}
+
+// time-travel checkpoint capture: items/s is states saved per second
+static void bench_save_state_to_vector(benchmark::State& state, std::string const& fname, bool compress)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    std::vector<uint8_t> v;
+    for(auto _ : state)
+    {
+        arduboy.save_state_to_vector(v, compress);
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations() * arduboy.savestate_flat_size()));
+}
+
+// game hash over program and FX data: bytes/s is data hashed
+static void bench_game_hash(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    for(auto _ : state)
+    {
+        arduboy.update_game_hash();
+        benchmark::DoNotOptimize(arduboy.game_hash);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations() *
+        (arduboy.cpu.prog.size() + arduboy.fx.DATA_BYTES)));
+}
+
+// loading a game file from memory: bytes/s is file bytes loaded
+static void bench_load_file(benchmark::State& state, std::string const& fname)
+{
+    std::string path = std::string(ARDENS_BENCHMARK_DIR) + "/" + fname;
+    std::ifstream f(path, std::ios::binary);
+    if(!f.good())
+    {
+        state.SkipWithError("could not open game");
+        return;
+    }
+    std::string data(
+        (std::istreambuf_iterator<char>(f)),
+        std::istreambuf_iterator<char>());
+
+    for(auto _ : state)
+    {
+        auto err = arduboy.load_file(path.c_str(),
+            (uint8_t const*)data.data(), data.size());
+        if(!err.empty())
+        {
+            state.SkipWithError(err.c_str());
+            break;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(int64_t(state.iterations() * data.size()));
+}
+
+#ifndef ARDENS_NO_DEBUGGER
+
+// time-travel checkpointing: items/s is checkpoints taken per second
+static void bench_update_history(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+
+    int64_t n = 0;
+    for(auto _ : state)
+    {
+        arduboy.history_next_cycle = 0;
+        arduboy.update_history();
+        if(++n % 1024 == 0)
+        {
+            state.PauseTiming();
+            arduboy.wait_for_history();
+            arduboy.state_history.clear();
+            arduboy.history_size = 0;
+            state.ResumeTiming();
+        }
+    }
+    arduboy.wait_for_history();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+// reverse stepping through recorded history: items/s is steps per second
+static void bench_travel_back(benchmark::State& state, std::string const& fname)
+{
+    if(!load_bench_game(fname))
+    {
+        state.SkipWithError("could not load game");
+        return;
+    }
+    arduboy.wait_for_history();
+
+    // the first step journals the latest checkpoint interval
+    arduboy.travel_back_single_instr();
+
+    for(auto _ : state)
+        arduboy.travel_back_single_instr();
+    arduboy.travel_to_present();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+#endif
+
 #define BENCH_OPTIONS ->Unit(benchmark::kMillisecond)->MinTime(3.0)
 //#define BENCH_OPTIONS ->Unit(benchmark::kMicrosecond)
 
@@ -78,17 +401,75 @@ BENCH_OPTIONS;
 BENCHMARK_CAPTURE(bench, ardugolf, "ardugolf.hex")
 BENCH_OPTIONS;
 
+#define SAVESTATE_BENCH_OPTIONS ->Unit(benchmark::kMicrosecond)
+
+BENCHMARK_CAPTURE(bench_savestate, flat_save, "ReturnOfTheArdu.arduboy", true, false)
+SAVESTATE_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_savestate, flat_load, "ReturnOfTheArdu.arduboy", true, true)
+SAVESTATE_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_savestate, stream_save, "ReturnOfTheArdu.arduboy", false, false)
+SAVESTATE_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_savestate, stream_load, "ReturnOfTheArdu.arduboy", false, true)
+SAVESTATE_BENCH_OPTIONS;
+
+#define SUBSYSTEM_BENCH_OPTIONS ->Unit(benchmark::kMicrosecond)
+
+BENCHMARK_CAPTURE(bench_decode, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_display_rows, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_display_filter, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_fx_read, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_save_state_to_vector, uncompressed, "ReturnOfTheArdu.arduboy", false)
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_save_state_to_vector, zlib, "ReturnOfTheArdu.arduboy", true)
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_game_hash, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_load_file, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_load_file, racing_game, "racing_game.hex")
+SUBSYSTEM_BENCH_OPTIONS;
+
 #ifndef ARDENS_NO_DEBUGGER
 
-BENCHMARK_CAPTURE(bench, ReturnOfTheArdu_nomerged, "ReturnOfTheArdu.arduboy", true)
+BENCHMARK_CAPTURE(bench, ReturnOfTheArdu_profiled, "ReturnOfTheArdu.arduboy", true)
+BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench, racing_game_profiled, "racing_game.hex", true)
+BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench, ardugolf_profiled, "ardugolf.hex", true)
+BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench, ReturnOfTheArdu_breakpoint, "ReturnOfTheArdu.arduboy", false, true)
 BENCH_OPTIONS;
 
-BENCHMARK_CAPTURE(bench, racing_game_nomerged, "racing_game.hex", true)
+BENCHMARK_CAPTURE(bench, racing_game_breakpoint, "racing_game.hex", false, true)
 BENCH_OPTIONS;
 
-BENCHMARK_CAPTURE(bench, ardugolf_nomerged, "ardugolf.hex", true)
+BENCHMARK_CAPTURE(bench, ardugolf_breakpoint, "ardugolf.hex", false, true)
 BENCH_OPTIONS;
 
+BENCHMARK_CAPTURE(bench_update_history, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
+BENCHMARK_CAPTURE(bench_travel_back, ReturnOfTheArdu, "ReturnOfTheArdu.arduboy")
+SUBSYSTEM_BENCH_OPTIONS;
+
 #endif
 
 BENCHMARK_MAIN();
@@ -0,0 +1,78 @@
+import sys, json, argparse
+
+# Compares two Google Benchmark JSON reports, as written by
+#
+#     Ardens_benchmark --benchmark_out=current.json --benchmark_out_format=json
+#
+# and flags benchmarks whose time or throughput regressed by more than the
+# threshold. Exits with status 1 if any did.
+
+# metrics where larger is better; everything else compared is a time
+RATE_SUFFIXES = ("_per_second",)
+
+def load(fname):
+    with open(fname) as f:
+        report = json.load(f)
+    runs = {}
+    for b in report.get("benchmarks", []):
+        if b.get("error_occurred"):
+            continue
+        name = b.get("run_name", b["name"])
+        if b.get("run_type") == "aggregate":
+            # prefer the median when run with repetitions
+            if b.get("aggregate_name") != "median":
+                continue
+            runs[name] = [b]
+        elif not any(r.get("run_type") == "aggregate" for r in runs.get(name, [])):
+            runs.setdefault(name, []).append(b)
+    result = {}
+    for name, bs in runs.items():
+        metrics = {}
+        for key in ["real_time", "cpu_time"]:
+            vals = sorted(b[key] for b in bs if key in b)
+            if vals:
+                metrics[key] = vals[len(vals) // 2]
+        for key in bs[0]:
+            if key.endswith(RATE_SUFFIXES):
+                vals = sorted(b[key] for b in bs if key in b)
+                metrics[key] = vals[len(vals) // 2]
+        result[name] = metrics
+    return result
+
+def main(argv):
+    parser = argparse.ArgumentParser(description="Compare benchmark reports")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=3.0,
+        help="regression threshold in percent (default 3)")
+    args = parser.parse_args(argv)
+
+    base = load(args.baseline)
+    cur = load(args.current)
+
+    regressions = 0
+    for name in sorted(set(base) & set(cur)):
+        for key in sorted(set(base[name]) & set(cur[name])):
+            b = base[name][key]
+            c = cur[name][key]
+            if b == 0:
+                continue
+            change = (c - b) / b * 100.0
+            # positive is worse
+            worse = -change if key.endswith(RATE_SUFFIXES) else change
+            flag = ""
+            if worse > args.threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            print("%-50s %-20s %14.4g %14.4g %+7.2f%%%s" % (
+                name, key, b, c, change, flag))
+    for name in sorted(set(base) - set(cur)):
+        print("%-50s missing from current report" % name)
+
+    if regressions:
+        print("%d regression(s) over %.1f%%" % (regressions, args.threshold))
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -7,6 +7,7 @@
 #include <vector>
 #include <array>
 #include <bitset>
+#include <deque>
 #include <memory>
 #include <string>
 #include <vector>
@@ -82,6 +83,85 @@ struct avr_instr_t
     uint8_t m2;
 };
 
+struct profiler_callgraph_t;
+struct history_worker_t;
+struct history_worker_deleter_t
+{
+    void operator()(history_worker_t* w) const;
+};
+struct elf_debug_loader_t;
+struct elf_debug_loader_deleter_t
+{
+    void operator()(elf_debug_loader_t* l) const;
+};
+struct trace_recorder_t;
+struct trace_recorder_deleter_t
+{
+    void operator()(trace_recorder_t* r) const;
+};
+struct movie_t;
+struct movie_deleter_t
+{
+    void operator()(movie_t* m) const;
+};
+struct trace_write_t
+{
+    uint16_t addr;
+    uint8_t value;
+};
+
+// runtime counters: cheap enough to stay compiled in. they only increase
+// (time travel replays count again) and are not part of savestates.
+// merged instrs are added once per batch; instr_counts and
+// merged_batch_lengths are only kept while atmega32u4_t::count_instrs is set
+struct cpu_stats_t
+{
+    // instruction dispatches (a fused merged instr counts once)
+    uint64_t unmerged_instrs = 0;
+    uint64_t merged_instrs = 0;
+
+    // merged execution batches and why each one ended
+    uint64_t merged_batches = 0;
+    uint64_t merged_exit_io = 0;       // io register access or autobreak
+    uint64_t merged_exit_deadline = 0; // reached the next queued peripheral event
+    uint64_t merged_exit_limit = 0;    // reached MAX_MERGED_CYCLES
+
+    std::array<uint64_t, NUM_PQ> queue_pops = {};
+
+    // dispatches per instr_id_t (names in INSTR_ID_NAMES)
+    std::array<uint64_t, NUM_INSTR> instr_counts = {};
+
+    // merged batches by length: bucket n counts batches of [2^n, 2^(n+1))
+    // instrs, the last bucket everything longer
+    static constexpr size_t MERGED_BATCH_BUCKETS = 12;
+    std::array<uint64_t, MERGED_BATCH_BUCKETS> merged_batch_lengths = {};
+    void add_merged_batch(uint64_t instrs)
+    {
+        size_t b = 0;
+        while(instrs > 1 && b + 1 < MERGED_BATCH_BUCKETS)
+            instrs >>= 1, ++b;
+        ++merged_batch_lengths[b];
+    }
+
+    // interrupts taken per vector (vector word address / 2)
+    static constexpr size_t NUM_VECTORS = 43;
+    std::array<uint64_t, NUM_VECTORS> interrupts = {};
+};
+
+// runtime counters for the rest of the system (see cpu_stats_t)
+struct arduboy_stats_t
+{
+    // bytes sent over SPI while each device was selected
+    uint64_t spi_display_bytes = 0;
+    uint64_t spi_fx_bytes = 0;
+
+    // time-travel checkpoints encoded, their encoded bytes and the time
+    // spent encoding them
+    uint64_t history_checkpoints = 0;
+    uint64_t history_bytes = 0;
+    uint64_t history_encode_ns = 0;
+};
+
 struct atmega32u4_t
 {
     static constexpr size_t PROG_SIZE_BYTES = 32 * 1024;
@@ -257,16 +337,36 @@ struct atmega32u4_t
     std::array<ld_handler_t, 256> ld_handlers;
     std::array<st_handler_t, 256> st_handlers;
 
+#ifndef ARDENS_NO_DEBUGGER
+    // data watchpoints: accesses to a watched page record just_read /
+    // just_written and end the merged block
+    static constexpr int WATCH_PAGE_SHIFT = 5;
+    static constexpr uint8_t WATCH_RD = 1;
+    static constexpr uint8_t WATCH_WR = 2;
+    std::array<uint8_t, (65536 >> WATCH_PAGE_SHIFT)> watch_pages;
+
+    // data space stores are appended here while an execution trace is
+    // recorded (merged instructions are disabled then)
+    std::vector<trace_write_t>* trace_writes = nullptr;
+#endif
+
     template<bool merged>
     ARDENS_FORCEINLINE uint8_t ld(uint16_t ptr)
     {
         check_deref(ptr);
         if(!merged)
             just_read = ptr;
+#ifndef ARDENS_NO_DEBUGGER
+        if(watch_pages[ptr >> WATCH_PAGE_SHIFT] & WATCH_RD)
+        {
+            just_read = ptr;
+            io_reg_accessed = true;
+        }
+#endif
         if(ptr < ld_handlers.size())
         {
-            if(merged)
-                io_reg_accessed = true;
+            // unmerged instrs (push, pop, ...) also run in merged blocks
+            io_reg_accessed = true;
             if(ld_handlers[ptr])
                 return ld_handlers[ptr](*this, ptr);
         }
@@ -279,10 +379,19 @@ struct atmega32u4_t
         check_deref(ptr);
         if(!merged)
             just_written = ptr;
+#ifndef ARDENS_NO_DEBUGGER
+        if(!merged && trace_writes)
+            trace_writes->push_back({ ptr, x });
+        if(watch_pages[ptr >> WATCH_PAGE_SHIFT] & WATCH_WR)
+        {
+            just_written = ptr;
+            io_reg_accessed = true;
+        }
+#endif
         if(ptr < st_handlers.size())
         {
-            if(merged)
-                io_reg_accessed = true;
+            // unmerged instrs (push, pop, ...) also run in merged blocks
+            io_reg_accessed = true;
             if(st_handlers[ptr])
                 return st_handlers[ptr](*this, ptr, x);
         }
@@ -455,6 +564,19 @@ struct atmega32u4_t
 
     uint16_t executing_instr_pc;
 
+#ifndef ARDENS_NO_DEBUGGER
+    // num_stack_frames when executing_instr_pc was set (not saved)
+    uint32_t executing_stack_depth;
+
+    // when set, merged execution charges cycles to this per-instruction
+    // array (and the call graph) itself and sets merged_cycles_profiled
+    uint64_t* merged_profiler_counts;
+    profiler_callgraph_t* merged_profiler_callgraph;
+    bool merged_cycles_profiled;
+    void profile_merged_instr(
+        uint16_t instr_pc, uint32_t stack_depth, avr_instr_t i, uint32_t cycles);
+#endif
+
     static constexpr size_t MAX_STACK_FRAMES = 1280;
     struct stack_frame_t 
     {
@@ -491,6 +613,9 @@ struct atmega32u4_t
     uint16_t num_instrs;
     uint16_t num_instrs_total;
     bool no_merged;
+    // merged batches end before this cycle, so that a step boundary falls
+    // on it whenever one did in unmerged execution (movie playback)
+    uint64_t merged_limit_cycle = UINT64_MAX;
     std::array<avr_instr_t, PROG_SIZE_BYTES / 2> decoded_prog;
     std::array<avr_instr_t, PROG_SIZE_BYTES / 2> merged_prog; // decoded and merged instrs
     std::array<disassembled_instr_t, PROG_SIZE_BYTES / 2> disassembled_prog;
@@ -498,6 +623,18 @@ struct atmega32u4_t
     bool decoded;
     void decode();
     void merge_instrs();
+
+#ifndef ARDENS_NO_DEBUGGER
+    // PC breakpoints: these instrs are replaced with INSTR_MERGED_TRAP in
+    // merged_prog, which ends merged execution before executing them
+    std::bitset<PROG_SIZE_BYTES / 2> merged_traps;
+    void set_merged_traps(std::bitset<PROG_SIZE_BYTES / 2> const& traps);
+    void install_merged_traps();
+    bool is_merged_trap(uint32_t addr) const
+    {
+        return addr < merged_traps.size() && merged_traps.test(addr);
+    }
+#endif
     size_t addr_to_disassembled_index(uint16_t addr);
 
     static void st_handle_pin(atmega32u4_t& cpu, uint16_t ptr, uint8_t x);
@@ -506,6 +643,8 @@ struct atmega32u4_t
     static void st_handle_prr0(atmega32u4_t& cpu, uint16_t ptr, uint8_t x);
 
     pqueue peripheral_queue;
+    cpu_stats_t stats;
+    bool count_instrs = false; // per-instr and batch length stats (slower)
 
     // timer0
     struct timer8_t
@@ -694,6 +833,8 @@ struct atmega32u4_t
     uint32_t sound_enabled; // bitmask of pins 1 and 2
     bool sound_pwm;
     int16_t sound_pwm_val;
+    bool sound_stereo; // emit each sample twice (interleaved L/R)
+    bool no_sound; // keep time but emit no samples (fast-forward)
     std::vector<int16_t> sound_buffer;
     static void sound_st_handler_ddrc(atmega32u4_t& cpu, uint16_t ptr, uint8_t x);
     void update_sound();
@@ -818,6 +959,9 @@ struct atmega32u4_t
     // execute at least one cycle (return how many cycles were executed)
     uint32_t advance_cycle();
 
+    // run merged instrs for up to cycles_max cycles (false on invalid pc)
+    template<bool PROFILE, bool COUNT> bool execute_merged(int64_t cycles_max);
+
     // update delayed peripheral states
     void update_all();
 };
@@ -840,6 +984,14 @@ struct display_t
     std::array<std::array<uint8_t, 8192>, MAX_PIXEL_HISTORY> pixels;
     int pixel_history_index;
     bool enable_filter;
+    // rows are scanned but not drawn into pixels (fast-forward)
+    bool no_render;
+
+    // when set, a hash of each completed frame is appended at vsync
+    // (for the host to consume, like cpu.sound_buffer)
+    bool hash_frames;
+    std::vector<uint64_t> frame_hashes;
+    uint64_t frame_hash() const;
 
     // physical display RAM
     std::array<uint8_t, 1024> ram;
@@ -925,6 +1077,8 @@ struct display_t
     // advance controller state by a given time
     // returns true if vsync occurred
     bool advance(uint64_t ps);
+    // out-of-line advance for callers outside the core (benchmarks)
+    bool advance_extern(uint64_t ps);
 };
 
 struct w25q128_t
@@ -939,6 +1093,9 @@ struct w25q128_t
 
     std::bitset<NUM_SECTORS> sectors_modified;
     bool sectors_dirty;
+    // sectors programmed or erased since savedata was last updated
+    // (not saved: rebuilt from sectors_modified when a state is loaded)
+    std::bitset<NUM_SECTORS> sectors_dirty_bits;
 
     bool enabled;
     bool woken_up;
@@ -988,6 +1145,13 @@ struct w25q128_t
     void set_enabled(bool e);
     uint8_t spi_transceive(uint8_t byte);
     void track_page();
+
+    // sectors allocated for written data (runtime counter)
+    uint64_t sector_allocs = 0;
+
+    // exchange n bytes in one chip-select transaction, out of line for
+    // callers outside the core (benchmarks)
+    void spi_transfer(uint8_t const* tx, uint8_t* rx, size_t n);
 };
 
 struct elf_data_symbol_t
@@ -1045,6 +1209,29 @@ struct elf_data_t
     std::vector<uint16_t> data_symbols_sorted;
     std::vector<uint16_t> data_symbols_sorted_size;
 
+    // address -> symbol: the lowest-addressed symbol containing the address,
+    // or else a symbol at exactly that address. stored as disjoint sorted
+    // ranges, built once the symbol maps are complete
+    struct symbol_index_t
+    {
+        struct range_t
+        {
+            uint32_t begin;
+            uint32_t end;
+            elf_data_symbol_t const* sym;
+        };
+        std::vector<range_t> ranges;
+        void build(map_type const& syms);
+        elf_data_symbol_t const* find(uint16_t addr) const;
+    };
+    symbol_index_t text_symbol_index;
+    symbol_index_t data_symbol_index;
+    // text symbol lookup per instruction word
+    std::vector<elf_data_symbol_t const*> pc_symbols;
+    void build_symbol_index();
+    elf_data_symbol_t const* symbol_for_prog_addr(uint16_t addr) const;
+    elf_data_symbol_t const* symbol_for_data_addr(uint16_t addr) const;
+
     struct source_file_t
     {
         std::string filename;
@@ -1063,8 +1250,15 @@ struct elf_data_t
 #ifdef ARDENS_LLVM
     std::unique_ptr<llvm::object::ObjectFile> obj;
     std::unique_ptr<llvm::DWARFContext> dwarf_ctx;
+    // builds the debug info below (from source_files on) in the background
+    std::unique_ptr<elf_debug_loader_t, elf_debug_loader_deleter_t> debug_loader;
 #endif
 
+    // true once the debug info (source lines and files, asm_with_source,
+    // globals, locals and dwarf_ctx) has been built: until then it must not
+    // be accessed. symbols are always available
+    bool debug_ready() const;
+
     struct global_t
     {
         uint64_t cu_offset; // compile unit
@@ -1075,6 +1269,44 @@ struct elf_data_t
     };
     std::map<std::string, global_t, icompare> globals;
 
+    // address -> global: the first global by name containing the address.
+    // stored as disjoint sorted ranges per address space (data, text)
+    struct global_range_t
+    {
+        uint32_t begin;
+        uint32_t end;
+        std::pair<std::string const, global_t> const* global;
+    };
+    std::vector<global_range_t> global_ranges[2];
+    std::pair<std::string const, global_t> const* global_for_addr(
+        uint16_t addr, bool text) const;
+
+    // pc -> local variables in scope, precomputed from the DWARF scopes so
+    // the Locals window doesn't have to walk DIEs every frame. each scope
+    // lists candidate locations in DIE order: per local, the first location
+    // that evaluates to data is used
+    struct local_t
+    {
+        std::string name;
+        uint32_t id;         // DIE offset
+        uint64_t type_cu;    // compile unit of type
+        uint32_t type;       // DIE offset
+    };
+    struct local_loc_t
+    {
+        uint32_t local;      // index into locals
+        std::string expr;    // location expression
+    };
+    struct scope_t
+    {
+        uint32_t begin;      // byte address
+        uint32_t end;
+        std::vector<local_loc_t> locs;
+    };
+    std::vector<local_t> locals;
+    std::vector<scope_t> scopes;
+    scope_t const* scope_for_pc(uint16_t addr) const;
+
     ~elf_data_t(); // only exists for unique_ptr's above
 
 };
@@ -1087,6 +1319,12 @@ struct savedata_t
     std::map<uint32_t, std::array<uint8_t, 4096>> fx_sectors;
     std::bitset<1024> eeprom_modified_bytes;
 
+    // not serialized: bumped on every change so that persistence can skip
+    // data that has not changed (never reset, so that clearing is a change)
+    uint32_t generation;
+    uint32_t eeprom_generation;
+    std::array<uint32_t, w25q128_t::NUM_SECTORS> fx_sector_generation;
+
     template<class A> void serialize(A& a)
     {
         a(game_hash, eeprom, fx_sectors);
@@ -1098,6 +1336,80 @@ struct savedata_t
         eeprom.clear();
         fx_sectors.clear();
         eeprom_modified_bytes.reset();
+        ++generation;
+    }
+};
+
+// calling-context tree built while profiling: one node per distinct chain
+// of functions on the call stack. interrupt handlers start a new chain at
+// the root so their cycles are not charged to whatever they interrupted.
+struct profiler_callgraph_t
+{
+    struct func_t
+    {
+        std::string name;
+        uint16_t addr; // byte address
+        bool isr;
+        // computed by finish()
+        uint64_t self;
+        uint64_t total;
+        uint64_t calls;
+    };
+    struct node_t
+    {
+        uint32_t parent;
+        uint32_t func;
+        uint64_t calls;
+        uint64_t self;
+        uint64_t total; // computed by finish()
+    };
+    static constexpr uint32_t ROOT = 0;
+
+    std::vector<func_t> funcs;
+    std::vector<node_t> nodes; // nodes[ROOT] has no function
+    std::vector<uint32_t> instr_funcs; // function index for each instr
+
+    // find functions from symbols (or call targets without an ELF)
+    void reset(atmega32u4_t const& cpu, elf_data_t const* elf);
+
+    // charge cycles to the instr at pc, which started executing with the
+    // bottom depth frames of the call stack (the frames it may have pushed
+    // or popped, including an interrupt taken after it, are not its own)
+    ARDENS_FORCEINLINE void charge(
+        atmega32u4_t const& cpu, uint16_t pc, uint32_t depth, uint32_t cycles)
+    {
+        // fast path: same stack and function as the previous charge
+        if(depth == frame_cycles.size() &&
+            (depth == 0 || frame_cycles[depth - 1] == cpu.stack_frames[depth - 1].cycle) &&
+            pc < instr_funcs.size() && instr_funcs[pc] == leaf_func)
+        {
+            nodes[leaf_node].self += cycles;
+            return;
+        }
+        charge_stack(cpu, pc, depth, cycles);
+    }
+
+    // compute inclusive costs
+    void finish();
+
+    // folded stacks for flame graph tools, one "f0;f1;f2 cycles" per line
+    std::string folded_stacks() const;
+
+    // callgrind format for KCachegrind
+    std::string callgrind() const;
+
+private:
+    std::unordered_map<uint64_t, uint32_t> children;
+    std::vector<uint64_t> frame_cycles;
+    std::vector<uint32_t> frame_nodes;
+    uint32_t leaf_parent;
+    uint32_t leaf_func;
+    uint32_t leaf_node;
+    uint32_t child(uint32_t parent, uint32_t func);
+    void charge_stack(atmega32u4_t const& cpu, uint16_t pc, uint32_t depth, uint32_t cycles);
+    uint32_t func_parent(uint32_t parent, uint32_t func) const
+    {
+        return funcs[func].isr ? ROOT : parent;
     }
 };
 
@@ -1132,6 +1444,9 @@ struct arduboy_t
     std::vector<uint8_t> fxdata;
     std::vector<uint8_t> fxsave;
     void reload_fx();
+    // put back the loaded contents (bootloader, fxdata, fxsave) of the given
+    // sectors, discarding anything the game wrote to them
+    void reload_fx_sectors(std::bitset<w25q128_t::NUM_SECTORS> const& sectors);
 
     std::unique_ptr<elf_data_t> elf;
     elf_data_symbol_t const* symbol_for_prog_addr(uint16_t addr);
@@ -1174,6 +1489,8 @@ struct arduboy_t
     uint32_t num_hotspots;
     std::vector<hotspot_t> profiler_hotspots_symbol;
 
+    profiler_callgraph_t profiler_callgraph;
+
     void profiler_build_hotspots();
     void profiler_reset();
 
@@ -1189,6 +1506,46 @@ struct arduboy_t
     // paused at breakpoint
     bool paused;
 
+    // runtime instrumentation: stats, cpu.stats and fx.sector_allocs only
+    // increase until reset_stats
+    arduboy_stats_t stats;
+    void reset_stats();
+    // all counters as a JSON object
+    std::string stats_json();
+
+#ifndef ARDENS_NO_DEBUGGER
+    // execution trace recording (see absim_trace.hpp)
+    std::unique_ptr<trace_recorder_t, trace_recorder_deleter_t> trace;
+    // returns error string on failure
+    std::string start_trace(std::string const& filename);
+    void stop_trace();
+#endif
+
+    // input movies (see absim_movie.hpp): a power-on or savestate start and
+    // every change of the button pins, with keyframes for seeking. during
+    // playback the movie's pins override those set by the caller
+    std::unique_ptr<movie_t, movie_deleter_t> movie;
+    // cycle of the next movie event or keyframe to play
+    uint64_t movie_next_cycle = UINT64_MAX;
+    static constexpr uint64_t MOVIE_KEYFRAME_MS = 10000;
+    // these return error string on failure
+    // power_on: reset and start from the current savedata
+    std::string start_movie_recording(bool power_on, uint64_t keyframe_ms = MOVIE_KEYFRAME_MS);
+    std::string stop_movie_recording(std::ostream& f);
+    std::string start_movie_playback(std::istream& f);
+    // play from the start or nearest keyframe as if advanced to cycle
+    // from the start of the movie
+    std::string seek_movie(uint64_t cycle);
+    // playback also puts back the savedata, eeprom and fx from before it
+    void stop_movie();
+    // playing back a movie, including after it has finished: saves are not
+    // persisted until it is stopped
+    bool is_playing_movie() const;
+    // records or plays inputs at the start of advance
+    void update_movie();
+    // plays events and checks keyframes reached during advance
+    void play_movie_events();
+
     // saved data
     savedata_t savedata;
     bool savedata_dirty;
@@ -1202,25 +1559,75 @@ struct arduboy_t
         uint8_t pinb, pine, pinf;
         bool operator<(inputs_t const& other) { return cycle < other.cycle; }
     };
-    std::vector<inputs_t> input_history;
+    std::deque<inputs_t> input_history;
+    // checkpoints are keyframes (fast-compressed flat savestates) or run-length
+    // coded deltas against the latest keyframe. a keyframe is stored every
+    // STATE_HISTORY_KEYFRAME_INTERVAL checkpoints, and deltas older than
+    // STATE_HISTORY_DENSE_CYCLES are thinned so their spacing grows with
+    // their age, up to STATE_HISTORY_MAX_SPACING. checkpoints are encoded by
+    // history_worker and appended to state_history with a delay: call
+    // wait_for_history before reading it
     struct tt_state_t
     {
         uint64_t cycle;
+        bool keyframe;
         std::vector<uint8_t> state;
     };
-    std::vector<tt_state_t> state_history;
+    std::deque<tt_state_t> state_history;
+    std::unique_ptr<history_worker_t, history_worker_deleter_t> history_worker;
+    uint64_t history_next_cycle;
+    size_t history_keyframe_countdown;
     uint64_t history_size;
     std::vector<uint8_t> present_state;
     uint64_t present_cycle;
     static constexpr uint64_t STATE_HISTORY_CYCLES = 0x100000;
-    static constexpr uint64_t STATE_HISTORY_TOTAL_MS = 60000;
+    static constexpr uint64_t STATE_HISTORY_TOTAL_MS = 600000;
     static constexpr uint64_t STATE_HISTORY_TOTAL_CYCLES =
         STATE_HISTORY_TOTAL_MS * 16000;
+    static constexpr uint64_t STATE_HISTORY_DENSE_CYCLES = STATE_HISTORY_CYCLES * 32;
+    static constexpr uint64_t STATE_HISTORY_MAX_SPACING = STATE_HISTORY_CYCLES * 16;
+    static constexpr size_t STATE_HISTORY_KEYFRAME_INTERVAL = 16;
+
+    // reverse stepping: a window of a checkpoint interval is replayed once
+    // into a journal of its instructions, with an uncompressed keyframe every
+    // JOURNAL_KEYFRAME_INSTRS instructions. stepping back within the window
+    // then replays at most that many instructions from the nearest keyframe
+    struct tt_instr_t
+    {
+        uint64_t cycle;
+        uint16_t pc;
+        uint16_t stack_depth;
+        uint8_t pinb, pine, pinf;
+    };
+    struct tt_journal_t
+    {
+        // checkpoint interval being journaled
+        uint64_t segment_cycle;
+        uint64_t segment_end;
+        // states at the start of each window of the interval replayed so far
+        std::vector<std::vector<uint8_t>> window_states;
+        // journaled window
+        size_t window;
+        std::vector<tt_instr_t> instrs;
+        std::vector<std::vector<uint8_t>> keyframes;
+        void clear()
+        {
+            segment_cycle = segment_end = 0;
+            window_states.clear();
+            window = SIZE_MAX;
+            instrs.clear();
+            keyframes.clear();
+        }
+    };
+    tt_journal_t tt_journal;
+    static constexpr uint64_t JOURNAL_WINDOW_CYCLES = STATE_HISTORY_CYCLES;
+    static constexpr size_t JOURNAL_KEYFRAME_INSTRS = 8192;
 
     // time-travel debugging
-    void save_state_to_vector(std::vector<uint8_t>& v);
+    void save_state_to_vector(std::vector<uint8_t>& v, bool compress = true);
     void load_state_from_vector(std::vector<uint8_t> const& v);
     void update_history();
+    void wait_for_history();
     void travel_back_to_cycle(uint64_t cycle);
     void travel_back_single_instr();
     void travel_back_single_instr_over();
@@ -1229,6 +1636,35 @@ struct arduboy_t
     void travel_continue();
     bool is_present_state();
 
+    // run-ahead: emulation is kept runahead_frames frames past the confirmed
+    // state by predicting that the inputs will not change. when they do, the
+    // uncompressed confirmed checkpoint is restored and the frames are rerun
+    struct runahead_frame_t
+    {
+        uint8_t pinb, pine, pinf;
+        uint64_t ps_rem;
+        std::vector<uint8_t> state;
+        std::vector<int16_t> sound;
+        bool savedata_pending; // wrote eeprom / fx (held until rerun)
+    };
+    uint32_t runahead_frames;
+    runahead_frame_t runahead_confirmed;
+    std::vector<runahead_frame_t> runahead_queue;
+    uint64_t runahead_mispredictions;
+    // set while running predicted frames: their eeprom / fx writes are not
+    // copied to savedata (the dirty flags stay set in their states)
+    bool runahead_speculating;
+    void runahead_reset();
+    // replaces advance(): sets the button pins and leaves the confirmed
+    // frame's sound in cpu.sound_buffer but the predicted display
+    void advance_runahead(uint64_t ps, uint8_t pinb, uint8_t pine, uint8_t pinf);
+
+    // fast-forward: advance without sound, the display filter or current
+    // limiting, drawing only the rows of the last TURBO_RENDER_PS (or none
+    // when render is false, to chain calls)
+    static constexpr uint64_t TURBO_RENDER_PS = 20000000000ull;
+    void advance_turbo(uint64_t ps, bool render = true);
+
     arduboy_config_t cfg;
     bool flashcart_loaded;
     void reset();
@@ -1238,6 +1674,11 @@ struct arduboy_t
 
     void advance_instr();
 
+    // execute one cpu step (an instruction, a merged instruction batch, or
+    // a period of sleep) and its peripheral updates, for differential
+    // testing of execution engines (returns how many cycles were advanced)
+    uint32_t step();
+
     // each cycle is 62.5 ns
     static constexpr uint64_t CYCLE_PS = 62500;
     static constexpr uint64_t PS_BUFFER = CYCLE_PS * 256 * 64;
@@ -1249,6 +1690,8 @@ struct arduboy_t
 
     // returns an error string on error or empty string on success
     std::string load_file(char const* filename, std::istream& f, bool save = false);
+    // parses in place from a buffer (e.g., an already loaded file)
+    std::string load_file(char const* filename, uint8_t const* data, size_t size, bool save = false);
 
     std::string load_bootloader_hex(std::istream& f);
     std::string load_bootloader_hex(uint8_t const* data, size_t size);
@@ -1261,6 +1704,14 @@ struct arduboy_t
     // savestates only contain device state and are not compressed (e.g., for RetroArch)
     std::string save_savestate(std::ostream& f);
     std::string load_savestate(std::istream& f);
+
+    // flat savestates are uncompressed memory images of the same device state,
+    // fast enough to be taken every frame. the size only grows as the game
+    // modifies more fx sectors
+    size_t savestate_flat_size();
+    std::string save_savestate_flat(void* data, size_t size);
+    std::string load_savestate_flat(void const* data, size_t size);
+    static bool is_savestate_flat(void const* data, size_t size);
 };
 
 
@@ -1288,7 +1739,10 @@ template<class T> size_t array_bytes(T const& a)
     return a.size() * sizeof(*a.data());
 }
 
-bool compress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_bytes);
+// fast trades compression ratio for speed
+bool compress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_bytes, bool fast = false);
+void save_savedata(std::ostream& f, savedata_t& d);
+bool load_savedata(std::istream& f, savedata_t& d);
 bool uncompress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_bytes);
 
 }
@@ -8,7 +8,11 @@
 
 #include "absim_atmega32u4.hpp"
 #include "absim_display.hpp"
+#include "absim_history.hpp"
 #include "absim_strstream.hpp"
+#include "absim_trace.hpp"
+
+#include <yyjson/yyjson.h>
 
 extern "C"
 {
@@ -57,11 +61,95 @@ void arduboy_t::reload_fx()
     }
 }
 
+// write the part of [offset, offset + n) that lies in sector i
+static void write_fx_sector_part(
+    w25q128_t& fx, size_t i, size_t offset, uint8_t const* data, size_t n)
+{
+    size_t begin = std::max(i * w25q128_t::SECTOR_BYTES, offset);
+    size_t end = std::min((i + 1) * w25q128_t::SECTOR_BYTES, offset + n);
+    if(begin < end)
+        fx.write_bytes(begin, data + (begin - offset), end - begin);
+}
+
+void arduboy_t::reload_fx_sectors(std::bitset<w25q128_t::NUM_SECTORS> const& sectors)
+{
+    if(sectors.none())
+        return;
+
+    // same layout as reload_fx
+    size_t fxsave_bytes = (fxsave.size() + 4095) & ~4095;
+    size_t fxdata_bytes = (fxdata.size() + 255) & ~255;
+    size_t fxsave_offset = w25q128_t::DATA_BYTES - fxsave_bytes;
+    size_t fxdata_offset = flashcart_loaded ? 0 : fxsave_offset - fxdata_bytes;
+
+    for(size_t i = 0; i < fx.NUM_SECTORS; ++i)
+    {
+        if(!sectors.test(i)) continue;
+        fx.sectors[i].reset();
+        write_fx_sector_part(fx, i, 0,
+            ARDENS_BOOT_FLASHCART, sizeof(ARDENS_BOOT_FLASHCART));
+        write_fx_sector_part(fx, i, fxdata_offset, fxdata.data(), fxdata.size());
+        if(!flashcart_loaded)
+            write_fx_sector_part(fx, i, fxsave_offset, fxsave.data(), fxsave.size());
+    }
+}
+
+bool display_t::advance_extern(uint64_t ps)
+{
+    return advance(ps);
+}
+
+void w25q128_t::spi_transfer(uint8_t const* tx, uint8_t* rx, size_t n)
+{
+    set_enabled(true);
+    for(size_t i = 0; i < n; ++i)
+    {
+        uint8_t t = spi_transceive(tx ? tx[i] : 0);
+        if(rx) rx[i] = t;
+    }
+    set_enabled(false);
+}
+
+// FNV-1a 64-bit
+static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+// FNV-1a over an erased (0xff) sector in constant time. Each step is
+// h' = (h + d) * PRIME, where d = (lo ^ 0xff) - lo only depends on the low
+// byte lo of h, and so does the next low byte. A whole sector is then
+// h' = h * PRIME^4096 + C[lo], with C found by hashing from h = lo.
+struct fnv_erased_sector_t
+{
+    uint64_t prime_pow;
+    std::array<uint64_t, 256> c;
+
+    fnv_erased_sector_t()
+    {
+        prime_pow = 1;
+        for(size_t i = 0; i < w25q128_t::SECTOR_BYTES; ++i)
+            prime_pow *= FNV_PRIME;
+        for(uint64_t lo = 0; lo < 256; ++lo)
+        {
+            uint64_t h = lo;
+            for(size_t i = 0; i < w25q128_t::SECTOR_BYTES; ++i)
+            {
+                h ^= 0xff;
+                h *= FNV_PRIME;
+            }
+            c[lo] = h - lo * prime_pow;
+        }
+    }
+
+    uint64_t operator()(uint64_t h) const
+    {
+        return h * prime_pow + c[h & 0xff];
+    }
+};
+
 void arduboy_t::update_game_hash()
 {
-    // FNV-1a 64-bit
-    constexpr uint64_t OFFSET = 0xcbf29ce484222325;
-    constexpr uint64_t PRIME = 0x100000001b3;
+    constexpr uint64_t OFFSET = FNV_OFFSET;
+    constexpr uint64_t PRIME = FNV_PRIME;
     uint64_t h = OFFSET;
     if(!flashcart_loaded)
     {
@@ -83,22 +171,103 @@ void arduboy_t::update_game_hash()
         h ^= 0xff;
         h *= PRIME;
     }
-    for(size_t i = sizeof(ARDENS_BOOT_FLASHCART); i < fx.DATA_BYTES; ++i)
+    static fnv_erased_sector_t const erased_sector;
+    for(size_t i = sizeof(ARDENS_BOOT_FLASHCART); i < fx.DATA_BYTES;)
     {
-        h ^= fx.read_byte(i); // TODO: optimize?
-        h *= PRIME;
+        size_t byte_index = i % fx.SECTOR_BYTES;
+        auto const& sector = fx.sectors[i / fx.SECTOR_BYTES];
+        if(!sector && byte_index == 0)
+        {
+            h = erased_sector(h);
+            i += fx.SECTOR_BYTES;
+            continue;
+        }
+        for(; byte_index < fx.SECTOR_BYTES; ++byte_index, ++i)
+        {
+            h ^= sector ? (*sector)[byte_index] : 0xff;
+            h *= PRIME;
+        }
     }
 
     game_hash = h;
 }
 
+void arduboy_t::reset_stats()
+{
+    stats = {};
+    cpu.stats = {};
+    fx.sector_allocs = 0;
+}
+
+std::string arduboy_t::stats_json()
+{
+#ifndef ARDENS_NO_DEBUGGER
+    if(history_worker)
+        history_worker->collect(*this);
+#endif
+    auto const& cs = cpu.stats;
+    yyjson_mut_doc* doc = yyjson_mut_doc_new(nullptr);
+    yyjson_mut_val* root = yyjson_mut_obj(doc);
+    yyjson_mut_doc_set_root(doc, root);
+
+    yyjson_mut_obj_add_uint(doc, root, "cycles", cpu.cycle_count);
+    yyjson_mut_obj_add_uint(doc, root, "unmerged_instrs", cs.unmerged_instrs);
+    yyjson_mut_obj_add_uint(doc, root, "merged_instrs", cs.merged_instrs);
+    yyjson_mut_obj_add_uint(doc, root, "merged_batches", cs.merged_batches);
+    yyjson_mut_obj_add_uint(doc, root, "merged_exit_io", cs.merged_exit_io);
+    yyjson_mut_obj_add_uint(doc, root, "merged_exit_deadline", cs.merged_exit_deadline);
+    yyjson_mut_obj_add_uint(doc, root, "merged_exit_limit", cs.merged_exit_limit);
+
+    auto* lengths = yyjson_mut_obj_add_arr(doc, root, "merged_batch_lengths");
+    for(auto n : cs.merged_batch_lengths)
+        yyjson_mut_arr_add_uint(doc, lengths, n);
+
+    auto* instrs = yyjson_mut_obj_add_obj(doc, root, "instrs");
+    for(size_t i = 0; i < cs.instr_counts.size(); ++i)
+        if(cs.instr_counts[i] != 0)
+            yyjson_mut_obj_add_uint(doc, instrs, INSTR_ID_NAMES[i], cs.instr_counts[i]);
+
+    auto* pops = yyjson_mut_obj_add_obj(doc, root, "queue_pops");
+    for(size_t i = 0; i < cs.queue_pops.size(); ++i)
+        if(cs.queue_pops[i] != 0)
+            yyjson_mut_obj_add_uint(doc, pops, PQUEUE_TYPE_NAMES[i], cs.queue_pops[i]);
+
+    // indexed by vector number
+    auto* ints = yyjson_mut_obj_add_arr(doc, root, "interrupts");
+    for(auto n : cs.interrupts)
+        yyjson_mut_arr_add_uint(doc, ints, n);
+
+    yyjson_mut_obj_add_uint(doc, root, "spi_display_bytes", stats.spi_display_bytes);
+    yyjson_mut_obj_add_uint(doc, root, "spi_fx_bytes", stats.spi_fx_bytes);
+    yyjson_mut_obj_add_uint(doc, root, "fx_sector_allocs", fx.sector_allocs);
+    yyjson_mut_obj_add_uint(doc, root, "history_checkpoints", stats.history_checkpoints);
+    yyjson_mut_obj_add_uint(doc, root, "history_bytes", stats.history_bytes);
+    yyjson_mut_obj_add_uint(doc, root, "history_encode_ns", stats.history_encode_ns);
+
+    std::string r;
+    size_t len = 0;
+    if(char* json = yyjson_mut_write(doc, YYJSON_WRITE_PRETTY, &len))
+    {
+        r.assign(json, len);
+        free(json);
+    }
+    yyjson_mut_doc_free(doc);
+    return r;
+}
+
 void arduboy_t::reset()
 {
+    wait_for_history();
     input_history.clear();
     state_history.clear();
+    history_next_cycle = 0;
+    history_keyframe_countdown = 0;
     history_size = 0;
     present_state.clear();
     present_cycle = 0;
+    tt_journal.clear();
+    runahead_reset();
+    stop_movie();
 
     profiler_reset();
     frame_cpu_usage.clear();
@@ -144,30 +313,16 @@ void arduboy_t::reset()
         cpu.decode();
 }
 
-static elf_data_symbol_t const* symbol_for_addr_helper(
-    elf_data_t::map_type const& syms, uint16_t addr)
-{
-    for(auto const& kv : syms)
-    {
-        auto const& sym = kv.second;
-        if(addr >= sym.addr && addr < sym.addr + sym.size)
-            return &sym;
-    }
-    auto it = syms.find(addr);
-    if(it != syms.end()) return &it->second;
-    return nullptr;
-}
-
 elf_data_symbol_t const* arduboy_t::symbol_for_prog_addr(uint16_t addr)
 {
     if(!elf) return nullptr;
-    return symbol_for_addr_helper(elf->text_symbols, addr);
+    return elf->symbol_for_prog_addr(addr);
 }
 
 elf_data_symbol_t const* arduboy_t::symbol_for_data_addr(uint16_t addr)
 {
     if(!elf) return nullptr;
-    return symbol_for_addr_helper(elf->data_symbols, addr);
+    return elf->symbol_for_data_addr(addr);
 }
 
 void arduboy_t::profiler_reset()
@@ -181,6 +336,7 @@ void arduboy_t::profiler_reset()
     prev_profiler_total = 0;
     prev_profiler_total_with_sleep = 0;
     profiler_enabled = false;
+    profiler_callgraph.reset(cpu, elf.get());
     frame_bytes = 0;
 }
 
@@ -189,6 +345,8 @@ void arduboy_t::profiler_build_hotspots()
     if(!cpu.decoded) return;
     if(cpu.num_instrs <= 0) return;
 
+    profiler_callgraph.finish();
+
     // group symbol hotspots
     profiler_hotspots_symbol.clear();
     if(elf)
@@ -418,6 +576,11 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
     bool vsync = false;
     uint8_t displayport = cpu.data[0x2b];
     uint8_t fxport = cpu.data[fxport_reg];
+#ifndef ARDENS_NO_DEBUGGER
+    uint16_t trace_pc = cpu.pc;
+    bool trace_instr = cpu.active;
+    int trace_spi = -1;
+#endif
 
     uint32_t cycles = cpu.advance_cycle();
 
@@ -428,10 +591,14 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
     if(cpu.spi_data_latched)
     {
         uint8_t byte = cpu.spi_data_byte;
+#ifndef ARDENS_NO_DEBUGGER
+        trace_spi = byte;
+#endif
 
         // display enabled?
         if(!(displayport & (1 << 6)))
         {
+            ++stats.spi_display_bytes;
             if(displayport & (1 << 4))
             {
                 if(frame_bytes_total != 0 && ++frame_bytes >= frame_bytes_total)
@@ -445,6 +612,8 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
                 display.send_command(byte);
         }
 
+        if(fx.enabled)
+            ++stats.spi_fx_bytes;
         bool was_erasing = (fx.erasing_sector != 0);
         cpu.spi_datain_byte = fx.spi_transceive(byte);
         if(fx.busy_error)
@@ -453,15 +622,29 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
     }
 
 #ifndef ARDENS_NO_DEBUGGER
+    if(trace)
+    {
+        if(is_present_state())
+            trace->record(cpu, trace_pc, trace_instr, trace_spi);
+        else
+            trace->writes.clear();
+    }
+
+    // merged execution has already charged its cycles per instruction
+    bool merged_cycles_profiled = cpu.merged_cycles_profiled;
+    cpu.merged_cycles_profiled = false;
     if(is_present_state())
     {
         profiler_total_with_sleep += cycles;
         if(cpu.active || cpu.wakeup_cycles != 0)
         {
             profiler_total += cycles;
-            if(profiler_enabled && cpu.executing_instr_pc < profiler_counts.size())
+            if(profiler_enabled && !merged_cycles_profiled &&
+                cpu.executing_instr_pc < profiler_counts.size())
             {
                 profiler_counts[cpu.executing_instr_pc] += cycles;
+                profiler_callgraph.charge(cpu,
+                    cpu.executing_instr_pc, cpu.executing_stack_depth, cycles);
             }
         }
     }
@@ -470,7 +653,9 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
     {
         auto cycles_ps = cycles * CYCLE_PS;
         bool actual_vsync = false;
-        if((cpu.PORTD() & (1 << 7)) != 0)
+        // use the display reset line from before the step, so merged
+        // execution charges its cycles the same way as unmerged
+        if((displayport & (1 << 7)) != 0)
         {
             actual_vsync = display.advance(cycles_ps);
             prev_display_reset = false;
@@ -548,35 +733,71 @@ ARDENS_FORCEINLINE uint32_t arduboy_t::cycle()
     return cycles;
 }
 
-void arduboy_t::save_state_to_vector(std::vector<uint8_t>& v)
+void arduboy_t::save_state_to_vector(std::vector<uint8_t>& v, bool compress)
 {
-    std::ostringstream ss;
-    save_savestate(ss);
-    auto s = ss.str();
+    size_t size = savestate_flat_size();
 #if COMPRESS_TIME_TRAVEL_STATES
-    if(!compress_zlib(v, s.data(), s.size()))
-        v.clear();
-#else
-    v.resize(s.size());
-    memcpy(v.data(), s.data(), v.size());
+    if(compress)
+    {
+        std::vector<uint8_t> s(size);
+        save_savestate_flat(s.data(), s.size());
+        if(!compress_zlib(v, s.data(), s.size(), true))
+            v.clear();
+        return;
+    }
 #endif
+    v.resize(size);
+    save_savestate_flat(v.data(), v.size());
 }
 
 void arduboy_t::load_state_from_vector(std::vector<uint8_t> const& v)
 {
     if(v.empty())
         return;
-#if COMPRESS_TIME_TRAVEL_STATES
+    if(is_savestate_flat(v.data(), v.size()))
+    {
+        load_savestate_flat(v.data(), v.size());
+        return;
+    }
     std::vector<uint8_t> v_uncomp;
     if(!uncompress_zlib(v_uncomp, v.data(), v.size()))
         return;
-    absim::istrstream ss((char const*)v_uncomp.data(), v_uncomp.size());
-#else
-    absim::istrstream ss((char const*)v.data(), v.size());
-#endif
-    load_savestate(ss);
+    load_savestate_flat(v_uncomp.data(), v_uncomp.size());
+}
+
+static bool load_history_state(arduboy_t& a, size_t i)
+{
+    std::vector<uint8_t> s;
+    if(!decode_history_state(a, i, s))
+        return false;
+    return a.load_savestate_flat(s.data(), s.size()).empty();
 }
 
+#ifndef ARDENS_NO_DEBUGGER
+// space deltas roughly in proportion to their age: keyframes are kept
+static void thin_history(arduboy_t& a)
+{
+    auto& h = a.state_history;
+    uint64_t cycle = a.cpu.cycle_count;
+    for(size_t i = h.size() - 1; i-- > 1; )
+    {
+        if(h[i].keyframe)
+            continue;
+        uint64_t age = cycle - h[i].cycle;
+        if(age <= arduboy_t::STATE_HISTORY_DENSE_CYCLES)
+            continue;
+        uint64_t spacing = std::min(
+            arduboy_t::STATE_HISTORY_CYCLES * age / arduboy_t::STATE_HISTORY_DENSE_CYCLES,
+            arduboy_t::STATE_HISTORY_MAX_SPACING);
+        if(h[i + 1].cycle - h[i - 1].cycle <= spacing)
+        {
+            a.history_size -= h[i].state.size();
+            h.erase(h.begin() + i);
+        }
+    }
+}
+#endif
+
 void arduboy_t::update_history()
 {
 #ifndef ARDENS_NO_DEBUGGER
@@ -599,37 +820,160 @@ void arduboy_t::update_history()
             input_history.push_back(state);
         }
     }
-    if(state_history.empty() ||
-        cpu.cycle_count >= state_history.back().cycle + STATE_HISTORY_CYCLES)
+    if(!history_worker)
+        history_worker.reset(new history_worker_t);
+    if(cpu.cycle_count >= history_next_cycle)
     {
-        tt_state_t state;
-        state.cycle = cpu.cycle_count;
-        save_state_to_vector(state.state);
-        history_size += state.state.size();
-        state_history.emplace_back(std::move(state));
+        bool keyframe = history_keyframe_countdown == 0;
+        history_keyframe_countdown = keyframe ?
+            STATE_HISTORY_KEYFRAME_INTERVAL - 1 :
+            history_keyframe_countdown - 1;
+        history_next_cycle = cpu.cycle_count + STATE_HISTORY_CYCLES;
+        history_worker->push(*this, keyframe);
     }
+    if(history_worker->collect(*this))
+        thin_history(*this);
     while(input_history.size() >= 2 &&
         input_history[1].cycle + STATE_HISTORY_TOTAL_CYCLES < cpu.cycle_count)
     {
-        input_history.erase(input_history.begin());
+        input_history.pop_front();
     }
-    while(state_history.size() >= 2 &&
-        state_history[1].cycle + STATE_HISTORY_TOTAL_CYCLES < cpu.cycle_count)
+    // drop the oldest keyframe together with its deltas
+    for(;;)
     {
-        state_history.erase(state_history.begin());
+        size_t k = 1;
+        while(k < state_history.size() && !state_history[k].keyframe)
+            ++k;
+        if(k >= state_history.size() ||
+            state_history[k].cycle + STATE_HISTORY_TOTAL_CYCLES >= cpu.cycle_count)
+            break;
+        for(size_t i = 0; i < k; ++i)
+            history_size -= state_history[i].state.size();
+        state_history.erase(state_history.begin(), state_history.begin() + k);
     }
 #endif
 }
 
-struct pc_hist_t
+void arduboy_t::wait_for_history()
 {
-    uint64_t cycle;
-    uint16_t pc;
-    uint16_t stack_depth;
-    uint8_t pinb;
-    uint8_t pine;
-    uint8_t pinf;
-};
+    if(history_worker)
+        history_worker->fence(*this);
+}
+
+void arduboy_t::runahead_reset()
+{
+    runahead_queue.clear();
+    runahead_confirmed.state.clear();
+}
+
+static void runahead_set_pins(arduboy_t& a, arduboy_t::runahead_frame_t const& f)
+{
+    a.cpu.data[0x23] = f.pinb;
+    a.cpu.data[0x2c] = f.pine;
+    a.cpu.data[0x2f] = f.pinf;
+}
+
+// run one frame and keep it: the frame's sound goes into f instead of the
+// output buffer, and the state after the frame is checkpointed
+static void runahead_frame(arduboy_t& a, arduboy_t::runahead_frame_t& f, uint64_t ps)
+{
+    f.sound.clear();
+    std::swap(a.cpu.sound_buffer, f.sound);
+    runahead_set_pins(a, f);
+    a.runahead_speculating = true;
+    a.advance(ps);
+    a.runahead_speculating = false;
+    f.savedata_pending = a.cpu.eeprom_dirty || a.fx.sectors_dirty;
+    std::swap(a.cpu.sound_buffer, f.sound);
+    f.ps_rem = a.ps_rem;
+    a.save_state_to_vector(f.state, false);
+}
+
+void arduboy_t::advance_runahead(uint64_t ps, uint8_t pinb, uint8_t pine, uint8_t pinf)
+{
+    runahead_frame_t in;
+    in.pinb = pinb;
+    in.pine = pine;
+    in.pinf = pinf;
+
+    // rewinds would reach movies and change their inputs
+    if(runahead_frames == 0 || paused || movie)
+    {
+        runahead_reset();
+        runahead_set_pins(*this, in);
+        advance(ps);
+        return;
+    }
+
+    auto& q = runahead_queue;
+    bool predicted =
+        q.size() == runahead_frames &&
+        q[0].pinb == pinb &&
+        q[0].pine == pine &&
+        q[0].pinf == pinf;
+
+    // a predicted frame that saved is rerun as confirmed below so that only
+    // confirmed writes reach savedata
+    if(predicted && !q[0].savedata_pending)
+    {
+        // the oldest predicted frame is now confirmed: extend the prediction
+        // by one frame from the current (latest) state
+        auto& f = q[0];
+        cpu.sound_buffer.insert(cpu.sound_buffer.end(), f.sound.begin(), f.sound.end());
+        std::swap(runahead_confirmed.state, f.state);
+        runahead_confirmed.ps_rem = f.ps_rem;
+        std::rotate(q.begin(), q.begin() + 1, q.end());
+        q.back().pinb = pinb;
+        q.back().pine = pine;
+        q.back().pinf = pinf;
+        runahead_frame(*this, q.back(), ps);
+        return;
+    }
+
+    // misprediction: rewind to the confirmed state and rerun everything
+    if(!runahead_confirmed.state.empty())
+    {
+        load_state_from_vector(runahead_confirmed.state);
+        ps_rem = runahead_confirmed.ps_rem;
+        if(!predicted)
+            ++runahead_mispredictions;
+    }
+    runahead_set_pins(*this, in);
+    advance(ps);
+    runahead_confirmed.ps_rem = ps_rem;
+    save_state_to_vector(runahead_confirmed.state, false);
+
+    q.resize(runahead_frames);
+    for(auto& f : q)
+    {
+        f.pinb = pinb;
+        f.pine = pine;
+        f.pinf = pinf;
+        runahead_frame(*this, f, ps);
+    }
+}
+
+void arduboy_t::advance_turbo(uint64_t ps, bool render)
+{
+    bool filter = display.enable_filter;
+    bool current_limiting = display.enable_current_limiting;
+    display.enable_filter = false;
+    display.enable_current_limiting = false;
+    cpu.no_sound = true;
+
+    uint64_t render_ps = render ? std::min(ps, TURBO_RENDER_PS) : 0;
+    display.no_render = true;
+    advance(ps - render_ps);
+    display.no_render = false;
+    if(render_ps > 0)
+        advance(render_ps);
+
+    cpu.no_sound = false;
+    display.enable_filter = filter;
+    display.enable_current_limiting = current_limiting;
+}
+
+using tt_instr_t = arduboy_t::tt_instr_t;
 
 static void travel_back_advance_instr(arduboy_t& a)
 {
@@ -645,9 +989,98 @@ static void travel_back_advance_instr(arduboy_t& a)
     } while(++n < 65536 && a.cpu.pc == oldpc);
 }
 
+static uint64_t history_segment_end(arduboy_t const& a, size_t si)
+{
+    return si + 1 < a.state_history.size() ?
+        a.state_history[si + 1].cycle : a.present_cycle;
+}
+
+// replay window w of the checkpoint interval starting at state_history[si]
+// into the journal, unless it already holds that window
+static bool build_journal(arduboy_t& a, size_t si, size_t w)
+{
+    constexpr uint64_t WC = arduboy_t::JOURNAL_WINDOW_CYCLES;
+    auto& j = a.tt_journal;
+    uint64_t seg = a.state_history[si].cycle;
+    uint64_t end = history_segment_end(a, si);
+    if(j.segment_cycle != seg || j.segment_end != end || j.window_states.empty())
+    {
+        j.clear();
+        if(!load_history_state(a, si))
+            return false;
+        j.segment_cycle = seg;
+        j.segment_end = end;
+        j.window_states.emplace_back();
+        a.save_state_to_vector(j.window_states.back(), false);
+    }
+    else if(j.window == w)
+        return true;
+
+    // resume from the latest window start replayed so far
+    a.load_state_from_vector(j.window_states[std::min(w, j.window_states.size() - 1)]);
+    size_t ii = size_t(std::upper_bound(
+        a.input_history.begin(), a.input_history.end(), a.cpu.cycle_count,
+        [](uint64_t c, arduboy_t::inputs_t const& i) { return c < i.cycle; }) -
+        a.input_history.begin());
+    if(ii-- == 0)
+        return false;
+
+    j.window = SIZE_MAX;
+    j.instrs.clear();
+    j.keyframes.clear();
+    uint64_t window_end = std::min(end, seg + (w + 1) * WC);
+    while(a.cpu.cycle_count < window_end)
+    {
+        while(ii + 1 < a.input_history.size() && a.input_history[ii + 1].cycle <= a.cpu.cycle_count)
+            ++ii;
+        while(j.window_states.size() <= w &&
+            a.cpu.cycle_count >= seg + j.window_states.size() * WC)
+        {
+            j.window_states.emplace_back();
+            a.save_state_to_vector(j.window_states.back(), false);
+        }
+        bool journaled = j.window_states.size() > w;
+        if(journaled && j.instrs.size() % arduboy_t::JOURNAL_KEYFRAME_INSTRS == 0)
+        {
+            j.keyframes.emplace_back();
+            a.save_state_to_vector(j.keyframes.back(), false);
+        }
+        auto const& input = a.input_history[ii];
+        tt_instr_t p{};
+        p.cycle = a.cpu.cycle_count;
+        p.pc = a.cpu.pc;
+        p.stack_depth = (uint16_t)a.cpu.num_stack_frames;
+        a.cpu.PINB() = p.pinb = input.pinb;
+        a.cpu.PINE() = p.pine = input.pine;
+        a.cpu.PINF() = p.pinf = input.pinf;
+        if(journaled)
+            j.instrs.push_back(p);
+        travel_back_advance_instr(a);
+    }
+    j.window = w;
+    return true;
+}
+
+// restore the state just before the journal's instruction i
+static void travel_to_journal_instr(arduboy_t& a, size_t i)
+{
+    auto const& j = a.tt_journal;
+    size_t k = i / arduboy_t::JOURNAL_KEYFRAME_INSTRS;
+    a.load_state_from_vector(j.keyframes[k]);
+    for(k *= arduboy_t::JOURNAL_KEYFRAME_INSTRS; k < i; ++k)
+    {
+        a.cpu.PINB() = j.instrs[k].pinb;
+        a.cpu.PINE() = j.instrs[k].pine;
+        a.cpu.PINF() = j.instrs[k].pinf;
+        travel_back_advance_instr(a);
+    }
+    a.cpu.update_all();
+}
+
 template<class F>
 static void travel_back_cond(arduboy_t& a, F&& f, uint64_t max_cycle = UINT64_MAX)
 {
+    a.wait_for_history();
     if(a.state_history.empty()) return;
     if(a.input_history.empty()) return;
     if(a.present_state.empty())
@@ -656,60 +1089,38 @@ static void travel_back_cond(arduboy_t& a, F&& f, uint64_t max_cycle = UINT64_MA
         a.present_cycle = a.cpu.cycle_count;
     }
     size_t si = a.state_history.size();
-    std::vector<pc_hist_t> pcs;
     std::vector<uint8_t> temp_state;
-    a.save_state_to_vector(temp_state);
+    a.save_state_to_vector(temp_state, false);
     uint64_t curr_cycle = a.cpu.cycle_count;
     max_cycle = std::min(max_cycle, curr_cycle);
     while(si >= 2 && a.state_history[si - 1].cycle >= max_cycle)
         si -= 1;
-    while(si-- > 0)
-    {
-        auto const& state = a.state_history[si];
-        uint64_t end_cycle = (si + 1 < a.state_history.size() ?
-            a.state_history[si + 1].cycle : a.present_cycle);
-        end_cycle = std::min(end_cycle, curr_cycle);
-        size_t ii = a.input_history.size();
-        while(ii-- > 0)
+    bool ok = true;
+    while(ok && si-- > 0)
+    {
+        uint64_t seg = a.state_history[si].cycle;
+        uint64_t end = std::min(history_segment_end(a, si), max_cycle + 1);
+        size_t w = end > seg ? size_t((end - 1 - seg) / arduboy_t::JOURNAL_WINDOW_CYCLES) + 1 : 0;
+        max_cycle = UINT64_MAX - 1;
+        while(w-- > 0)
         {
-            if(a.input_history[ii].cycle <= state.cycle)
+            if(!build_journal(a, si, w))
+            {
+                ok = false;
                 break;
-        }
-        if(ii >= a.input_history.size())
-            break;
-        a.load_state_from_vector(state.state);
-        pcs.clear();
-        while(a.cpu.cycle_count < end_cycle)
-        {
-            while(ii + 1 < a.input_history.size() && a.input_history[ii + 1].cycle <= a.cpu.cycle_count)
-                ++ii;
-            auto const& input = a.input_history[ii];
-            pc_hist_t p{};
-            p.cycle = a.cpu.cycle_count;
-            p.pc = a.cpu.pc;
-            p.stack_depth = (uint16_t)a.cpu.num_stack_frames;
-            a.cpu.PINB() = p.pinb = input.pinb;
-            a.cpu.PINE() = p.pine = input.pine;
-            a.cpu.PINF() = p.pinf = input.pinf;
-            pcs.push_back(p);
-            travel_back_advance_instr(a);
-        }
-        size_t pi = pcs.size();
-        while(pi-- > 0)
-        {
-            if(f(pcs[pi]))
+            }
+            auto const& instrs = a.tt_journal.instrs;
+            size_t pi = size_t(std::lower_bound(
+                instrs.begin(), instrs.end(), curr_cycle,
+                [](tt_instr_t const& p, uint64_t c) { return p.cycle < c; }) - instrs.begin());
+            while(pi-- > 0)
             {
-                // success
-                a.load_state_from_vector(state.state);
-                for(size_t i = 0; i < pi; ++i)
+                if(f(instrs[pi]))
                 {
-                    a.cpu.PINB() = pcs[i].pinb;
-                    a.cpu.PINE() = pcs[i].pine;
-                    a.cpu.PINF() = pcs[i].pinf;
-                    travel_back_advance_instr(a);
+                    // success
+                    travel_to_journal_instr(a, pi);
+                    return;
                 }
-                a.cpu.update_all();
-                return;
             }
         }
     }
@@ -724,7 +1135,7 @@ static void travel_back_cond(arduboy_t& a, F&& f, uint64_t max_cycle = UINT64_MA
 
 void arduboy_t::travel_back_to_cycle(uint64_t cycle)
 {
-    travel_back_cond(*this, [=](pc_hist_t const& p) {
+    travel_back_cond(*this, [=](tt_instr_t const& p) {
         return p.cycle <= cycle;
     }, cycle);
 }
@@ -732,7 +1143,7 @@ void arduboy_t::travel_back_to_cycle(uint64_t cycle)
 void arduboy_t::travel_back_single_instr()
 {
     uint16_t tpc = cpu.pc;
-    travel_back_cond(*this, [=](pc_hist_t const& p) {
+    travel_back_cond(*this, [=](tt_instr_t const& p) {
         return p.pc != tpc;
     });
 }
@@ -741,7 +1152,7 @@ void arduboy_t::travel_back_single_instr_over()
 {
     uint16_t tpc = cpu.pc;
     uint16_t tsd = cpu.num_stack_frames;
-    travel_back_cond(*this, [=](pc_hist_t const& p) {
+    travel_back_cond(*this, [=](tt_instr_t const& p) {
         return p.pc != tpc && p.stack_depth == tsd;
     });
 }
@@ -753,7 +1164,7 @@ void arduboy_t::travel_back_single_instr_out()
     uint64_t cycle = cpu.stack_frames[tsd - 1].cycle;
     assert(cycle < cpu.cycle_count);
     if(cycle >= cpu.cycle_count) return;
-    travel_back_cond(*this, [=](pc_hist_t const& p) {
+    travel_back_cond(*this, [=](tt_instr_t const& p) {
         return p.stack_depth < tsd;
     }, cycle);
 }
@@ -768,11 +1179,17 @@ void arduboy_t::travel_to_present()
 void arduboy_t::travel_continue()
 {
     if(present_state.empty()) return;
+    wait_for_history();
     present_state.clear();
+    history_next_cycle = 0;
+    history_keyframe_countdown = 0;
+    tt_journal.clear();
     size_t i;
     i = 0;
     while(i < state_history.size() && state_history[i].cycle < cpu.cycle_count)
         ++i;
+    for(size_t j = i; j < state_history.size(); ++j)
+        history_size -= state_history[j].state.size();
     if(i < state_history.size())
         state_history.resize(i);
     i = 0;
@@ -829,8 +1246,43 @@ void arduboy_t::advance_instr()
     } while(++n < 65536 && cpu.pc == oldpc);
 }
 
+uint32_t arduboy_t::step()
+{
+    if(!cpu.decoded) return 0;
+    return cycle();
+}
+
+#ifndef ARDENS_NO_DEBUGGER
+// compile breakpoints into merged execution: PC breakpoints become traps in
+// merged_prog and data watchpoints mark pages in the watch map
+static void update_merged_breakpoints(arduboy_t& a, bool any_watchpoints)
+{
+    auto& cpu = a.cpu;
+
+    std::bitset<arduboy_t::NUM_INSTRS> traps;
+    if(a.allow_nonstep_breakpoints)
+        traps = a.breakpoints;
+    if(a.break_step < traps.size())
+        traps.set(a.break_step);
+    cpu.set_merged_traps(traps);
+
+    cpu.watch_pages.fill(0);
+    if(!any_watchpoints)
+        return;
+    for(size_t i = 0; i < a.breakpoints_rd.size(); ++i)
+    {
+        uint8_t f = 0;
+        if(a.breakpoints_rd.test(i)) f |= atmega32u4_t::WATCH_RD;
+        if(a.breakpoints_wr.test(i)) f |= atmega32u4_t::WATCH_WR;
+        cpu.watch_pages[i >> atmega32u4_t::WATCH_PAGE_SHIFT] |= f;
+    }
+}
+#endif
+
 void arduboy_t::advance(uint64_t ps)
 {
+    if(movie)
+        update_movie();
     update_history();
 
     ps += ps_rem;
@@ -842,33 +1294,57 @@ void arduboy_t::advance(uint64_t ps)
     cpu.autobreaks = 0;
 
 #ifndef ARDENS_NO_DEBUGGER
-    bool any_breakpoints =
+    bool any_watchpoints =
         allow_nonstep_breakpoints && (
-        breakpoints.any() ||
         breakpoints_rd.any() ||
-        breakpoints_wr.any()) ||
+        breakpoints_wr.any());
+    bool any_breakpoints =
+        any_watchpoints ||
+        allow_nonstep_breakpoints && breakpoints.any() ||
         break_step != 0xffffffff;
+    update_merged_breakpoints(*this, any_watchpoints);
 
-    cpu.no_merged = profiler_enabled || any_breakpoints;
+    // breakpoints and the profiler keep merged execution: breakpoints are
+    // compiled into it and merged instrs charge profiler_counts directly
+    cpu.no_merged = false;
+    cpu.merged_profiler_counts = profiler_enabled ? profiler_counts.data() : nullptr;
+    cpu.merged_profiler_callgraph = profiler_enabled ? &profiler_callgraph : nullptr;
 #endif
 
     if(!is_present_state())
         cpu.no_merged = true;
 
+#ifndef ARDENS_NO_DEBUGGER
+    // traces record each instruction
+    if(trace)
+        cpu.no_merged = true;
+
+    // when resuming from a PC breakpoint, step past its trap unmerged
+    bool step_trap = !cpu.no_merged && cpu.is_merged_trap(cpu.pc);
+    if(step_trap)
+        cpu.no_merged = true;
+#endif
+
     while(ps >= PS_BUFFER)
     {
         if(!is_present_state())
             set_button_pins_from_history(*this);
+        if(cpu.cycle_count >= movie_next_cycle)
+            play_movie_events();
 
         uint32_t cycles = cycle();
 
         ps -= cycles * CYCLE_PS;
 
 #ifndef ARDENS_NO_DEBUGGER
+        if(step_trap)
+        {
+            step_trap = false;
+            cpu.no_merged = false;
+        }
         if(any_breakpoints)
         {
-            if(cpu.pc == break_step || allow_nonstep_breakpoints && (
-                cpu.pc < breakpoints.size() && breakpoints.test(cpu.pc) ||
+            if(cpu.is_merged_trap(cpu.pc) || any_watchpoints && (
                 cpu.just_read < breakpoints_rd.size() && breakpoints_rd.test(cpu.just_read) ||
                 cpu.just_written < breakpoints_wr.size() && breakpoints_wr.test(cpu.just_written)))
             {
@@ -902,21 +1378,26 @@ void arduboy_t::advance(uint64_t ps)
             array_bytes(display.filtered_pixels));
     }
 
-    // update savedata
-    if(cpu.eeprom_dirty)
+    // update savedata: saves made while replaying history or a movie's
+    // inputs are not persisted, and run-ahead predictions are held
+    bool persist = is_present_state() && !is_playing_movie();
+    if(cpu.eeprom_dirty && !runahead_speculating)
     {
         savedata.eeprom.resize(cpu.eeprom.size());
         savedata.eeprom_modified_bytes = cpu.eeprom_modified_bytes;
         memcpy(savedata.eeprom.data(), cpu.eeprom.data(), array_bytes(savedata.eeprom));
+        savedata.eeprom_generation = ++savedata.generation;
         cpu.eeprom_dirty = false;
-        if(is_present_state())
+        if(persist)
             savedata_dirty = true;
     }
-    if(fx.sectors_dirty)
+    if(fx.sectors_dirty && !runahead_speculating)
     {
-        for(size_t i = 0; i < fx.sectors_modified.size(); ++i)
+        uint32_t generation = ++savedata.generation;
+        for(size_t i = 0; i < fx.sectors_dirty_bits.size(); ++i)
         {
-            if(!fx.sectors_modified.test(i)) continue;
+            if(!fx.sectors_dirty_bits.test(i)) continue;
+            savedata.fx_sector_generation[i] = generation;
             auto& s = savedata.fx_sectors[(uint32_t)i];
             auto const& fxs = fx.sectors[i];
             if(!fxs)
@@ -931,8 +1412,9 @@ void arduboy_t::advance(uint64_t ps)
             else
                 memcpy(fxsm->data(), fxs->data(), 4096);
         }
+        fx.sectors_dirty_bits.reset();
         fx.sectors_dirty = false;
-        if(is_present_state())
+        if(persist)
             savedata_dirty = true;
     }
 
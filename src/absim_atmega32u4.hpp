@@ -278,6 +278,8 @@ ARDENS_FORCEINLINE bool atmega32u4_t::check_interrupt(
         wakeup_cycles += 4;
     active = false;
     just_interrupted = true;
+    if(vector / 2u < stats.interrupts.size())
+        ++stats.interrupts[vector / 2u];
     return true;
 }
 
@@ -361,6 +363,46 @@ size_t atmega32u4_t::addr_to_disassembled_index(uint16_t addr)
     return (size_t)index;
 }
 
+template<bool PROFILE, bool COUNT>
+ARDENS_FORCEINLINE bool atmega32u4_t::execute_merged(int64_t cycles_max)
+{
+    constexpr uint16_t last_pc = 0x4000;
+    uint64_t instrs = 0;
+    do
+    {
+        if(pc >= last_pc)
+        {
+            stats.merged_instrs += instrs;
+            autobreak(AB_OOB_PC);
+            return false;
+        }
+        auto const& i = merged_prog[pc];
+#ifndef ARDENS_NO_DEBUGGER
+        uint16_t instr_pc = pc;
+        uint32_t instr_stack_depth = num_stack_frames;
+#endif
+        auto instr_cycles = INSTR_MAP[i.func](*this, i);
+        assert(instr_cycles <= MAX_INSTR_CYCLES);
+        cycle_count += instr_cycles;
+        ++instrs;
+        if(COUNT)
+            ++stats.instr_counts[i.func];
+#ifndef ARDENS_NO_DEBUGGER
+        if(PROFILE)
+        {
+            executing_instr_pc = instr_pc;
+            executing_stack_depth = instr_stack_depth;
+            profile_merged_instr(instr_pc, instr_stack_depth, i, instr_cycles);
+        }
+#endif
+        if(io_reg_accessed || should_autobreak())
+            break;
+        cycles_max -= instr_cycles;
+    } while((int64_t)cycles_max > 0);
+    stats.merged_instrs += instrs;
+    return true;
+}
+
 ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
 {
     uint32_t cycles = 1;
@@ -373,13 +415,17 @@ ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
         // not sleeping: execute instruction(s)
 
         int64_t max_merged_cycles = int64_t(
-            peripheral_queue.next_cycle() - cycle_count - MAX_INSTR_CYCLES);
+            std::min(peripheral_queue.next_cycle(), merged_limit_cycle) -
+            cycle_count - MAX_INSTR_CYCLES);
 
 #ifndef ARDENS_NO_DEBUGGER
         executing_instr_pc = pc;
+        executing_stack_depth = num_stack_frames;
 #endif
         constexpr uint16_t last_pc = 0x4000;
-        if(max_merged_cycles < 0 ||
+        // a merged batch always executes at least one instr, which could
+        // reach the next peripheral event without processing it
+        if(max_merged_cycles <= 0 ||
 #ifndef ARDENS_NO_DEBUGGER
             no_merged ||
 #endif
@@ -397,6 +443,9 @@ ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
             cycles = INSTR_MAP[i.func](*this, i);
             assert(cycles <= MAX_INSTR_CYCLES);
             cycle_count += cycles;
+            ++stats.unmerged_instrs;
+            if(count_instrs)
+                ++stats.instr_counts[i.func];
         }
         else
         {
@@ -407,27 +456,42 @@ ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
             // this can happen here because if SREG I-bit is ever changed
             // it'll break out of the loop anyway
             prev_sreg = sreg();
-            
+            uint64_t tinstrs = stats.merged_instrs;
+
             io_reg_accessed = false;
-            do
+#ifndef ARDENS_NO_DEBUGGER
+            just_read = 0xffffffff;
+            just_written = 0xffffffff;
+#endif
+            bool valid_pc;
+#ifndef ARDENS_NO_DEBUGGER
+            if(merged_profiler_counts)
             {
-                if(pc >= last_pc)
-                {
-                    autobreak(AB_OOB_PC);
-                    cycles = uint32_t(cycle_count - tcycles);
-                    return cycles;
-                }
-                auto const& i = merged_prog[pc];
-                auto instr_cycles = INSTR_MAP[i.func](*this, i);
-                assert(instr_cycles <= MAX_INSTR_CYCLES);
-                cycle_count += instr_cycles;
-                if(io_reg_accessed || should_autobreak())
-                    break;
-                cycles_max -= instr_cycles;
-            } while((int64_t)cycles_max > 0);
+                merged_cycles_profiled = true;
+                valid_pc = count_instrs ?
+                    execute_merged<true, true>(cycles_max) :
+                    execute_merged<true, false>(cycles_max);
+            }
+            else
+#endif
+                valid_pc = count_instrs ?
+                    execute_merged<false, true>(cycles_max) :
+                    execute_merged<false, false>(cycles_max);
             cycles = uint32_t(cycle_count - tcycles);
+            ++stats.merged_batches;
+            if(count_instrs)
+                stats.add_merged_batch(stats.merged_instrs - tinstrs);
+            if(!valid_pc)
+                return cycles;
             if(!(should_autobreak() || io_reg_accessed))
+            {
+                if(max_merged_cycles > int64_t(MAX_MERGED_CYCLES))
+                    ++stats.merged_exit_limit;
+                else
+                    ++stats.merged_exit_deadline;
                 goto skip_peripheral_updates;
+            }
+            ++stats.merged_exit_io;
         }
     }
     else if(wakeup_cycles > 0)
@@ -439,7 +503,10 @@ ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
         // set this here so we don't steal profiler cycle from
         // instruction that was running when interrupt hit
         if(wakeup_cycles == 4)
+        {
             executing_instr_pc = pc;
+            executing_stack_depth = num_stack_frames;
+        }
 #endif
 
         if(--wakeup_cycles == 0)
@@ -471,6 +538,7 @@ ARDENS_FORCEINLINE uint32_t atmega32u4_t::advance_cycle()
             if(qi.cycle > cycle_count)
                 break;
             peripheral_queue.pop();
+            ++stats.queue_pops[qi.type];
             switch(qi.type)
             {
             case PQ_SPI: update_spi(); break;
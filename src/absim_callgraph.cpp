@@ -0,0 +1,292 @@
+#include "absim.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace absim
+{
+
+// the interrupt vector table: one two-word jmp per vector
+constexpr uint32_t NUM_VECTORS = 43;
+
+static std::string hex_name(uint32_t addr)
+{
+    char b[16];
+    snprintf(b, sizeof(b), "0x%04x", addr);
+    return b;
+}
+
+void profiler_callgraph_t::reset(atmega32u4_t const& cpu, elf_data_t const* elf)
+{
+    funcs.clear();
+    nodes.clear();
+    instr_funcs.clear();
+    children.clear();
+    frame_cycles.clear();
+    frame_nodes.clear();
+    leaf_parent = leaf_func = leaf_node = UINT32_MAX;
+
+    nodes.push_back({ UINT32_MAX, UINT32_MAX, 0, 0, 0 });
+
+    if(!cpu.decoded)
+        return;
+
+    size_t n = cpu.last_addr / 2;
+    if(n == 0) return;
+    n = std::min(n, cpu.decoded_prog.size());
+
+    // function entries (word addresses)
+    std::map<uint32_t, bool> starts; // entry -> isr
+    starts[0] = false;
+    if(elf)
+    {
+        for(auto const& kv : elf->text_symbols)
+        {
+            auto const& sym = kv.second;
+            if(sym.object || sym.notype) continue;
+            starts.emplace(sym.addr / 2, false);
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < n; )
+        {
+            auto const& instr = cpu.decoded_prog[i];
+            if(instr.func == INSTR_CALL)
+                starts.emplace(instr.word, false);
+            else if(instr.func == INSTR_RCALL)
+                starts.emplace(uint32_t(i + 1 + (int16_t)instr.word), false);
+            i += instr_is_two_words(instr) ? 2 : 1;
+        }
+    }
+
+    // interrupt handlers are the targets of the vector table jmps
+    std::array<uint32_t, NUM_VECTORS> vector_targets;
+    vector_targets.fill(UINT32_MAX);
+    for(uint32_t v = 1; v < NUM_VECTORS && v * 2 < n; ++v)
+    {
+        auto const& instr = cpu.decoded_prog[v * 2];
+        uint32_t t;
+        if(instr.func == INSTR_JMP)
+            t = instr.word;
+        else if(instr.func == INSTR_RJMP)
+            t = uint32_t(v * 2 + 1 + (int16_t)instr.word);
+        else
+            continue;
+        if(t >= n) continue;
+        vector_targets[v] = t;
+        starts[t] = true;
+    }
+
+    std::map<uint32_t, uint32_t> start_funcs;
+    for(auto const& kv : starts)
+    {
+        if(kv.first >= n) continue;
+        func_t f{};
+        f.addr = uint16_t(kv.first * 2);
+        f.isr = kv.second;
+        f.name = hex_name(f.addr);
+        if(elf)
+        {
+            auto it = elf->text_symbols.find(f.addr);
+            if(it != elf->text_symbols.end())
+                f.name = it->second.name;
+        }
+        else if(f.isr)
+            f.name = "isr_" + f.name;
+        start_funcs[kv.first] = uint32_t(funcs.size());
+        funcs.push_back(std::move(f));
+    }
+
+    instr_funcs.resize(cpu.decoded_prog.size());
+    auto it = start_funcs.begin();
+    uint32_t func = it->second;
+    for(uint32_t i = 0; i < instr_funcs.size(); ++i)
+    {
+        while(it != start_funcs.end() && it->first <= i)
+            func = (it++)->second;
+        instr_funcs[i] = func;
+    }
+
+    // vector table entries belong to their handler
+    for(uint32_t v = 1; v < NUM_VECTORS; ++v)
+    {
+        if(vector_targets[v] == UINT32_MAX) continue;
+        uint32_t f = start_funcs[vector_targets[v]];
+        instr_funcs[v * 2 + 0] = f;
+        instr_funcs[v * 2 + 1] = f;
+    }
+}
+
+uint32_t profiler_callgraph_t::child(uint32_t parent, uint32_t func)
+{
+    uint64_t key = (uint64_t(parent) << 32) | func;
+    auto it = children.find(key);
+    if(it != children.end())
+        return it->second;
+    uint32_t node = uint32_t(nodes.size());
+    nodes.push_back({ parent, func, 0, 0, 0 });
+    children[key] = node;
+    return node;
+}
+
+void profiler_callgraph_t::charge_stack(
+    atmega32u4_t const& cpu, uint16_t pc, uint32_t depth, uint32_t cycles)
+{
+    if(instr_funcs.empty())
+        return;
+    auto const& frames = cpu.stack_frames;
+    uint32_t d = depth;
+    uint32_t leaf_pc = pc;
+
+    // reuse nodes for frames still on the stack: a frame is identified by
+    // the cycle it was pushed on
+    uint32_t i = 0;
+    uint32_t n = std::min<uint32_t>(d, (uint32_t)frame_cycles.size());
+    if(n == d && (d == 0 || frame_cycles[d - 1] == frames[d - 1].cycle))
+        i = d;
+    else
+    {
+        while(i < n && frame_cycles[i] == frames[i].cycle)
+            ++i;
+    }
+    uint32_t first_new = i;
+    frame_cycles.resize(i);
+    frame_nodes.resize(i);
+
+    // each frame holds a return address into the function at its level
+    for(; i < d; ++i)
+    {
+        uint32_t parent = i == 0 ? ROOT : frame_nodes[i - 1];
+        uint32_t pc = frames[i].pc;
+        uint32_t f = instr_funcs[pc < instr_funcs.size() ? pc : 0];
+        uint32_t node = child(func_parent(parent, f), f);
+        if(i > first_new)
+            ++nodes[node].calls;
+        frame_cycles.push_back(frames[i].cycle);
+        frame_nodes.push_back(node);
+    }
+
+    uint32_t parent = d == 0 ? ROOT : frame_nodes[d - 1];
+    uint32_t f = instr_funcs[leaf_pc < instr_funcs.size() ? leaf_pc : 0];
+    parent = func_parent(parent, f);
+    if(parent != leaf_parent || f != leaf_func)
+    {
+        leaf_parent = parent;
+        leaf_func = f;
+        leaf_node = child(parent, f);
+    }
+    if(d > first_new)
+        ++nodes[leaf_node].calls;
+    nodes[leaf_node].self += cycles;
+}
+
+void profiler_callgraph_t::finish()
+{
+    for(auto& n : nodes)
+        n.total = n.self;
+    // children are always created after their parents
+    for(size_t i = nodes.size(); i-- > 1; )
+        nodes[nodes[i].parent].total += nodes[i].total;
+
+    for(auto& f : funcs)
+        f.self = f.total = f.calls = 0;
+    for(size_t i = 1; i < nodes.size(); ++i)
+    {
+        auto const& n = nodes[i];
+        auto& f = funcs[n.func];
+        f.self += n.self;
+        f.calls += n.calls;
+        // don't count recursive calls twice
+        bool recursive = false;
+        for(uint32_t p = n.parent; p != ROOT; p = nodes[p].parent)
+        {
+            if(nodes[p].func == n.func)
+            {
+                recursive = true;
+                break;
+            }
+        }
+        if(!recursive)
+            f.total += n.total;
+    }
+}
+
+std::string profiler_callgraph_t::folded_stacks() const
+{
+    std::string r;
+    std::vector<uint32_t> path;
+    for(size_t i = 1; i < nodes.size(); ++i)
+    {
+        if(nodes[i].self == 0) continue;
+        path.clear();
+        for(uint32_t p = uint32_t(i); p != ROOT; p = nodes[p].parent)
+            path.push_back(p);
+        for(size_t j = path.size(); j-- > 0; )
+        {
+            std::string name = funcs[nodes[path[j]].func].name;
+            std::replace(name.begin(), name.end(), ';', ':');
+            r += name;
+            r += j == 0 ? ' ' : ';';
+        }
+        r += std::to_string(nodes[i].self);
+        r += '\n';
+    }
+    return r;
+}
+
+std::string profiler_callgraph_t::callgrind() const
+{
+    struct edge_t
+    {
+        uint64_t calls;
+        uint64_t total;
+    };
+    std::vector<std::map<uint32_t, edge_t>> edges(funcs.size());
+    uint64_t total = 0;
+    for(size_t i = 1; i < nodes.size(); ++i)
+    {
+        auto const& n = nodes[i];
+        total += n.self;
+        if(n.parent == ROOT) continue;
+        auto& e = edges[nodes[n.parent].func][n.func];
+        e.calls += n.calls;
+        e.total += n.total;
+    }
+
+    std::string r;
+    r += "# callgrind format\n";
+    r += "version: 1\n";
+    r += "creator: Ardens\n";
+    r += "positions: instr\n";
+    r += "events: Cycles\n";
+    r += "summary: " + std::to_string(total) + "\n";
+
+    std::set<uint32_t> named;
+    auto name = [&](uint32_t f) {
+        std::string id = "(" + std::to_string(f + 1) + ")";
+        if(named.insert(f).second)
+            id += " " + funcs[f].name;
+        return id;
+    };
+    for(uint32_t f = 0; f < funcs.size(); ++f)
+    {
+        if(funcs[f].self == 0 && edges[f].empty()) continue;
+        std::string addr = hex_name(funcs[f].addr);
+        r += "\nfn=" + name(f) + "\n";
+        r += addr + " " + std::to_string(funcs[f].self) + "\n";
+        for(auto const& kv : edges[f])
+        {
+            r += "cfn=" + name(kv.first) + "\n";
+            r += "calls=" + std::to_string(kv.second.calls) + " " +
+                hex_name(funcs[kv.first].addr) + "\n";
+            r += addr + " " + std::to_string(kv.second.total) + "\n";
+        }
+    }
+    return r;
+}
+
+}
@@ -5,7 +5,7 @@
 namespace absim
 {
 
-static void decode_instr(avr_instr_t& i, uint16_t w0, uint16_t w1)
+void decode_instr(avr_instr_t& i, uint16_t w0, uint16_t w1)
 {
     i.func = INSTR_UNKNOWN;
     i.src = 0;
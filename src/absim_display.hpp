@@ -341,13 +341,18 @@ ARDENS_FORCEINLINE void display_t::update_pixels_row()
 
     auto& parray = pixels[pixel_history_index];
 
+    bool frame_done = false;
     if((mux_ratio >= 16 && row == mux_ratio) || row >= 63)
     {
         if(enable_filter && ++pixel_history_index >= MAX_PIXEL_HISTORY)
             pixel_history_index = 0;
         vsync = true;
+        frame_done = true;
     }
 
+    if(no_render)
+        return;
+
     constexpr float F = 0.65f;
     constexpr uint32_t FA = uint32_t(F * 256);
     constexpr uint32_t FB = 280 - FA;
@@ -440,6 +445,41 @@ ARDENS_FORCEINLINE void display_t::update_pixels_row()
 #endif
     if(vsync && enable_filter)
         filter_pixels();
+    if(frame_done && hash_frames)
+        frame_hashes.push_back(frame_hash());
+}
+
+static inline uint64_t frame_hash_rotl(uint64_t x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// xxHash64-style: four lanes over the frame's 8-byte words, then mixed
+uint64_t display_t::frame_hash() const
+{
+    constexpr uint64_t P1 = 0x9e3779b185ebca87ull;
+    constexpr uint64_t P2 = 0xc2b2ae3d27d4eb4full;
+    constexpr uint64_t P3 = 0x165667b19e3779f9ull;
+    uint8_t const* p = enable_filter ? filtered_pixels.data() : pixels[0].data();
+    uint64_t h[4] = { P1 + P2, P2, 0, 0 - P1 };
+    for(size_t i = 0; i < 8192; i += 32)
+    {
+        for(int j = 0; j < 4; ++j)
+        {
+            uint64_t w;
+            memcpy(&w, p + i + j * 8, 8);
+            h[j] = frame_hash_rotl(h[j] + w * P2, 31) * P1;
+        }
+    }
+    uint64_t r =
+        frame_hash_rotl(h[0], 1) + frame_hash_rotl(h[1], 7) +
+        frame_hash_rotl(h[2], 12) + frame_hash_rotl(h[3], 18);
+    r ^= r >> 33;
+    r *= P2;
+    r ^= r >> 29;
+    r *= P3;
+    r ^= r >> 32;
+    return r;
 }
 
 void display_t::filter_pixels()
@@ -142,6 +142,145 @@ instr_func_t const INSTR_MAP[NUM_INSTR] =
     instr_merged_cp_cpc,
     instr_merged_subi_sbci,
     instr_merged_delay,
+    instr_merged_trap,
+};
+
+char const* const INSTR_ID_NAMES[NUM_INSTR] =
+{
+    "unknown",
+    "rcall",
+    "call",
+    "icall",
+    "ret",
+    "reti",
+    "movw",
+    "mov",
+    "and",
+    "or",
+    "eor",
+    "clr",
+    "add",
+    "adc",
+    "sub",
+    "sbc",
+    "cpi",
+    "cp",
+    "cpc",
+    "out",
+    "in",
+    "ldi",
+    "lpm",
+    "brbs",
+    "brbc",
+    "lds",
+    "sts",
+    "ldd_y",
+    "ldd_z",
+    "std_y",
+    "std_z",
+    "ld_st",
+    "ld_x",
+    "ld_y",
+    "ld_z",
+    "ld_x_inc",
+    "ld_y_inc",
+    "ld_z_inc",
+    "ld_x_dec",
+    "ld_y_dec",
+    "ld_z_dec",
+    "st_x",
+    "st_y",
+    "st_z",
+    "st_x_inc",
+    "st_y_inc",
+    "st_z_inc",
+    "st_x_dec",
+    "st_y_dec",
+    "st_z_dec",
+    "push",
+    "pop",
+    "cpse",
+    "subi",
+    "sbci",
+    "ori",
+    "andi",
+    "adiw",
+    "sbiw",
+    "bset",
+    "bclr",
+    "sbi",
+    "cbi",
+    "sbis",
+    "sbic",
+    "sbrs",
+    "sbrc",
+    "bld",
+    "bst",
+    "com",
+    "neg",
+    "swap",
+    "inc",
+    "dec",
+    "asr",
+    "lsr",
+    "ror",
+    "sleep",
+    "mul",
+    "muls",
+    "mulsu",
+    "fmul",
+    "fmuls",
+    "fmulsu",
+    "nop",
+    "rjmp",
+    "jmp",
+    "ijmp",
+    "wdr",
+    "spm",
+    "break",
+
+    // merged instrs
+
+    "merged_out",
+    "merged_in",
+    "merged_lds",
+    "merged_sts",
+    "merged_ldd_y",
+    "merged_ldd_z",
+    "merged_std_y",
+    "merged_std_z",
+    "merged_ld_st",
+    "merged_ld_x",
+    "merged_ld_y",
+    "merged_ld_z",
+    "merged_ld_x_inc",
+    "merged_ld_y_inc",
+    "merged_ld_z_inc",
+    "merged_ld_x_dec",
+    "merged_ld_y_dec",
+    "merged_ld_z_dec",
+    "merged_st_x",
+    "merged_st_y",
+    "merged_st_z",
+    "merged_st_x_inc",
+    "merged_st_y_inc",
+    "merged_st_z_inc",
+    "merged_st_x_dec",
+    "merged_st_y_dec",
+    "merged_st_z_dec",
+    "merged_sbi",
+    "merged_cbi",
+    "merged_sbis",
+    "merged_sbic",
+
+    "merged_ldi2",
+    "merged_dec_brne",
+    "merged_add_adc",
+    "merged_sub_sbc",
+    "merged_cp_cpc",
+    "merged_subi_sbci",
+    "merged_delay",
+    "merged_trap",
 };
 
 bool instr_is_two_words(avr_instr_t i)
@@ -313,7 +452,7 @@ uint32_t instr_call(atmega32u4_t& cpu, avr_instr_t i)
     return 4;
 }
 
-uint32_t instr_icall(atmega32u4_t& cpu, avr_instr_t i)
+uint32_t instr_icall(atmega32u4_t& cpu, avr_instr_t /*i*/)
 {
     uint16_t ret_addr = cpu.pc + 1;
     cpu.pc = cpu.z_word();
@@ -323,7 +462,7 @@ uint32_t instr_icall(atmega32u4_t& cpu, avr_instr_t i)
     return 3;
 }
 
-uint32_t instr_ret(atmega32u4_t& cpu, avr_instr_t i)
+uint32_t instr_ret(atmega32u4_t& cpu, avr_instr_t /*i*/)
 {
     uint16_t hi = cpu.pop();
     uint16_t lo = cpu.pop();
@@ -332,7 +471,7 @@ uint32_t instr_ret(atmega32u4_t& cpu, avr_instr_t i)
     return 4;
 }
 
-uint32_t instr_reti(atmega32u4_t& cpu, avr_instr_t i)
+uint32_t instr_reti(atmega32u4_t& cpu, avr_instr_t /*i*/)
 {
     uint16_t hi = cpu.pop();
     uint16_t lo = cpu.pop();
@@ -340,6 +479,9 @@ uint32_t instr_reti(atmega32u4_t& cpu, avr_instr_t i)
     cpu.sreg() |= SREG_I;
     cpu.just_written = 0x5f;
     cpu.pop_stack_frame();
+    // end merged execution so a pending interrupt is taken after the next
+    // instruction, as when unmerged
+    cpu.io_reg_accessed = true;
     return 4;
 }
 
@@ -1010,6 +1152,8 @@ uint32_t instr_bset(atmega32u4_t& cpu, avr_instr_t i)
 {
     // src: bit, dst: mask
     cpu.sreg() |= i.dst;
+    if(i.dst & SREG_I)
+        cpu.io_reg_accessed = true;
     cpu.pc += 1;
     return 1;
 }
@@ -1018,6 +1162,8 @@ uint32_t instr_bclr(atmega32u4_t& cpu, avr_instr_t i)
 {
     // src: bit, dst: mask
     cpu.sreg() &= i.dst;
+    if(!(i.dst & SREG_I))
+        cpu.io_reg_accessed = true;
     cpu.pc += 1;
     return 1;
 }
@@ -1227,10 +1373,14 @@ uint32_t instr_ror(atmega32u4_t& cpu, avr_instr_t i)
     return 1;
 }
 
-uint32_t instr_sleep(atmega32u4_t& cpu, avr_instr_t i)
+uint32_t instr_sleep(atmega32u4_t& cpu, avr_instr_t /*i*/)
 {
     if(cpu.smcr() & 0x1)
+    {
         cpu.active = false;
+        // end merged execution
+        cpu.io_reg_accessed = true;
+    }
     cpu.pc += 1;
     return 1;
 }
@@ -1356,7 +1506,8 @@ uint32_t instr_merged_add_adc(atmega32u4_t& cpu, avr_instr_t i)
     sreg |= (hc & 0x0800) >> 6;  // H flag
     sreg |= hc >> 15;            // C flag
     sreg |= (v & 0x8000) >> 12;  // V flag
-    sreg = flags_nzs16(sreg, res);
+    // unlike sbc/cpc, adc's Z flag only reflects the high byte
+    sreg = flags_nzs16(sreg, res & 0xff00);
     cpu.sreg() = (uint8_t)sreg;
 
     cpu.pc += 2;
@@ -1430,4 +1581,11 @@ uint32_t instr_merged_delay(atmega32u4_t& cpu, avr_instr_t i)
     return i.word;
 }
 
+uint32_t instr_merged_trap(atmega32u4_t& cpu, avr_instr_t /*i*/)
+{
+    // breakpoint: end the merged block without executing the instr
+    cpu.io_reg_accessed = true;
+    return 0;
+}
+
 }
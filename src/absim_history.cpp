@@ -0,0 +1,247 @@
+#include "absim_history.hpp"
+
+namespace absim
+{
+
+// checkpoint deltas are zlib-compressed (fast) streams of the new state's
+// size, then runs of
+//     varint unchanged bytes, varint changed bytes, the changed bytes
+// relative to the latest keyframe (treated as zero past its end). the
+// changed bytes are stored as they are rather than xor'd: they compress better.
+// deltas don't depend on each other, so any of them can be dropped
+
+// changed runs end at this many unchanged bytes
+constexpr size_t DELTA_MIN_UNCHANGED = 8;
+
+static void put_varint(std::vector<uint8_t>& v, size_t x)
+{
+    while(x >= 0x80)
+    {
+        v.push_back(uint8_t(x | 0x80));
+        x >>= 7;
+    }
+    v.push_back(uint8_t(x));
+}
+
+static bool get_varint(uint8_t const*& p, uint8_t const* end, size_t& x)
+{
+    x = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t t = *p++;
+        x |= size_t(t & 0x7f) << shift;
+        if(!(t & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void encode_delta(
+    std::vector<uint8_t>& dst,
+    std::vector<uint8_t> const& base,
+    std::vector<uint8_t> const& s)
+{
+    size_t n = s.size();
+    auto same = [&](size_t i) { return s[i] == (i < base.size() ? base[i] : 0); };
+    std::vector<uint8_t> runs;
+    put_varint(runs, n);
+    size_t i = 0;
+    while(i < n)
+    {
+        size_t b = i;
+        while(b < n && same(b))
+            ++b;
+        size_t e = b;
+        size_t unchanged = 0;
+        while(e < n && unchanged < DELTA_MIN_UNCHANGED)
+        {
+            unchanged = same(e) ? unchanged + 1 : 0;
+            ++e;
+        }
+        e -= unchanged;
+        put_varint(runs, b - i);
+        put_varint(runs, e - b);
+        runs.insert(runs.end(), s.begin() + b, s.begin() + e);
+        i = e;
+    }
+    if(!compress_zlib(dst, runs.data(), runs.size(), true))
+        dst.clear();
+}
+
+static bool apply_delta(std::vector<uint8_t>& s, std::vector<uint8_t> const& delta)
+{
+    std::vector<uint8_t> runs;
+    if(!uncompress_zlib(runs, delta.data(), delta.size()))
+        return false;
+    uint8_t const* p = runs.data();
+    uint8_t const* end = p + runs.size();
+    size_t n = 0;
+    if(!get_varint(p, end, n))
+        return false;
+    s.resize(n, 0);
+    size_t i = 0;
+    while(p < end)
+    {
+        size_t skip = 0, m = 0;
+        if(!get_varint(p, end, skip) || !get_varint(p, end, m))
+            return false;
+        i += skip;
+        if(i > n || n - i < m || size_t(end - p) < m)
+            return false;
+        memcpy(&s[i], p, m);
+        p += m;
+        i += m;
+    }
+    return true;
+}
+
+bool decode_history_state(arduboy_t const& a, size_t i, std::vector<uint8_t>& s)
+{
+    auto const& h = a.state_history;
+    if(i >= h.size())
+        return false;
+    size_t k = i;
+    while(k > 0 && !h[k].keyframe)
+        --k;
+    if(!h[k].keyframe || !uncompress_zlib(s, h[k].state.data(), h[k].state.size()))
+        return false;
+    return k == i || apply_delta(s, h[i].state);
+}
+
+history_worker_t::history_worker_t()
+{
+#if ARDENS_HISTORY_THREAD
+    thread = std::thread([this]() { thread_func(); });
+#endif
+}
+
+history_worker_t::~history_worker_t()
+{
+#if ARDENS_HISTORY_THREAD
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exiting = true;
+    }
+    cv.notify_one();
+    thread.join();
+#endif
+}
+
+uint64_t history_worker_t::encode(job_t& job, arduboy_t::tt_state_t& state)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    state.cycle = job.cycle;
+    state.keyframe = job.keyframe || base.empty();
+    if(state.keyframe)
+    {
+        if(!compress_zlib(state.state, job.state.data(), job.state.size(), true))
+            state.state.clear();
+        base.swap(job.state);
+    }
+    else
+        encode_delta(state.state, base, job.state);
+    auto t1 = std::chrono::steady_clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+void history_worker_t::push(arduboy_t& a, bool keyframe)
+{
+    job_t job;
+    job.cycle = a.cpu.cycle_count;
+    job.keyframe = keyframe;
+    {
+#if ARDENS_HISTORY_THREAD
+        std::lock_guard<std::mutex> lock(mutex);
+#endif
+        if(!pool.empty())
+        {
+            job.state.swap(pool.back());
+            pool.pop_back();
+        }
+    }
+    job.state.resize(a.savestate_flat_size());
+    a.save_savestate_flat(job.state.data(), job.state.size());
+
+#if ARDENS_HISTORY_THREAD
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(job));
+    }
+    cv.notify_one();
+#else
+    arduboy_t::tt_state_t state;
+    done_encode_ns += encode(job, state);
+    done.push_back(std::move(state));
+    if(!job.state.empty())
+        pool.push_back(std::move(job.state));
+#endif
+}
+
+bool history_worker_t::collect(arduboy_t& a)
+{
+    std::deque<arduboy_t::tt_state_t> states;
+    {
+#if ARDENS_HISTORY_THREAD
+        std::lock_guard<std::mutex> lock(mutex);
+#endif
+        states.swap(done);
+        a.stats.history_encode_ns += done_encode_ns;
+        done_encode_ns = 0;
+    }
+    for(auto& s : states)
+    {
+        a.history_size += s.state.size();
+        a.stats.history_bytes += s.state.size();
+        ++a.stats.history_checkpoints;
+        a.state_history.push_back(std::move(s));
+    }
+    return !states.empty();
+}
+
+void history_worker_t::fence(arduboy_t& a)
+{
+#if ARDENS_HISTORY_THREAD
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_idle.wait(lock, [this] { return pending.empty() && !busy; });
+    }
+#endif
+    collect(a);
+}
+
+#if ARDENS_HISTORY_THREAD
+void history_worker_t::thread_func()
+{
+    for(;;)
+    {
+        job_t job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return exiting || !pending.empty(); });
+            if(exiting)
+                break;
+            job = std::move(pending.front());
+            pending.pop_front();
+            busy = true;
+        }
+        arduboy_t::tt_state_t state;
+        uint64_t ns = encode(job, state);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.push_back(std::move(state));
+            done_encode_ns += ns;
+            if(!job.state.empty())
+                pool.push_back(std::move(job.state));
+            busy = false;
+        }
+        cv_idle.notify_all();
+    }
+}
+#endif
+
+void history_worker_deleter_t::operator()(history_worker_t* w) const
+{
+    delete w;
+}
+
+}
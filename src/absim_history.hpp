@@ -0,0 +1,79 @@
+#pragma once
+
+#include "absim.hpp"
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#ifndef __EMSCRIPTEN__
+#define ARDENS_HISTORY_THREAD 1
+#else
+#define ARDENS_HISTORY_THREAD 0
+#endif
+
+#if ARDENS_HISTORY_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace absim
+{
+
+// decode state_history[i] into a flat savestate
+bool decode_history_state(arduboy_t const& a, size_t i, std::vector<uint8_t>& s);
+
+// Time-travel checkpoint encoder. The emulation thread copies the state into
+// a pooled buffer and queues it; keyframes are compressed and other
+// checkpoints delta-encoded against the latest keyframe on a background
+// thread where available. Encoded checkpoints are appended to
+// state_history by collect and fence, on the emulation thread.
+struct history_worker_t
+{
+    history_worker_t();
+    ~history_worker_t();
+
+    // queue a checkpoint of the current state
+    void push(arduboy_t& a, bool keyframe);
+
+    // append the checkpoints encoded so far to a.state_history
+    // returns true if any were appended
+    bool collect(arduboy_t& a);
+
+    // wait for all queued checkpoints and append them
+    void fence(arduboy_t& a);
+
+private:
+
+    struct job_t
+    {
+        uint64_t cycle;
+        bool keyframe;
+        std::vector<uint8_t> state;
+    };
+
+    // uncompressed latest keyframe (owned by the encoder)
+    std::vector<uint8_t> base;
+
+    std::vector<std::vector<uint8_t>> pool;
+    std::deque<job_t> pending;
+    std::deque<arduboy_t::tt_state_t> done;
+    // time spent encoding done
+    uint64_t done_encode_ns = 0;
+
+    // returns nanoseconds spent
+    uint64_t encode(job_t& job, arduboy_t::tt_state_t& state);
+
+#if ARDENS_HISTORY_THREAD
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable cv_idle;
+    bool busy = false;
+    bool exiting = false;
+    void thread_func();
+#endif
+};
+
+}
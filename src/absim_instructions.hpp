@@ -10,6 +10,12 @@ using instr_func_t = uint32_t(*)(atmega32u4_t& cpu, avr_instr_t i);
 
 extern instr_func_t const INSTR_MAP[];
 
+// lowercase instr_id_t names, for instrumentation
+extern char const* const INSTR_ID_NAMES[];
+
+// decode the instruction starting with word w0 (w1 is the following word)
+void decode_instr(avr_instr_t& i, uint16_t w0, uint16_t w1);
+
 struct disassembled_instr_arg_t
 {
     struct type
@@ -182,6 +188,7 @@ enum instr_id_t
     INSTR_MERGED_CP_CPC,
     INSTR_MERGED_SUBI_SBCI,
     INSTR_MERGED_DELAY,
+    INSTR_MERGED_TRAP,
 
     NUM_INSTR
 };
@@ -320,5 +327,6 @@ uint32_t instr_merged_sub_sbc  (atmega32u4_t& cpu, avr_instr_t const i);
 uint32_t instr_merged_cp_cpc   (atmega32u4_t& cpu, avr_instr_t const i);
 uint32_t instr_merged_subi_sbci(atmega32u4_t& cpu, avr_instr_t const i);
 uint32_t instr_merged_delay    (atmega32u4_t& cpu, avr_instr_t const i);
+uint32_t instr_merged_trap     (atmega32u4_t& cpu, avr_instr_t const i);
 
 }
@@ -14,6 +14,10 @@
 
 #include "absim_strstream.hpp"
 
+#if defined(ARDENS_SSE2)
+#include <emmintrin.h>
+#endif
+
 #ifndef ARDENS_NO_ARDUBOY_FILE
 #include <yyjson/yyjson.h>
 #include <miniz.h>
@@ -36,6 +40,18 @@
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
+
+#include <atomic>
+
+#ifndef __EMSCRIPTEN__
+#define ARDENS_ELF_DEBUG_THREAD 1
+#else
+#define ARDENS_ELF_DEBUG_THREAD 0
+#endif
+
+#if ARDENS_ELF_DEBUG_THREAD
+#include <thread>
+#endif
 #endif
 
 namespace absim
@@ -65,7 +81,130 @@ size_t elf_data_t::addr_to_disassembled_index(uint16_t addr)
     return (size_t)index;
 }
 
-elf_data_t::~elf_data_t() {}
+#ifdef ARDENS_LLVM
+struct elf_debug_loader_t
+{
+    std::atomic<bool> ready{ false };
+    std::atomic<bool> cancel{ false };
+#if ARDENS_ELF_DEBUG_THREAD
+    std::thread thread;
+#endif
+};
+
+void elf_debug_loader_deleter_t::operator()(elf_debug_loader_t* l) const
+{
+#if ARDENS_ELF_DEBUG_THREAD
+    l->cancel = true;
+    if(l->thread.joinable())
+        l->thread.join();
+#endif
+    delete l;
+}
+#endif
+
+elf_data_t::~elf_data_t()
+{
+#ifdef ARDENS_LLVM
+    // stop the debug info loader before the data it fills in goes away
+    debug_loader.reset();
+#endif
+}
+
+bool elf_data_t::debug_ready() const
+{
+#ifdef ARDENS_LLVM
+    return !debug_loader || debug_loader->ready;
+#else
+    return true;
+#endif
+}
+
+void elf_data_t::symbol_index_t::build(map_type const& syms)
+{
+    ranges.clear();
+    if(syms.empty())
+        return;
+
+    uint32_t n = 0;
+    for(auto const& kv : syms)
+        n = std::max<uint32_t>(n, uint32_t(kv.second.addr) + std::max<uint16_t>(kv.second.size, 1));
+    std::vector<elf_data_symbol_t const*> table(n);
+
+    // lower addresses are written last so they win where symbols overlap
+    for(auto it = syms.rbegin(); it != syms.rend(); ++it)
+    {
+        auto const& sym = it->second;
+        for(uint32_t a = sym.addr; a < uint32_t(sym.addr) + sym.size; ++a)
+            table[a] = &sym;
+    }
+    for(auto const& kv : syms)
+    {
+        if(!table[kv.first])
+            table[kv.first] = &kv.second;
+    }
+
+    for(uint32_t a = 0; a < n; ++a)
+    {
+        if(!table[a]) continue;
+        if(!ranges.empty() && ranges.back().end == a && ranges.back().sym == table[a])
+            ranges.back().end = a + 1;
+        else
+            ranges.push_back({ a, a + 1, table[a] });
+    }
+}
+
+elf_data_symbol_t const* elf_data_t::symbol_index_t::find(uint16_t addr) const
+{
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+        [](uint16_t a, range_t const& r) { return a < r.begin; });
+    if(it == ranges.begin())
+        return nullptr;
+    --it;
+    return addr < it->end ? it->sym : nullptr;
+}
+
+void elf_data_t::build_symbol_index()
+{
+    text_symbol_index.build(text_symbols);
+    data_symbol_index.build(data_symbols);
+    pc_symbols.resize(atmega32u4_t::PROG_SIZE_BYTES / 2);
+    for(size_t i = 0; i < pc_symbols.size(); ++i)
+        pc_symbols[i] = text_symbol_index.find(uint16_t(i * 2));
+}
+
+elf_data_symbol_t const* elf_data_t::symbol_for_prog_addr(uint16_t addr) const
+{
+    if(!(addr & 1) && addr / 2 < pc_symbols.size())
+        return pc_symbols[addr / 2];
+    return text_symbol_index.find(addr);
+}
+
+elf_data_symbol_t const* elf_data_t::symbol_for_data_addr(uint16_t addr) const
+{
+    return data_symbol_index.find(addr);
+}
+
+std::pair<std::string const, elf_data_t::global_t> const* elf_data_t::global_for_addr(
+    uint16_t addr, bool text) const
+{
+    auto const& ranges = global_ranges[text ? 1 : 0];
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+        [](uint16_t a, global_range_t const& r) { return a < r.begin; });
+    if(it == ranges.begin())
+        return nullptr;
+    --it;
+    return addr < it->end ? it->global : nullptr;
+}
+
+elf_data_t::scope_t const* elf_data_t::scope_for_pc(uint16_t addr) const
+{
+    auto it = std::upper_bound(scopes.begin(), scopes.end(), addr,
+        [](uint16_t a, scope_t const& s) { return a < s.begin; });
+    if(it == scopes.begin())
+        return nullptr;
+    --it;
+    return addr < it->end ? &*it : nullptr;
+}
 
 #ifdef ARDENS_LLVM
 static std::string demangle(char const* sym)
@@ -81,25 +220,108 @@ static std::string demangle(char const* sym)
 }
 #endif
 
-static int convert_hex_char(int c)
+static void read_stream(std::istream& f, std::vector<uint8_t>& d)
 {
-    if(c >= '0' && c <= '9') return c - '0';
-    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
-    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
-    return -1;
+    constexpr size_t CHUNK = 64 * 1024;
+    size_t n = 0;
+    d.clear();
+    while(f)
+    {
+        d.resize(n + CHUNK);
+        f.read((char*)d.data() + n, CHUNK);
+        n += (size_t)f.gcount();
+    }
+    d.resize(n);
 }
 
-static int get_hex_byte(std::istream& f)
+static constexpr int convert_hex_char(int c)
 {
-    if(f.eof()) return -1;
-    int hi = convert_hex_char(f.get());
-    if(hi < 0) return -1;
-    if(f.eof()) return -1;
-    int lo = convert_hex_char(f.get());
-    if(lo < 0) return -1;
-    return lo + hi * 16;
+    return
+        c >= '0' && c <= '9' ? c - '0' :
+        c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+        c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+        -1;
 }
 
+struct hex_table_t
+{
+    int8_t v[256];
+    constexpr hex_table_t() : v{}
+    {
+        for(int i = 0; i < 256; ++i)
+            v[i] = (int8_t)convert_hex_char(i);
+    }
+};
+static constexpr hex_table_t HEX_TABLE{};
+
+struct hex_reader_t
+{
+    uint8_t const* p;
+    uint8_t const* end;
+
+    int byte()
+    {
+        if(end - p < 2) return -1;
+        int hi = HEX_TABLE.v[p[0]];
+        int lo = HEX_TABLE.v[p[1]];
+        if((hi | lo) < 0) return -1;
+        p += 2;
+        return lo + hi * 16;
+    }
+
+    // decode n bytes into dst, adding them to sum
+    bool bytes(uint8_t* dst, int n, uint8_t& sum)
+    {
+        if(end - p < n * 2) return false;
+#if defined(ARDENS_SSE2)
+        // 32 hex digits to 16 bytes at a time
+        for(; n >= 16; n -= 16, p += 32, dst += 16)
+        {
+            __m128i c0 = _mm_loadu_si128((__m128i const*)p + 0);
+            __m128i c1 = _mm_loadu_si128((__m128i const*)p + 1);
+            __m128i v0, v1;
+            if(!decode_digits(c0, v0) || !decode_digits(c1, v1))
+                return false;
+            // even digits are high nibbles
+            __m128i lo8 = _mm_set1_epi16(0x00ff);
+            v0 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v0, lo8), 4), _mm_srli_epi16(v0, 8));
+            v1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v1, lo8), 4), _mm_srli_epi16(v1, 8));
+            __m128i b = _mm_packus_epi16(v0, v1);
+            _mm_storeu_si128((__m128i*)dst, b);
+            __m128i s = _mm_sad_epu8(b, _mm_setzero_si128());
+            sum += uint8_t(_mm_cvtsi128_si32(s) + _mm_cvtsi128_si32(_mm_srli_si128(s, 8)));
+        }
+#endif
+        for(int i = 0; i < n; ++i)
+        {
+            int x = byte();
+            if(x < 0) return false;
+            dst[i] = (uint8_t)x;
+            sum += (uint8_t)x;
+        }
+        return true;
+    }
+
+#if defined(ARDENS_SSE2)
+    static bool decode_digits(__m128i c, __m128i& v)
+    {
+        __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        __m128i digit = _mm_and_si128(
+            _mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+            _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+        __m128i alpha = _mm_and_si128(
+            _mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+            _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lc));
+        if(_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+            return false;
+        v = _mm_or_si128(
+            _mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+            _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+        return true;
+    }
+#endif
+};
+
 static void find_stack_check_data(atmega32u4_t& cpu, uint16_t n)
 {
     if(n + 11 >= cpu.decoded_prog.size()) return;
@@ -187,7 +409,8 @@ static void find_stack_check(atmega32u4_t& cpu)
     }
 }
 
-static std::string load_hex(arduboy_t& a, std::istream& f, bool bootloader = false)
+static std::string load_hex(
+    arduboy_t& a, uint8_t const* data, size_t size, bool bootloader = false)
 {
     auto& cpu = a.cpu;
     if(!bootloader)
@@ -205,47 +428,47 @@ static std::string load_hex(arduboy_t& a, std::istream& f, bool bootloader = fal
 
     uint32_t addr_upper = 0;
     uint32_t num_records = 0;
+    hex_reader_t r{ data, data + size };
 
-    while(!f.eof())
+    for(;;)
     {
-        while(!f.eof() && f.get() != ':')
-            ;
-        if(f.eof())
+        auto* colon = (uint8_t const*)memchr(r.p, ':', size_t(r.end - r.p));
+        if(!colon)
             break;
+        r.p = colon + 1;
         uint8_t checksum = 0;
-        int count = get_hex_byte(f);
+        int count = r.byte();
         ++num_records;
         if(count < 0)
             return "HEX bad byte count";
         checksum += (uint8_t)count;
-        uint32_t addr_hi = (uint32_t)get_hex_byte(f);
-        uint32_t addr_lo = (uint32_t)get_hex_byte(f);
+        int addr_hi = r.byte();
+        int addr_lo = r.byte();
         if(addr_lo < 0 || addr_hi < 0)
             return "HEX: bad address";
         checksum += (uint8_t)addr_lo;
         checksum += (uint8_t)addr_hi;
-        uint32_t addr = addr_lo + addr_hi * 256;
+        uint32_t addr = uint32_t(addr_lo + addr_hi * 256);
         addr += (addr_upper << 16);
-        int type = get_hex_byte(f);
+        int type = r.byte();
         checksum += (uint8_t)type;
         if(type < 0 || type > 5)
             return "HEX: bad type";
         if(type == 0)
         {
-            for(int i = 0; i < count; ++i)
+            // decode straight into program memory
+            uint8_t skip[256];
+            uint8_t* dst = skip;
+            if(addr < 0x800000)
             {
-                int data = get_hex_byte(f);
-                if(data < 0)
-                    return "HEX: bad data";
-                checksum += (uint8_t)data;
-                if(addr >= 0x800000)
-                    continue;
-                if(addr + i >= cpu.prog.size())
+                if(addr + count > cpu.prog.size())
                     return "Too many instructions!";
-                if(!bootloader && addr + i > cpu.last_addr)
-                    cpu.last_addr = addr + i;
-                cpu.prog[addr + i] = (uint8_t)data;
+                if(!bootloader && count > 0 && addr + count - 1 > cpu.last_addr)
+                    cpu.last_addr = addr + count - 1;
+                dst = &cpu.prog[addr];
             }
+            if(!r.bytes(dst, count, checksum))
+                return "HEX: bad data";
         }
         else if(type == 1)
         {
@@ -258,26 +481,26 @@ static std::string load_hex(arduboy_t& a, std::istream& f, bool bootloader = fal
             addr_upper = 0;
             for(int i = 0; i < count; ++i)
             {
-                int data = get_hex_byte(f);
-                if(data < 0)
+                int x = r.byte();
+                if(x < 0)
                     return "HEX: bad data";
-                checksum += (uint8_t)data;
+                checksum += (uint8_t)x;
                 addr_upper <<= 8;
-                addr_upper |= (uint32_t)data;
+                addr_upper |= (uint32_t)x;
             }
         }
         else if(type == 3)
         {
             // ignore
             for(int i = 0; i < count; ++i)
-                checksum += (uint8_t)get_hex_byte(f);
+                checksum += (uint8_t)r.byte();
         }
         else
         {
             return "HEX: unsupported type";
         }
         checksum = uint8_t(-checksum);
-        int check = get_hex_byte(f);
+        int check = r.byte();
         if(checksum != check)
             return "HEX: bad checksum";
     }
@@ -291,6 +514,13 @@ static std::string load_hex(arduboy_t& a, std::istream& f, bool bootloader = fal
     return "";
 }
 
+static std::string load_hex(arduboy_t& a, std::istream& f, bool bootloader = false)
+{
+    std::vector<uint8_t> d;
+    read_stream(f, d);
+    return load_hex(a, d.data(), d.size(), bootloader);
+}
+
 static std::string load_hex(arduboy_t& a, std::string const& fname)
 {
     std::ifstream f(fname, std::ios::in);
@@ -302,6 +532,12 @@ static std::string load_hex(arduboy_t& a, std::string const& fname)
 }
 
 #ifdef ARDENS_LLVM
+struct source_line_ref_t
+{
+    uint32_t file; // index into the file names found so far
+    int line;
+};
+
 struct Elf32_Sym
 {
     uint32_t  st_name;
@@ -333,39 +569,12 @@ static void try_insert_symbol(elf_data_t::map_type& m, elf_data_symbol_t& sym)
     m[sym.addr] = std::move(sym);
 }
 
-static void add_file_to_elf(elf_data_t& elf,
-    uint16_t addr, std::string const& filename, int line)
-{
-    if(elf.source_lines.count(addr) != 0) return;
-    if(elf.source_file_names.count(filename) == 0)
-    {
-        // load file contents
-        std::ifstream f(filename);
-        if(f.fail()) return;
-        int i = (int)elf.source_files.size();
-        elf.source_files.resize(i + 1);
-        auto& sf = elf.source_files.back();
-        sf.filename = filename;
-        elf.source_file_names[filename] = i;
-        std::string linestr;
-        while(std::getline(f, linestr))
-        {
-            //trim(linestr);
-            sf.lines.push_back(linestr);
-        }
-        elf.source_lines[addr] = { i, line };
-    }
-    else
-        elf.source_lines[addr] = { elf.source_file_names[filename], line };
-}
-
 template<class T> T defval(llvm::Expected<T> e)
 {
     return e ? e.get() : T{};
 }
 
 static void load_elf_debug_recurse_globals(
-    arduboy_t& a,
     absim::elf_data_t& elf,
     std::string prefix,
     llvm::DWARFContext* dwarf_ctx,
@@ -377,7 +586,7 @@ static void load_elf_debug_recurse_globals(
         for(auto child : die)
         {
             load_elf_debug_recurse_globals(
-                a, elf,
+                elf,
                 prefix + dwarf_name(die) + "::",
                 dwarf_ctx, cu, child);
         }
@@ -388,7 +597,7 @@ static void load_elf_debug_recurse_globals(
         for(auto child : die)
         {
             load_elf_debug_recurse_globals(
-                a, elf,
+                elf,
                 prefix + dwarf_function_args_string(die) + "::",
                 dwarf_ctx, cu, child);
         }
@@ -446,19 +655,250 @@ static void load_elf_debug_recurse_globals(
         g.addr -= 0x800000;
     else
         g.text = true;
-    if(g.text && g.addr >= a.cpu.prog.size()) return;
-    if(!g.text && g.addr >= a.cpu.data.size()) return;
+    if(g.text && g.addr >= atmega32u4_t::PROG_SIZE_BYTES) return;
+    if(!g.text && g.addr >= atmega32u4_t::DATA_SIZE_BYTES) return;
     elf.globals[sname] = g;
 }
 
-static void load_elf_debug(
-    arduboy_t& a, absim::elf_data_t& elf,
-    llvm::object::ELFObjectFileBase* obj,
+static void load_elf_debug_index_globals(
+    absim::elf_data_t& elf,
     llvm::DWARFContext* dwarf_ctx)
 {
-    using namespace llvm;
+    std::vector<std::pair<std::string const, elf_data_t::global_t> const*> tables[2];
+    tables[0].resize(atmega32u4_t::DATA_SIZE_BYTES);
+    tables[1].resize(atmega32u4_t::PROG_SIZE_BYTES);
 
-    auto& cpu = a.cpu;
+    // later names are written first so the first by name wins on overlap
+    for(auto it = elf.globals.rbegin(); it != elf.globals.rend(); ++it)
+    {
+        auto const& g = it->second;
+        auto* cu = dwarf_ctx->getCompileUnitForOffset(g.cu_offset);
+        if(!cu) continue;
+        auto& table = tables[g.text ? 1 : 0];
+        uint32_t end = g.addr + absim::dwarf_size(cu->getDIEForOffset(g.type));
+        end = std::min<uint32_t>(end, (uint32_t)table.size());
+        for(uint32_t addr = g.addr; addr < end; ++addr)
+            table[addr] = &*it;
+    }
+
+    for(int i = 0; i < 2; ++i)
+    {
+        auto const& table = tables[i];
+        auto& ranges = elf.global_ranges[i];
+        ranges.clear();
+        for(uint32_t addr = 0; addr < table.size(); ++addr)
+        {
+            if(!table[addr]) continue;
+            if(!ranges.empty() && ranges.back().end == addr && ranges.back().global == table[addr])
+                ranges.back().end = addr + 1;
+            else
+                ranges.push_back({ addr, addr + 1, table[addr] });
+        }
+    }
+}
+
+struct local_candidate_t
+{
+    uint32_t begin, end;
+    uint32_t local;
+    std::string expr;
+};
+
+static void load_elf_debug_gather_locals(
+    absim::elf_data_t& elf,
+    llvm::DWARFAddressRangesVector const& func_ranges,
+    llvm::DWARFDie die,
+    std::vector<local_candidate_t>& cands)
+{
+    llvm::DWARFAddressRangesVector ranges;
+    ranges.push_back({ 0, UINT64_MAX });
+    if(auto eranges = die.getAddressRanges())
+        ranges = std::move(*eranges);
+    else
+        llvm::consumeError(eranges.takeError());
+
+    for(auto child : die)
+    {
+        auto tag = child.getTag();
+        if(tag == llvm::dwarf::DW_TAG_inlined_subroutine ||
+            tag == llvm::dwarf::DW_TAG_lexical_block)
+        {
+            load_elf_debug_gather_locals(elf, func_ranges, child, cands);
+            continue;
+        }
+        if(tag != llvm::dwarf::DW_TAG_variable &&
+            tag != llvm::dwarf::DW_TAG_formal_parameter)
+            continue;
+        if(ranges.empty()) continue;
+        auto elocs = child.getLocations(llvm::dwarf::DW_AT_location);
+        if(!elocs)
+        {
+            llvm::consumeError(elocs.takeError());
+            continue;
+        }
+
+        elf_data_t::local_t local{};
+        local.name = absim::dwarf_name(child);
+        local.id = (uint32_t)child.getOffset();
+        local.type_cu = UINT64_MAX;
+        if(auto type = absim::dwarf_type(child))
+        {
+            local.type_cu = type.getDwarfUnit()->getOffset();
+            local.type = (uint32_t)type.getOffset();
+        }
+        uint32_t index = (uint32_t)elf.locals.size();
+        bool used = false;
+
+        // a location applies where the function, the enclosing scope and
+        // the location's own range all overlap
+        for(auto const& loc : *elocs)
+        {
+            uint64_t lo = 0, hi = UINT64_MAX;
+            if(loc.Range)
+            {
+                lo = loc.Range->LowPC;
+                hi = loc.Range->HighPC;
+            }
+            for(auto const& fr : func_ranges)
+            {
+                for(auto const& r : ranges)
+                {
+                    uint64_t b = std::max({ lo, fr.LowPC, r.LowPC });
+                    uint64_t e = std::min({ hi, fr.HighPC, r.HighPC, uint64_t(0x10000) });
+                    if(b >= e) continue;
+                    cands.push_back({ uint32_t(b), uint32_t(e), index,
+                        std::string(llvm::toStringRef(loc.Expr)) });
+                    used = true;
+                }
+            }
+        }
+        if(used)
+            elf.locals.push_back(std::move(local));
+    }
+}
+
+static void load_elf_debug_index_locals(
+    absim::elf_data_t& elf,
+    llvm::DWARFDie die)
+{
+    for(auto child : die)
+        load_elf_debug_index_locals(elf, child);
+    if(die.getTag() != llvm::dwarf::DW_TAG_subprogram) return;
+    auto efunc_ranges = die.getAddressRanges();
+    if(!efunc_ranges)
+    {
+        llvm::consumeError(efunc_ranges.takeError());
+        return;
+    }
+    auto const& func_ranges = *efunc_ranges;
+    if(func_ranges.empty()) return;
+
+    std::vector<local_candidate_t> cands;
+    load_elf_debug_gather_locals(elf, func_ranges, die, cands);
+    if(cands.empty()) return;
+
+    // split the function into ranges over which the candidates don't change
+    std::vector<uint32_t> bounds;
+    for(auto const& c : cands)
+    {
+        bounds.push_back(c.begin);
+        bounds.push_back(c.end);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    std::vector<uint32_t> prev, cur;
+    for(size_t i = 0; i + 1 < bounds.size(); ++i)
+    {
+        uint32_t b = bounds[i], e = bounds[i + 1];
+        cur.clear();
+        for(uint32_t j = 0; j < cands.size(); ++j)
+            if(cands[j].begin <= b && cands[j].end >= e)
+                cur.push_back(j);
+        if(cur.empty()) continue;
+        if(!elf.scopes.empty() && elf.scopes.back().end == b && cur == prev)
+        {
+            elf.scopes.back().end = e;
+            continue;
+        }
+        elf_data_t::scope_t scope{};
+        scope.begin = b;
+        scope.end = e;
+        for(auto j : cur)
+            scope.locs.push_back({ cands[j].local, cands[j].expr });
+        elf.scopes.push_back(std::move(scope));
+        prev.swap(cur);
+    }
+}
+
+// what load_elf_debug needs from the cpu: copied, as the emulator resets
+// and runs while debug info loads
+struct elf_debug_prog_t
+{
+    uint16_t last_addr;
+    uint16_t num_instrs;
+    std::vector<disassembled_instr_t> disassembled_prog;
+};
+
+static void load_elf_source_files(
+    absim::elf_data_t& elf,
+    std::vector<std::string> const& filenames,
+    std::vector<std::pair<uint16_t, source_line_ref_t>> const& lines)
+{
+    // read in parallel: there can be many headers from slow disks
+    std::vector<std::vector<std::string>> contents(filenames.size());
+    std::vector<char> ok(filenames.size());
+    auto read_file = [&](size_t i) {
+        std::ifstream f(filenames[i]);
+        if(f.fail()) return;
+        std::string linestr;
+        while(std::getline(f, linestr))
+            contents[i].push_back(linestr);
+        ok[i] = 1;
+    };
+#if ARDENS_ELF_DEBUG_THREAD
+    std::atomic<size_t> next{ 0 };
+    size_t n = std::min<size_t>(filenames.size(),
+        std::max<unsigned>(std::thread::hardware_concurrency(), 1));
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < n; ++t)
+        threads.emplace_back([&]() {
+            for(size_t i; (i = next++) < filenames.size(); )
+                read_file(i);
+        });
+    for(auto& t : threads)
+        t.join();
+#else
+    for(size_t i = 0; i < filenames.size(); ++i)
+        read_file(i);
+#endif
+
+    // files that couldn't be read are skipped
+    std::vector<int> indices(filenames.size(), -1);
+    for(auto const& kv : lines)
+    {
+        uint32_t f = kv.second.file;
+        if(!ok[f]) continue;
+        if(indices[f] < 0)
+        {
+            indices[f] = (int)elf.source_files.size();
+            elf.source_files.resize(elf.source_files.size() + 1);
+            auto& sf = elf.source_files.back();
+            sf.filename = filenames[f];
+            sf.lines = std::move(contents[f]);
+            elf.source_file_names[sf.filename] = indices[f];
+        }
+        elf.source_lines[kv.first] = { indices[f], kv.second.line };
+    }
+}
+
+static void load_elf_debug(
+    absim::elf_data_t& elf,
+    elf_debug_prog_t const& cpu,
+    llvm::DWARFContext* dwarf_ctx,
+    std::atomic<bool> const& cancel)
+{
+    using namespace llvm;
 
 #if 0
     // get frame unwind info
@@ -514,8 +954,12 @@ static void load_elf_debug(
 #endif
 
     // find source lines for each address
+    std::vector<std::string> filenames;
+    std::unordered_map<std::string, uint32_t> filename_indices;
+    std::vector<std::pair<uint16_t, source_line_ref_t>> lines;
     for(size_t a = 0; a < cpu.last_addr; a += 2)
     {
+        if(cancel) return;
         auto* cu = dwarf_ctx->getCompileUnitForAddress(a);
         if(!cu) continue;
         auto* tab = dwarf_ctx->getLineTableForUnit(cu);
@@ -533,8 +977,16 @@ static void load_elf_debug(
             llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath,
             source_file))
             continue;
-        add_file_to_elf(elf, (uint16_t)a, source_file, (int)it->Line - 1);
+        auto fit = filename_indices.find(source_file);
+        if(fit == filename_indices.end())
+        {
+            fit = filename_indices.emplace(source_file, (uint32_t)filenames.size()).first;
+            filenames.push_back(source_file);
+        }
+        lines.push_back({ (uint16_t)a, { fit->second, (int)it->Line - 1 } });
     }
+    load_elf_source_files(elf, filenames, lines);
+    if(cancel) return;
 
     // create intermixed asm with source/symbols
     {
@@ -617,12 +1069,23 @@ static void load_elf_debug(
     // track globals
     for(auto const& cu : dwarf_ctx->compile_units())
     {
+        if(cancel) return;
         auto const& u = cu->getUnitDIE();
         for(auto const& v : u.children())
         {
-            load_elf_debug_recurse_globals(a, elf, "", dwarf_ctx, cu.get(), v);
+            load_elf_debug_recurse_globals(elf, "", dwarf_ctx, cu.get(), v);
         }
     }
+    load_elf_debug_index_globals(elf, dwarf_ctx);
+
+    // index locals by pc
+    for(auto const& cu : dwarf_ctx->compile_units())
+    {
+        if(cancel) return;
+        load_elf_debug_index_locals(elf, cu->getUnitDIE());
+    }
+    std::stable_sort(elf.scopes.begin(), elf.scopes.end(),
+        [](auto const& a, auto const& b) { return a.begin < b.begin; });
 }
 
 static std::string load_elf(arduboy_t& a, std::istream& f, std::string const& fname)
@@ -806,6 +1269,8 @@ static std::string load_elf(arduboy_t& a, std::istream& f, std::string const& fn
     std::sort(elf.data_symbols_sorted_size.begin(), elf.data_symbols_sorted_size.end(),
         [&](uint16_t a, uint16_t b) { return elf.data_symbols[a].size > elf.data_symbols[b].size; });
 
+    elf.build_symbol_index();
+
     // note object text symbols in disassembly
     for(auto const& kv : elf.text_symbols)
     {
@@ -823,12 +1288,30 @@ static std::string load_elf(arduboy_t& a, std::istream& f, std::string const& fn
         }
     }
 
-    // load debug info
-    auto dwarf_ctx = DWARFContext::create(*obj);
-    load_elf_debug(a, elf, obj, dwarf_ctx.get());
-
+    // load debug info: in the background where possible, so the game can
+    // start (and rebuilds reload) without waiting on it
     elf.obj.swap(bin_or_err.get());
-    elf.dwarf_ctx.swap(dwarf_ctx);
+    elf.dwarf_ctx = DWARFContext::create(*elf.obj);
+    elf.debug_loader.reset(new elf_debug_loader_t);
+    {
+        auto prog = std::make_shared<elf_debug_prog_t>();
+        prog->last_addr = cpu.last_addr;
+        prog->num_instrs = cpu.num_instrs;
+        prog->disassembled_prog.assign(
+            cpu.disassembled_prog.begin(),
+            cpu.disassembled_prog.begin() + cpu.num_instrs);
+        auto* loader = elf.debug_loader.get();
+        auto task = [&elf, loader, prog]() {
+            load_elf_debug(elf, *prog, elf.dwarf_ctx.get(), loader->cancel);
+            loader->ready = true;
+        };
+#if ARDENS_ELF_DEBUG_THREAD
+        loader->thread = std::thread(task);
+#else
+        task();
+#endif
+    }
+
     a.elf.swap(elf_ptr);
 
     return "";
@@ -843,12 +1326,10 @@ static std::string load_elf(arduboy_t& a, std::string const& fname)
 }
 #endif
 
-static std::string load_bin(arduboy_t& a, std::istream& f, bool save)
+// checks the size of the FX data (or save) already in place
+static std::string check_bin(arduboy_t& a, bool save)
 {
     auto& d = save ? a.fxsave : a.fxdata;
-    d = std::vector<uint8_t>(
-        (std::istreambuf_iterator<char>(f)),
-        std::istreambuf_iterator<char>());
     if(a.fxdata.size() + a.fxsave.size() >= a.fx.DATA_BYTES)
         return "BIN: FX data too large";
 
@@ -870,6 +1351,19 @@ not_flashcart:
     return "";
 }
 
+static std::string load_bin(arduboy_t& a, uint8_t const* data, size_t size, bool save)
+{
+    auto& d = save ? a.fxsave : a.fxdata;
+    d.assign(data, data + size);
+    return check_bin(a, save);
+}
+
+static std::string load_bin(arduboy_t& a, std::istream& f, bool save)
+{
+    read_stream(f, save ? a.fxsave : a.fxdata);
+    return check_bin(a, save);
+}
+
 static std::string load_bin(arduboy_t& a, std::string const& fname, bool save)
 {
     std::ifstream f(fname, std::ios::binary);
@@ -880,12 +1374,8 @@ static std::string load_bin(arduboy_t& a, std::string const& fname, bool save)
 
 #ifndef ARDENS_NO_ARDUBOY_FILE
 
-static std::string load_arduboy(arduboy_t& a, std::istream& f)
+static std::string load_arduboy(arduboy_t& a, uint8_t const* fdata, size_t fsize)
 {
-    std::vector<uint8_t> fdata(
-        (std::istreambuf_iterator<char>(f)),
-        std::istreambuf_iterator<char>());
-
     struct zip_t
     {
         mz_zip_archive z = {};
@@ -893,7 +1383,8 @@ static std::string load_arduboy(arduboy_t& a, std::istream& f)
     };
     zip_t zip;
     auto* z = &zip.z;
-    mz_zip_reader_init_mem(z, fdata.data(), fdata.size(), 0);
+    if(MZ_FALSE == mz_zip_reader_init_mem(z, fdata, fsize, 0))
+        return "ARDUBOY: could not open archive";
 
     std::vector<char> info;
     {
@@ -956,7 +1447,7 @@ static std::string load_arduboy(arduboy_t& a, std::istream& f)
     if(title && yyjson_is_str(title))
         a.title = yyjson_get_str(title);
 
-    std::vector<char> data;
+    std::vector<uint8_t> data;
     {
         int i = mz_zip_reader_locate_file(z, yyjson_get_str(hexfile), nullptr, 0);
         if(i == -1)
@@ -968,8 +1459,7 @@ static std::string load_arduboy(arduboy_t& a, std::istream& f)
     }
 
     {
-        std::stringstream ss(std::string(data.begin(), data.end()));
-        std::string err = load_hex(a, ss);
+        std::string err = load_hex(a, data.data(), data.size());
         if(!err.empty()) return err;
     }
 
@@ -1026,6 +1516,13 @@ static std::string load_arduboy(arduboy_t& a, std::istream& f)
     return "";
 }
 
+static std::string load_arduboy(arduboy_t& a, std::istream& f)
+{
+    std::vector<uint8_t> d;
+    read_stream(f, d);
+    return load_arduboy(a, d.data(), d.size());
+}
+
 static std::string load_arduboy(arduboy_t& a, std::string const& fname)
 {
     std::ifstream f(fname, std::ios::binary);
@@ -1115,8 +1612,7 @@ std::string arduboy_t::load_bootloader_hex(std::istream& f)
 
 std::string arduboy_t::load_bootloader_hex(uint8_t const* data, size_t size)
 {
-    istrstream f((char const*)data, (int)size);
-    return load_bootloader_hex(f);
+    return load_hex(*this, data, size, true);
 }
 
 std::string arduboy_t::load_flashcart_zip(uint8_t const* data, size_t size)
@@ -1147,13 +1643,14 @@ std::string arduboy_t::load_flashcart_zip(uint8_t const* data, size_t size)
     if(stat.m_uncomp_size > fx.DATA_BYTES)
         return "FLASHCART: data file too large";
 
-    std::vector<uint8_t> fdata;
-    fdata.resize((size_t)stat.m_uncomp_size);
-    if(MZ_FALSE == mz_zip_reader_extract_to_mem(z, 0, fdata.data(), fdata.size(), 0))
+    fxdata.resize((size_t)stat.m_uncomp_size);
+    if(MZ_FALSE == mz_zip_reader_extract_to_mem(z, 0, fxdata.data(), fxdata.size(), 0))
+    {
+        fxdata.clear();
         return "FLASHCART: could not extract data file";
+    }
 
-    istrstream f((char const*)fdata.data(), (int)fdata.size());
-    auto r = load_bin(*this, f, false);
+    auto r = check_bin(*this, false);
     if(!r.empty()) return r;
 
     if(!flashcart_loaded)
@@ -1175,46 +1672,56 @@ std::string arduboy_t::load_flashcart_zip(uint8_t const* data, size_t size)
     return "";
 }
 
-std::string arduboy_t::load_file(char const* filename, std::istream& f, bool save)
+// keep is set if data is the program file to remember for snapshots
+static std::string load_file_data(arduboy_t& a, char const* filename,
+    uint8_t const* data, size_t size, bool save, bool& keep)
 {
-    if(f.fail())
-        return "Failed to open file";
-
+    auto& cpu = a.cpu;
     std::string fname(filename);
     std::string r;
+    keep = false;
+
+    if(ends_with(fname, ".ardmovie"))
+    {
+        if(!cpu.decoded)
+            return "Load the game before its movie";
+        istrstream f((char const*)data, (std::streamsize)size);
+        return a.start_movie_playback(f);
+    }
 
     if(ends_with(fname, ".save"))
     {
         if(cpu.decoded)
         {
-            reset();
-            if(load_savedata(f))
-                savedata_dirty = true;
+            a.reset();
+            istrstream f((char const*)data, (std::streamsize)size);
+            if(a.load_savedata(f))
+                a.savedata_dirty = true;
         }
         return "";
     }
 
     if(ends_with(fname, ".hex"))
     {
-        flashcart_loaded = false;
-        reset();
-        elf.reset();
-        device_type.clear();
-        r = load_hex(*this, f);
+        a.flashcart_loaded = false;
+        a.reset();
+        a.elf.reset();
+        a.device_type.clear();
+        r = load_hex(a, data, size);
         if(r.empty())
         {
-            check_for_fx_usage_in_prog(*this);
+            check_for_fx_usage_in_prog(a);
             cpu.program_loaded = true;
         }
-        reset();
+        a.reset();
     }
 
     if(ends_with(fname, ".bin"))
     {
-        reset();
-        r = load_bin(*this, f, save);
-        reload_fx();
-        if(flashcart_loaded)
+        a.reset();
+        r = load_bin(a, data, size, save);
+        a.reload_fx();
+        if(a.flashcart_loaded)
         {
             // add instruction to jump to bootloader
             uint16_t w0 = 0x940c;
@@ -1224,7 +1731,7 @@ std::string arduboy_t::load_file(char const* filename, std::istream& f, bool sav
             cpu.prog[2] = uint8_t(w1 >> 0);
             cpu.prog[3] = uint8_t(w1 >> 8);
             cpu.program_loaded = true;
-            reset();
+            a.reset();
         }
         return r;
     }
@@ -1232,52 +1739,80 @@ std::string arduboy_t::load_file(char const* filename, std::istream& f, bool sav
 #ifdef ARDENS_LLVM
     if(ends_with(fname, ".elf"))
     {
-        flashcart_loaded = false;
-        reset();
-        device_type.clear();
-        r = load_elf(*this, f, fname);
+        a.flashcart_loaded = false;
+        a.reset();
+        a.device_type.clear();
+        istrstream f((char const*)data, (std::streamsize)size);
+        r = load_elf(a, f, fname);
         if(r.empty())
         {
-            check_for_fx_usage_in_prog(*this);
+            check_for_fx_usage_in_prog(a);
             cpu.program_loaded = true;
         }
-        reset();
-}
+        a.reset();
+    }
 #endif
 
 #ifndef ARDENS_NO_ARDUBOY_FILE
     if(ends_with(fname, ".arduboy"))
     {
-        flashcart_loaded = false;
-        reset();
-        elf.reset();
-        device_type.clear();
-        r = load_arduboy(*this, f);
-        reload_fx();
+        a.flashcart_loaded = false;
+        a.reset();
+        a.elf.reset();
+        a.device_type.clear();
+        r = load_arduboy(a, data, size);
+        a.reload_fx();
         if(r.empty())
             cpu.program_loaded = true;
-        reset();
+        a.reset();
     }
 #endif
 
 #ifndef ARDENS_NO_SNAPSHOTS
     if(ends_with(fname, ".snapshot"))
     {
-        r = load_snapshot(f);
+        istrstream f((char const*)data, (std::streamsize)size);
+        r = a.load_snapshot(f);
     }
     else
 #endif
     if(r.empty())
     {
-        f.clear();
-        f.seekg(0);
+        keep = true;
+        a.reload_fx();
+    }
+
+    return r;
+}
+
+std::string arduboy_t::load_file(char const* filename, std::istream& f, bool save)
+{
+    if(f.fail())
+        return "Failed to open file";
+
+    std::vector<uint8_t> d;
+    read_stream(f, d);
+    bool keep;
+    auto r = load_file_data(*this, filename, d.data(), d.size(), save, keep);
+    if(keep)
+    {
         prog_filename = filename;
-        prog_filedata = std::vector<uint8_t>(
-            (std::istreambuf_iterator<char>(f)),
-            std::istreambuf_iterator<char>());
-        reload_fx();
+        prog_filedata = std::move(d);
     }
+    return r;
+}
 
+std::string arduboy_t::load_file(
+    char const* filename, uint8_t const* data, size_t size, bool save)
+{
+    bool keep;
+    auto r = load_file_data(*this, filename, data, size, save, keep);
+    if(keep)
+    {
+        prog_filename = filename;
+        if(data != prog_filedata.data())
+            prog_filedata.assign(data, data + size);
+    }
     return r;
 }
 
@@ -35,60 +35,106 @@ static uint32_t instr_is_delay(atmega32u4_t const& cpu, size_t n)
     case INSTR_NOP:
         return 1;
     case INSTR_RJMP:
-    {
-        if(i.word == 0)
-            return 2;
-        size_t nr = n + i.word + 1;
-        if(nr < cpu.decoded_prog.size() && cpu.decoded_prog[nr].func == INSTR_RET)
-            return 7;
-    }
+        // rjmp .+0
+        return i.word == 0 ? 2 : 0;
     default:
         return 0;
     }
 }
 
-void atmega32u4_t::merge_instrs()
+#ifndef ARDENS_NO_DEBUGGER
+void atmega32u4_t::profile_merged_instr(
+    uint16_t instr_pc, uint32_t stack_depth, avr_instr_t i, uint32_t cycles)
 {
-    memcpy(merged_prog.data(), &decoded_prog, array_bytes(merged_prog));
+    // statically split the cycles of a merged instr between the original
+    // instrs it replaced, so hotspots match unmerged profiling
+    if(merged_profiler_callgraph)
+        merged_profiler_callgraph->charge(*this, instr_pc, stack_depth, cycles);
 
-    for(auto& i : merged_prog)
+    auto* counts = merged_profiler_counts;
+    constexpr size_t n = PROG_SIZE_BYTES / 2;
+    switch(i.func)
+    {
+    case INSTR_MERGED_LDI2:
+    case INSTR_MERGED_DEC_BRNE:
+    case INSTR_MERGED_ADD_ADC:
+    case INSTR_MERGED_SUB_SBC:
+    case INSTR_MERGED_CP_CPC:
+    case INSTR_MERGED_SUBI_SBCI:
+        // first instr is always single-cycle
+        counts[instr_pc] += 1;
+        if(instr_pc + 1u < n)
+            counts[instr_pc + 1] += cycles - 1;
+        break;
+    case INSTR_MERGED_DELAY:
     {
-        switch(i.func)
+        size_t m = instr_pc;
+        size_t end = std::min<size_t>(instr_pc + i.src, n);
+        while(cycles > 0 && m < end)
         {
-        case INSTR_OUT     : i.func = INSTR_MERGED_OUT     ; break;
-        case INSTR_IN      : i.func = INSTR_MERGED_IN      ; break;
-        case INSTR_LDS     : i.func = INSTR_MERGED_LDS     ; break;
-        case INSTR_STS     : i.func = INSTR_MERGED_STS     ; break;
-        case INSTR_LDD_Y   : i.func = INSTR_MERGED_LDD_Y   ; break;
-        case INSTR_LDD_Z   : i.func = INSTR_MERGED_LDD_Z   ; break;
-        case INSTR_STD_Y   : i.func = INSTR_MERGED_STD_Y   ; break;
-        case INSTR_STD_Z   : i.func = INSTR_MERGED_STD_Z   ; break;
-        case INSTR_LD_ST   : i.func = INSTR_MERGED_LD_ST   ; break;
-        case INSTR_LD_X    : i.func = INSTR_MERGED_LD_X    ; break;
-        case INSTR_LD_Y    : i.func = INSTR_MERGED_LD_Y    ; break;
-        case INSTR_LD_Z    : i.func = INSTR_MERGED_LD_Z    ; break;
-        case INSTR_LD_X_INC: i.func = INSTR_MERGED_LD_X_INC; break;
-        case INSTR_LD_Y_INC: i.func = INSTR_MERGED_LD_Y_INC; break;
-        case INSTR_LD_Z_INC: i.func = INSTR_MERGED_LD_Z_INC; break;
-        case INSTR_LD_X_DEC: i.func = INSTR_MERGED_LD_X_DEC; break;
-        case INSTR_LD_Y_DEC: i.func = INSTR_MERGED_LD_Y_DEC; break;
-        case INSTR_LD_Z_DEC: i.func = INSTR_MERGED_LD_Z_DEC; break;
-        case INSTR_ST_X    : i.func = INSTR_MERGED_ST_X    ; break;
-        case INSTR_ST_Y    : i.func = INSTR_MERGED_ST_Y    ; break;
-        case INSTR_ST_Z    : i.func = INSTR_MERGED_ST_Z    ; break;
-        case INSTR_ST_X_INC: i.func = INSTR_MERGED_ST_X_INC; break;
-        case INSTR_ST_Y_INC: i.func = INSTR_MERGED_ST_Y_INC; break;
-        case INSTR_ST_Z_INC: i.func = INSTR_MERGED_ST_Z_INC; break;
-        case INSTR_ST_X_DEC: i.func = INSTR_MERGED_ST_X_DEC; break;
-        case INSTR_ST_Y_DEC: i.func = INSTR_MERGED_ST_Y_DEC; break;
-        case INSTR_ST_Z_DEC: i.func = INSTR_MERGED_ST_Z_DEC; break;
-        case INSTR_SBI     : i.func = INSTR_MERGED_SBI     ; break;
-        case INSTR_CBI     : i.func = INSTR_MERGED_CBI     ; break;
-        case INSTR_SBIS    : i.func = INSTR_MERGED_SBIS    ; break;
-        case INSTR_SBIC    : i.func = INSTR_MERGED_SBIC    ; break;
-        default: break;
+            size_t next = m + (instr_is_two_words(decoded_prog[m]) ? 2 : 1);
+            uint32_t t = next < end ? instr_is_delay(*this, m) : cycles;
+            t = std::min(t, cycles);
+            counts[m] += t;
+            cycles -= t;
+            m = next;
         }
+        if(cycles > 0)
+            counts[instr_pc] += cycles;
+        break;
+    }
+    default:
+        counts[instr_pc] += cycles;
+        break;
+    }
+}
+#endif
+
+// merged variant of a single instr
+static avr_instr_t merged_single_instr(avr_instr_t i)
+{
+    switch(i.func)
+    {
+    case INSTR_OUT     : i.func = INSTR_MERGED_OUT     ; break;
+    case INSTR_IN      : i.func = INSTR_MERGED_IN      ; break;
+    case INSTR_LDS     : i.func = INSTR_MERGED_LDS     ; break;
+    case INSTR_STS     : i.func = INSTR_MERGED_STS     ; break;
+    case INSTR_LDD_Y   : i.func = INSTR_MERGED_LDD_Y   ; break;
+    case INSTR_LDD_Z   : i.func = INSTR_MERGED_LDD_Z   ; break;
+    case INSTR_STD_Y   : i.func = INSTR_MERGED_STD_Y   ; break;
+    case INSTR_STD_Z   : i.func = INSTR_MERGED_STD_Z   ; break;
+    case INSTR_LD_ST   : i.func = INSTR_MERGED_LD_ST   ; break;
+    case INSTR_LD_X    : i.func = INSTR_MERGED_LD_X    ; break;
+    case INSTR_LD_Y    : i.func = INSTR_MERGED_LD_Y    ; break;
+    case INSTR_LD_Z    : i.func = INSTR_MERGED_LD_Z    ; break;
+    case INSTR_LD_X_INC: i.func = INSTR_MERGED_LD_X_INC; break;
+    case INSTR_LD_Y_INC: i.func = INSTR_MERGED_LD_Y_INC; break;
+    case INSTR_LD_Z_INC: i.func = INSTR_MERGED_LD_Z_INC; break;
+    case INSTR_LD_X_DEC: i.func = INSTR_MERGED_LD_X_DEC; break;
+    case INSTR_LD_Y_DEC: i.func = INSTR_MERGED_LD_Y_DEC; break;
+    case INSTR_LD_Z_DEC: i.func = INSTR_MERGED_LD_Z_DEC; break;
+    case INSTR_ST_X    : i.func = INSTR_MERGED_ST_X    ; break;
+    case INSTR_ST_Y    : i.func = INSTR_MERGED_ST_Y    ; break;
+    case INSTR_ST_Z    : i.func = INSTR_MERGED_ST_Z    ; break;
+    case INSTR_ST_X_INC: i.func = INSTR_MERGED_ST_X_INC; break;
+    case INSTR_ST_Y_INC: i.func = INSTR_MERGED_ST_Y_INC; break;
+    case INSTR_ST_Z_INC: i.func = INSTR_MERGED_ST_Z_INC; break;
+    case INSTR_ST_X_DEC: i.func = INSTR_MERGED_ST_X_DEC; break;
+    case INSTR_ST_Y_DEC: i.func = INSTR_MERGED_ST_Y_DEC; break;
+    case INSTR_ST_Z_DEC: i.func = INSTR_MERGED_ST_Z_DEC; break;
+    case INSTR_SBI     : i.func = INSTR_MERGED_SBI     ; break;
+    case INSTR_CBI     : i.func = INSTR_MERGED_CBI     ; break;
+    case INSTR_SBIS    : i.func = INSTR_MERGED_SBIS    ; break;
+    case INSTR_SBIC    : i.func = INSTR_MERGED_SBIC    ; break;
+    default: break;
     }
+    return i;
+}
+
+void atmega32u4_t::merge_instrs()
+{
+    for(size_t n = 0; n < merged_prog.size(); ++n)
+        merged_prog[n] = merged_single_instr(decoded_prog[n]);
 
     for(size_t n = 0; n + 1 < merged_prog.size(); ++n)
     {
@@ -113,7 +159,8 @@ void atmega32u4_t::merge_instrs()
         if(i0.func == INSTR_ADD &&
             i1.func == INSTR_ADC &&
             i0.dst + 1 == i1.dst &&
-            i0.src + 1 == i1.src)
+            i0.src + 1 == i1.src &&
+            i0.dst != i1.src) // second instr reads the first's result
         {
             i0.func = INSTR_MERGED_ADD_ADC;
             continue;
@@ -122,7 +169,8 @@ void atmega32u4_t::merge_instrs()
         if(i0.func == INSTR_SUB &&
             i1.func == INSTR_SBC &&
             i0.dst + 1 == i1.dst &&
-            i0.src + 1 == i1.src)
+            i0.src + 1 == i1.src &&
+            i0.dst != i1.src) // second instr reads the first's result
         {
             i0.func = INSTR_MERGED_SUB_SBC;
             continue;
@@ -138,7 +186,8 @@ void atmega32u4_t::merge_instrs()
         }
 
         if(i0.func == INSTR_SUBI &&
-            i1.func == INSTR_SBCI)
+            i1.func == INSTR_SBCI &&
+            i0.dst != i1.dst)
         {
             i0.func = INSTR_MERGED_SUBI_SBCI;
             i0.word = i0.src + i1.src * 256;
@@ -147,25 +196,79 @@ void atmega32u4_t::merge_instrs()
         }
 
         {
+            // run of delay instrs: d cycles over w words
             uint32_t d = 0;
-            uint32_t n = 0;
-            for(size_t m = n; n < 254 && m < decoded_prog.size(); ++n)
+            uint32_t w = 0;
+            for(size_t m = n; w < 254 && m < decoded_prog.size(); ++m, ++w)
             {
                 uint32_t t = instr_is_delay(*this, m);
                 if(t == 0) break;
                 if(d + t > MAX_INSTR_CYCLES)
                     break;
                 d += t;
-                n += instr_is_two_words(decoded_prog[m]) ? 2 : 1;
             }
             if(d > 1)
             {
                 i0.func = INSTR_MERGED_DELAY;
-                i0.src = (uint8_t)n;
+                i0.src = (uint8_t)w;
                 i0.word = (uint16_t)d;
             }
         }
     }
+
+#ifndef ARDENS_NO_DEBUGGER
+    install_merged_traps();
+#endif
+}
+
+#ifndef ARDENS_NO_DEBUGGER
+static bool merged_instr_covers(avr_instr_t i, size_t n, size_t addr)
+{
+    switch(i.func)
+    {
+    case INSTR_MERGED_LDI2:
+    case INSTR_MERGED_DEC_BRNE:
+    case INSTR_MERGED_ADD_ADC:
+    case INSTR_MERGED_SUB_SBC:
+    case INSTR_MERGED_CP_CPC:
+    case INSTR_MERGED_SUBI_SBCI:
+        return n + 1 == addr;
+    case INSTR_MERGED_DELAY:
+        return n + i.src > addr;
+    default:
+        return false;
+    }
+}
+
+void atmega32u4_t::install_merged_traps()
+{
+    for(size_t addr = 0; addr < merged_traps.size(); ++addr)
+    {
+        if(!merged_traps.test(addr))
+            continue;
+        merged_prog[addr].func = INSTR_MERGED_TRAP;
+
+        // split up merged instrs that would execute past the trap
+        size_t first = addr > 255 ? addr - 255 : 0;
+        for(size_t n = first; n < addr; ++n)
+        {
+            if(merged_instr_covers(merged_prog[n], n, addr))
+                merged_prog[n] = merged_single_instr(decoded_prog[n]);
+        }
+    }
+}
+
+void atmega32u4_t::set_merged_traps(std::bitset<PROG_SIZE_BYTES / 2> const& traps)
+{
+    if(traps == merged_traps)
+        return;
+    bool removed = (merged_traps & ~traps).any();
+    merged_traps = traps;
+    if(removed)
+        merge_instrs();
+    else
+        install_merged_traps();
 }
+#endif
 
 }
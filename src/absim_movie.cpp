@@ -0,0 +1,614 @@
+#include "absim_movie.hpp"
+
+#include <iterator>
+
+namespace absim
+{
+
+constexpr char MOVIE_MAGIC[8] = { 'A', 'R', 'D', 'M', 'O', 'V', 'I', 'E' };
+constexpr uint8_t MOVIE_BOOTLOADER = 0x01;
+constexpr uint8_t MOVIE_BOOT_TO_MENU = 0x02;
+
+static void put_varint(std::vector<uint8_t>& v, uint64_t x)
+{
+    while(x >= 0x80)
+    {
+        v.push_back(uint8_t(x | 0x80));
+        x >>= 7;
+    }
+    v.push_back(uint8_t(x));
+}
+
+static void put_le(std::vector<uint8_t>& v, uint64_t x, int bytes)
+{
+    for(int i = 0; i < bytes; ++i)
+        v.push_back(uint8_t(x >> (i * 8)));
+}
+
+static void put_blob(std::vector<uint8_t>& v, std::vector<uint8_t> const& b)
+{
+    put_le(v, b.size(), 4);
+    v.insert(v.end(), b.begin(), b.end());
+}
+
+// bounds-checked reads: ok is cleared on the first read past the end
+struct movie_reader_t
+{
+    uint8_t const* p;
+    uint8_t const* end;
+    bool ok;
+
+    movie_reader_t(std::vector<uint8_t> const& v)
+        : p(v.data()), end(v.data() + v.size()), ok(true)
+    {}
+
+    size_t left() const { return size_t(end - p); }
+
+    uint64_t le(int bytes)
+    {
+        if(left() < size_t(bytes))
+        {
+            ok = false;
+            return 0;
+        }
+        uint64_t x = 0;
+        for(int i = 0; i < bytes; ++i)
+            x |= uint64_t(*p++) << (i * 8);
+        return x;
+    }
+
+    uint64_t varint()
+    {
+        uint64_t x = 0;
+        for(int shift = 0; p < end && shift < 64; shift += 7)
+        {
+            uint8_t t = *p++;
+            x |= uint64_t(t & 0x7f) << shift;
+            if(!(t & 0x80))
+                return x;
+        }
+        ok = false;
+        return 0;
+    }
+
+    void bytes(uint8_t* dst, size_t n)
+    {
+        if(left() < n)
+        {
+            ok = false;
+            return;
+        }
+        memcpy(dst, p, n);
+        p += n;
+    }
+
+    void blob(std::vector<uint8_t>& v)
+    {
+        size_t n = size_t(le(4));
+        if(left() < n)
+        {
+            ok = false;
+            return;
+        }
+        v.assign(p, p + n);
+        p += n;
+    }
+};
+
+void movie_deleter_t::operator()(movie_t* m) const
+{
+    delete m;
+}
+
+uint64_t movie_state_hash(arduboy_t& a)
+{
+    // FNV-1a 64-bit
+    constexpr uint64_t OFFSET = 0xcbf29ce484222325;
+    constexpr uint64_t PRIME = 0x100000001b3;
+    uint64_t h = OFFSET;
+    auto add = [&](uint64_t x, int bytes) {
+        for(int i = 0; i < bytes; ++i)
+        {
+            h ^= uint8_t(x >> (i * 8));
+            h *= PRIME;
+        }
+    };
+    add(a.cpu.cycle_count, 8);
+    add(a.cpu.pc, 2);
+    for(uint8_t byte : a.cpu.data)
+        add(byte, 1);
+    return h;
+}
+
+std::string movie_t::save(std::ostream& f) const
+{
+    std::vector<uint8_t> v;
+    v.insert(v.end(), std::begin(MOVIE_MAGIC), std::end(MOVIE_MAGIC));
+    put_le(v, MOVIE_VERSION, 4);
+    put_le(v, game_hash, 8);
+    put_le(v, start_type, 1);
+    put_le(v, start_cycle, 8);
+    put_le(v, end_cycle, 8);
+
+    if(start_type == MOVIE_START_POWER_ON)
+    {
+        std::vector<uint8_t> s;
+        put_le(s, uint8_t(cfg.display_type), 1);
+        put_le(s, cfg.fxport_reg, 1);
+        put_le(s, cfg.fxport_mask, 1);
+        put_le(s,
+            (cfg.bootloader ? MOVIE_BOOTLOADER : 0) |
+            (cfg.boot_to_menu ? MOVIE_BOOT_TO_MENU : 0), 1);
+        put_le(s, adc_seed, 4);
+        put_le(s, eeprom.size(), 2);
+        s.insert(s.end(), eeprom.begin(), eeprom.end());
+        put_le(s, fx_sectors.size(), 4);
+        for(auto const& kv : fx_sectors)
+        {
+            put_le(s, kv.first, 4);
+            s.insert(s.end(), kv.second.begin(), kv.second.end());
+        }
+        std::vector<uint8_t> c;
+        if(!compress_zlib(c, s.data(), s.size()))
+            return "Movie: compression failed";
+        put_blob(v, c);
+    }
+    else
+        put_blob(v, start_state);
+
+    put_le(v, events.size(), 4);
+    uint64_t prev_cycle = start_cycle;
+    movie_event_t prev{ 0, 0x10, 0x40, 0xf0 };
+    for(auto const& e : events)
+    {
+        uint8_t flags = 0;
+        if(e.pinb != prev.pinb) flags |= MOVIE_PINB;
+        if(e.pine != prev.pine) flags |= MOVIE_PINE;
+        if(e.pinf != prev.pinf) flags |= MOVIE_PINF;
+        put_varint(v, e.cycle - prev_cycle);
+        v.push_back(flags);
+        if(flags & MOVIE_PINB) v.push_back(e.pinb);
+        if(flags & MOVIE_PINE) v.push_back(e.pine);
+        if(flags & MOVIE_PINF) v.push_back(e.pinf);
+        prev_cycle = e.cycle;
+        prev = e;
+    }
+
+    put_le(v, keyframe_cycles, 8);
+    put_le(v, keyframes.size(), 4);
+    for(auto const& k : keyframes)
+    {
+        put_le(v, k.cycle, 8);
+        put_le(v, k.event, 4);
+        put_le(v, k.hash, 8);
+        put_blob(v, k.state);
+    }
+
+    f.write((char const*)v.data(), std::streamsize(v.size()));
+    if(f.fail())
+        return "Movie: write failed";
+    return "";
+}
+
+std::string movie_t::load(std::istream& f)
+{
+    if(f.fail())
+        return "Movie: failed to open file";
+    std::vector<uint8_t> v(
+        (std::istreambuf_iterator<char>(f)),
+        std::istreambuf_iterator<char>());
+    movie_reader_t r(v);
+
+    uint8_t magic[8];
+    r.bytes(magic, sizeof(magic));
+    if(!r.ok || memcmp(magic, MOVIE_MAGIC, sizeof(magic)) != 0)
+        return "Movie: invalid identifier";
+    if(r.le(4) != MOVIE_VERSION)
+        return "Movie: incompatible version";
+    game_hash = r.le(8);
+    start_type = uint8_t(r.le(1));
+    start_cycle = r.le(8);
+    end_cycle = r.le(8);
+    if(!r.ok)
+        return "Movie: truncated data";
+
+    if(start_type == MOVIE_START_POWER_ON)
+    {
+        std::vector<uint8_t> c, s;
+        r.blob(c);
+        if(!r.ok || !uncompress_zlib(s, c.data(), c.size()))
+            return "Movie: invalid start data";
+        movie_reader_t sr(s);
+        uint8_t display_type = uint8_t(sr.le(1));
+        if(display_type > display_t::SH1106)
+            return "Movie: invalid display type";
+        cfg.display_type = display_t::type_t(display_type);
+        cfg.fxport_reg = uint8_t(sr.le(1));
+        cfg.fxport_mask = uint8_t(sr.le(1));
+        uint8_t flags = uint8_t(sr.le(1));
+        cfg.bootloader = (flags & MOVIE_BOOTLOADER) != 0;
+        cfg.boot_to_menu = (flags & MOVIE_BOOT_TO_MENU) != 0;
+        adc_seed = uint32_t(sr.le(4));
+        eeprom.resize(size_t(sr.le(2)));
+        sr.bytes(eeprom.data(), eeprom.size());
+        uint32_t num_sectors = uint32_t(sr.le(4));
+        fx_sectors.clear();
+        for(uint32_t i = 0; sr.ok && i < num_sectors; ++i)
+        {
+            uint32_t sector = uint32_t(sr.le(4));
+            if(sector >= w25q128_t::NUM_SECTORS)
+                return "Movie: invalid fx sector";
+            auto& d = fx_sectors[sector];
+            sr.bytes(d.data(), d.size());
+        }
+        if(!sr.ok)
+            return "Movie: invalid start data";
+    }
+    else if(start_type == MOVIE_START_STATE)
+    {
+        r.blob(start_state);
+        if(!r.ok)
+            return "Movie: truncated data";
+    }
+    else
+        return "Movie: invalid start type";
+
+    uint32_t num_events = uint32_t(r.le(4));
+    if(num_events > r.left() / 2)
+        return "Movie: truncated data";
+    events.clear();
+    events.reserve(num_events);
+    uint64_t event_cycle = start_cycle;
+    movie_event_t e{ 0, 0x10, 0x40, 0xf0 };
+    for(uint32_t i = 0; r.ok && i < num_events; ++i)
+    {
+        event_cycle += r.varint();
+        uint8_t flags = uint8_t(r.le(1));
+        if(flags & MOVIE_PINB) e.pinb = uint8_t(r.le(1));
+        if(flags & MOVIE_PINE) e.pine = uint8_t(r.le(1));
+        if(flags & MOVIE_PINF) e.pinf = uint8_t(r.le(1));
+        e.cycle = event_cycle;
+        events.push_back(e);
+    }
+
+    keyframe_cycles = r.le(8);
+    uint32_t num_keyframes = uint32_t(r.le(4));
+    if(num_keyframes > r.left() / 24)
+        return "Movie: truncated data";
+    keyframes.clear();
+    keyframes.resize(num_keyframes);
+    for(auto& k : keyframes)
+    {
+        k.cycle = r.le(8);
+        k.event = uint32_t(r.le(4));
+        k.hash = r.le(8);
+        r.blob(k.state);
+        if(k.event > events.size())
+            return "Movie: invalid keyframe";
+    }
+    if(!r.ok)
+        return "Movie: truncated data";
+
+    return "";
+}
+
+static std::string load_movie_state(arduboy_t& a, std::vector<uint8_t> const& v)
+{
+    if(arduboy_t::is_savestate_flat(v.data(), v.size()))
+        return a.load_savestate_flat(v.data(), v.size());
+    std::vector<uint8_t> s;
+    if(!uncompress_zlib(s, v.data(), v.size()))
+        return "Movie: invalid savestate";
+    return a.load_savestate_flat(s.data(), s.size());
+}
+
+// reset to the movie's start. recording fills in the adc seed, which
+// playback restores
+static std::string start_movie(arduboy_t& a, movie_t& m, bool record)
+{
+    if(m.start_type == MOVIE_START_STATE)
+    {
+        a.reset();
+        return load_movie_state(a, m.start_state);
+    }
+
+    if(!record)
+        a.cfg = m.cfg;
+    // the game's fx data under the movie's saved sectors
+    for(auto& s : a.fx.sectors_modified_data)
+        s.reset();
+    a.reload_fx();
+    a.reset();
+    if(record)
+        m.adc_seed = a.cpu.adc_seed;
+    else
+        a.cpu.adc_seed = m.adc_seed;
+    if(m.eeprom.size() == a.cpu.eeprom.size())
+        memcpy(a.cpu.eeprom.data(), m.eeprom.data(), m.eeprom.size());
+    for(auto const& kv : m.fx_sectors)
+        a.fx.write_bytes(kv.first * w25q128_t::SECTOR_BYTES,
+            kv.second.data(), w25q128_t::SECTOR_BYTES);
+    return "";
+}
+
+// resume playback from the current cycle
+static void sync_movie(arduboy_t& a)
+{
+    auto& m = *a.movie;
+    uint64_t cycle = a.cpu.cycle_count;
+    m.next_event = size_t(std::upper_bound(
+        m.events.begin(), m.events.end(), cycle,
+        [](uint64_t c, movie_event_t const& e) { return c < e.cycle; }) -
+        m.events.begin());
+    m.next_keyframe = size_t(std::upper_bound(
+        m.keyframes.begin(), m.keyframes.end(), cycle,
+        [](uint64_t c, movie_keyframe_t const& k) { return c < k.cycle; }) -
+        m.keyframes.begin());
+    if(m.next_event > 0)
+    {
+        auto const& e = m.events[m.next_event - 1];
+        m.pinb = e.pinb;
+        m.pine = e.pine;
+        m.pinf = e.pinf;
+    }
+    else
+    {
+        m.pinb = a.cpu.PINB();
+        m.pine = a.cpu.PINE();
+        m.pinf = a.cpu.PINF();
+    }
+    m.mode = cycle < m.end_cycle ? movie_t::PLAYING : movie_t::FINISHED;
+    m.cycle = cycle;
+}
+
+static void update_movie_next_cycle(arduboy_t& a)
+{
+    auto const& m = *a.movie;
+    uint64_t c = UINT64_MAX;
+    if(m.mode == movie_t::PLAYING)
+    {
+        c = m.end_cycle;
+        if(m.next_event < m.events.size())
+            c = std::min(c, m.events[m.next_event].cycle);
+        if(m.next_keyframe < m.keyframes.size())
+            c = std::min(c, m.keyframes[m.next_keyframe].cycle);
+    }
+    a.movie_next_cycle = c;
+    a.cpu.merged_limit_cycle = c;
+}
+
+std::string arduboy_t::start_movie_recording(bool power_on, uint64_t keyframe_ms)
+{
+    if(!cpu.decoded)
+        return "Movie: no game loaded";
+    if(!is_present_state())
+        return "Movie: return to the present first";
+
+    std::unique_ptr<movie_t, movie_deleter_t> m(new movie_t());
+    m->game_hash = game_hash;
+    m->keyframe_cycles = keyframe_ms == 0 ? UINT64_MAX :
+        keyframe_ms * 1000000000ull / CYCLE_PS;
+    if(power_on)
+    {
+        m->start_type = MOVIE_START_POWER_ON;
+        m->cfg = cfg;
+        if(savedata.eeprom.size() == cpu.eeprom.size())
+            m->eeprom = savedata.eeprom;
+        m->fx_sectors = savedata.fx_sectors;
+        (void)start_movie(*this, *m, true);
+    }
+    else
+    {
+        stop_movie();
+        m->start_type = MOVIE_START_STATE;
+        save_state_to_vector(m->start_state);
+    }
+    m->start_cycle = m->end_cycle = m->cycle = cpu.cycle_count;
+    m->mode = movie_t::RECORDING;
+    movie.swap(m);
+    return "";
+}
+
+std::string arduboy_t::stop_movie_recording(std::ostream& f)
+{
+    if(!movie || movie->mode != movie_t::RECORDING)
+        return "Movie: not recording";
+    auto& m = *movie;
+    m.end_cycle = is_present_state() ? cpu.cycle_count : m.cycle;
+    auto r = m.save(f);
+    stop_movie();
+    return r;
+}
+
+std::string arduboy_t::start_movie_playback(std::istream& f)
+{
+    std::unique_ptr<movie_t, movie_deleter_t> m(new movie_t());
+    auto r = m->load(f);
+    if(!r.empty())
+        return r;
+    if(!cpu.decoded)
+        return "Movie: no game loaded";
+    if(m->game_hash != game_hash)
+        return "Movie: recorded with a different game";
+    stop_movie();
+    m->user_savedata = savedata;
+    m->user_eeprom.assign(cpu.eeprom.begin(), cpu.eeprom.end());
+    m->user_eeprom_modified_bytes = cpu.eeprom_modified_bytes;
+    r = start_movie(*this, *m, false);
+    if(!r.empty())
+        return r;
+    movie.swap(m);
+    sync_movie(*this);
+    update_movie_next_cycle(*this);
+    return "";
+}
+
+std::string arduboy_t::seek_movie(uint64_t cycle)
+{
+    if(!movie || movie->mode == movie_t::RECORDING)
+        return "Movie: not playing";
+
+    // reset clears the movie along with the rest of the history
+    std::unique_ptr<movie_t, movie_deleter_t> m;
+    m.swap(movie);
+    auto r = start_movie(*this, *m, false);
+    if(!r.empty())
+        return r;
+    // advance stops at the first step boundary with less than PS_BUFFER
+    // left, which keyframes past it would overshoot
+    for(size_t k = m->keyframes.size(); k-- > 0; )
+    {
+        auto const& kf = m->keyframes[k];
+        if(kf.cycle * CYCLE_PS + PS_BUFFER <= cycle * CYCLE_PS &&
+            load_movie_state(*this, kf.state).empty())
+            break;
+    }
+    movie.swap(m);
+    sync_movie(*this);
+    update_movie_next_cycle(*this);
+
+    paused = false;
+    ps_rem = 0;
+    if(cycle > cpu.cycle_count)
+        advance((cycle - cpu.cycle_count) * CYCLE_PS);
+    return "";
+}
+
+// the movie's eeprom and fx (and whatever the game saved while playing it)
+// are replaced with the user's: the game's fx data under their saved sectors
+static void restore_user_savedata(arduboy_t& a, movie_t& m)
+{
+    a.savedata = std::move(m.user_savedata);
+    if(m.user_eeprom.size() == a.cpu.eeprom.size())
+        memcpy(a.cpu.eeprom.data(), m.user_eeprom.data(), m.user_eeprom.size());
+    a.cpu.eeprom_modified_bytes = m.user_eeprom_modified_bytes;
+    a.cpu.eeprom_dirty = false;
+    for(auto& s : a.fx.sectors_modified_data)
+        s.reset();
+    a.reload_fx();
+    for(auto const& kv : a.savedata.fx_sectors)
+        a.fx.write_bytes(kv.first * w25q128_t::SECTOR_BYTES,
+            kv.second.data(), w25q128_t::SECTOR_BYTES);
+    a.fx.sectors_dirty = false;
+}
+
+void arduboy_t::stop_movie()
+{
+    std::unique_ptr<movie_t, movie_deleter_t> m;
+    m.swap(movie);
+    movie_next_cycle = UINT64_MAX;
+    cpu.merged_limit_cycle = UINT64_MAX;
+    if(m && m->mode != movie_t::RECORDING)
+        restore_user_savedata(*this, *m);
+}
+
+bool arduboy_t::is_playing_movie() const
+{
+    return movie && movie->mode != movie_t::RECORDING;
+}
+
+void arduboy_t::update_movie()
+{
+    auto& m = *movie;
+    uint64_t cycle = cpu.cycle_count;
+    if(!is_present_state())
+    {
+        movie_next_cycle = UINT64_MAX;
+        cpu.merged_limit_cycle = UINT64_MAX;
+        return;
+    }
+
+    if(m.mode != movie_t::RECORDING)
+    {
+        // the state went back in time (travel_continue, savestates)
+        if(cycle < m.cycle)
+            sync_movie(*this);
+        play_movie_events();
+        return;
+    }
+
+    // discard inputs after the state went back in time
+    if(cycle < m.cycle)
+    {
+        while(!m.events.empty() && m.events.back().cycle >= cycle)
+            m.events.pop_back();
+        while(!m.keyframes.empty() && m.keyframes.back().cycle >= cycle)
+            m.keyframes.pop_back();
+    }
+    m.cycle = cycle;
+
+    movie_event_t e{ cycle, cpu.PINB(), cpu.PINE(), cpu.PINF() };
+    if(!m.events.empty() && m.events.back().cycle == cycle)
+        m.events.back() = e;
+    else if(m.events.empty() ||
+        m.events.back().pinb != e.pinb ||
+        m.events.back().pine != e.pine ||
+        m.events.back().pinf != e.pinf)
+    {
+        m.events.push_back(e);
+    }
+
+    // keyframe states must not change afterwards: wait for the cycle
+    // to move on while paused
+    uint64_t prev = m.keyframes.empty() ? m.start_cycle : m.keyframes.back().cycle;
+    if(!paused && cpu.decoded && cycle - prev >= m.keyframe_cycles)
+    {
+        movie_keyframe_t k;
+        k.cycle = cycle;
+        k.event = uint32_t(m.events.size());
+        k.hash = movie_state_hash(*this);
+        save_state_to_vector(k.state);
+        m.keyframes.push_back(std::move(k));
+    }
+}
+
+void arduboy_t::play_movie_events()
+{
+    auto& m = *movie;
+    uint64_t cycle = cpu.cycle_count;
+    m.cycle = cycle;
+
+    // events are recorded on step boundaries, which playback reaches exactly
+    // unless it has desynced
+    for(; m.next_event < m.events.size(); ++m.next_event)
+    {
+        auto const& e = m.events[m.next_event];
+        if(e.cycle > cycle)
+            break;
+        if(e.cycle != cycle)
+            ++m.desyncs;
+        m.pinb = e.pinb;
+        m.pine = e.pine;
+        m.pinf = e.pinf;
+    }
+    if(m.mode == movie_t::PLAYING)
+    {
+        cpu.PINB() = m.pinb;
+        cpu.PINE() = m.pine;
+        cpu.PINF() = m.pinf;
+    }
+
+    for(; m.next_keyframe < m.keyframes.size(); ++m.next_keyframe)
+    {
+        auto const& k = m.keyframes[m.next_keyframe];
+        if(k.cycle > cycle)
+            break;
+        if(k.cycle == cycle)
+        {
+            // recorded between calls to advance
+            cpu.update_all();
+            if(movie_state_hash(*this) == k.hash)
+            {
+                ++m.verified;
+                continue;
+            }
+        }
+        ++m.desyncs;
+    }
+
+    if(cycle >= m.end_cycle)
+        m.mode = movie_t::FINISHED;
+    update_movie_next_cycle(*this);
+}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "absim.hpp"
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace absim
+{
+
+// Input movie file format (little endian):
+//
+//     "ARDMOVIE", u32 version, u64 game hash,
+//     u8 start type, u64 start cycle, u64 end cycle,
+//     u32 start bytes, start data
+//     u32 events, events
+//     u64 keyframe interval (cycles), u32 keyframes, each
+//         u64 cycle, u32 index of the first event after it,
+//         u64 state hash, u32 bytes, flat savestate (zlib or raw)
+//
+// MOVIE_START_POWER_ON start data is zlib-compressed:
+//     u8 display type, u8 fxport reg, u8 fxport mask,
+//     u8 flags (1: bootloader, 2: boot to menu), u32 adc seed,
+//     u16 eeprom bytes, eeprom, u32 fx sectors, each u32 sector and its data
+// MOVIE_START_STATE start data is a flat savestate (zlib or raw).
+//
+// Each event is a varint cycle delta from the previous event (or the start
+// cycle), a byte of MOVIE_PINB/PINE/PINF flags, then the new value of each
+// flagged pin register. Events land on step boundaries: playback limits
+// merged batches so that the same boundaries are reached.
+//
+// Keyframes only speed up seeking: a build whose savestate version differs
+// replays from the start instead. Their state hashes cover the cpu state
+// alone, so that playback can detect desyncs across builds.
+
+constexpr uint32_t MOVIE_VERSION = 1;
+
+constexpr uint8_t MOVIE_START_POWER_ON = 0;
+constexpr uint8_t MOVIE_START_STATE = 1;
+
+constexpr uint8_t MOVIE_PINB = 0x01;
+constexpr uint8_t MOVIE_PINE = 0x02;
+constexpr uint8_t MOVIE_PINF = 0x04;
+
+struct movie_event_t
+{
+    uint64_t cycle;
+    uint8_t pinb, pine, pinf;
+};
+
+struct movie_keyframe_t
+{
+    uint64_t cycle;
+    uint32_t event; // index of the first event after cycle
+    uint64_t hash;
+    std::vector<uint8_t> state;
+};
+
+struct movie_t
+{
+    uint64_t game_hash;
+    uint8_t start_type;
+    uint64_t start_cycle;
+    uint64_t end_cycle;
+
+    // MOVIE_START_POWER_ON
+    arduboy_config_t cfg;
+    uint32_t adc_seed;
+    std::vector<uint8_t> eeprom;
+    std::map<uint32_t, std::array<uint8_t, 4096>> fx_sectors;
+
+    // MOVIE_START_STATE
+    std::vector<uint8_t> start_state;
+
+    std::vector<movie_event_t> events;
+    uint64_t keyframe_cycles;
+    std::vector<movie_keyframe_t> keyframes;
+
+    // returns error string on failure
+    std::string save(std::ostream& f) const;
+    std::string load(std::istream& f);
+
+    // recording and playback position
+    enum mode_t
+    {
+        RECORDING,
+        PLAYING,
+        FINISHED,
+    };
+    mode_t mode;
+    uint64_t cycle; // when the movie was last updated
+    size_t next_event;
+    size_t next_keyframe;
+    uint8_t pinb, pine, pinf;
+
+    // playback verification: keyframes whose state hash matched or not,
+    // and events that could not be applied on their cycle
+    uint64_t verified;
+    uint64_t desyncs;
+
+    // playback: the user's savedata and eeprom from before the movie, put
+    // back when it is stopped
+    savedata_t user_savedata;
+    std::vector<uint8_t> user_eeprom;
+    std::bitset<1024> user_eeprom_modified_bytes;
+};
+
+// hash of the cpu state compared at keyframes
+uint64_t movie_state_hash(arduboy_t& a);
+
+}
@@ -31,6 +31,12 @@ enum pqueue_type
     NUM_PQ
 };
 
+constexpr char const* const PQUEUE_TYPE_NAMES[NUM_PQ] =
+{
+    "dummy", "spi", "timer0", "timer1", "timer3", "timer4", "usb",
+    "watchdog", "eeprom", "pll", "adc", "spm", "interrupt",
+};
+
 struct pqueue_item
 {
     uint64_t cycle;
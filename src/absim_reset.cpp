@@ -123,6 +123,9 @@ void atmega32u4_t::soft_reset()
 
     pc = BOOTRST() ? bootloader_address() : 0;
     executing_instr_pc = pc;
+#ifndef ARDENS_NO_DEBUGGER
+    executing_stack_depth = 0;
+#endif
 
     just_read = 0xffffffff;
     just_written = 0xffffffff;
@@ -0,0 +1,416 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS 1
+#endif
+
+#include "absim_savedata.hpp"
+
+#include <fstream>
+#include <sstream>
+
+namespace absim
+{
+
+// journal layout: 8-byte identifier, 8-byte game hash, then records of
+//     u8 type, u32 index, u32 size, data[size], u32 checksum
+// all little-endian. a torn record at the end is ignored on replay.
+
+constexpr char JOURNAL_ID[8] = { '_', 'A', 'B', 'J', 'R', 'N', 'L', '\0' };
+constexpr size_t JOURNAL_HEADER_BYTES = 16;
+constexpr size_t RECORD_HEADER_BYTES = 9;
+
+enum
+{
+    RECORD_EEPROM = 1, // index is the byte offset
+    RECORD_FX_SECTOR = 2, // index is the sector
+};
+
+// EEPROM runs closer than this are merged into one record
+constexpr size_t EEPROM_MERGE_GAP = 8;
+
+static void put_u32(uint8_t* p, uint32_t x)
+{
+    p[0] = uint8_t(x >> 0);
+    p[1] = uint8_t(x >> 8);
+    p[2] = uint8_t(x >> 16);
+    p[3] = uint8_t(x >> 24);
+}
+
+static uint32_t get_u32(uint8_t const* p)
+{
+    return
+        (uint32_t(p[0]) << 0) |
+        (uint32_t(p[1]) << 8) |
+        (uint32_t(p[2]) << 16) |
+        (uint32_t(p[3]) << 24);
+}
+
+static uint32_t record_checksum(uint8_t const* header, uint8_t const* data, size_t size)
+{
+    // FNV-1a 32-bit
+    uint32_t h = 0x811c9dc5;
+    for(size_t i = 0; i < RECORD_HEADER_BYTES; ++i)
+        h = (h ^ header[i]) * 0x01000193;
+    for(size_t i = 0; i < size; ++i)
+        h = (h ^ data[i]) * 0x01000193;
+    return h;
+}
+
+static bool apply_record(savedata_t& d, uint8_t type, uint32_t index, uint8_t const* data, size_t size)
+{
+    if(type == RECORD_EEPROM)
+    {
+        if(size_t(index) + size > d.eeprom_modified_bytes.size())
+            return false;
+        if(d.eeprom.size() < d.eeprom_modified_bytes.size())
+            d.eeprom.resize(d.eeprom_modified_bytes.size(), 0xff);
+        memcpy(&d.eeprom[index], data, size);
+        for(size_t i = 0; i < size; ++i)
+            d.eeprom_modified_bytes.set(index + i);
+        return true;
+    }
+    if(type == RECORD_FX_SECTOR)
+    {
+        if(index >= w25q128_t::NUM_SECTORS || size != w25q128_t::SECTOR_BYTES)
+            return false;
+        memcpy(d.fx_sectors[index].data(), data, size);
+        return true;
+    }
+    return false;
+}
+
+// returns false if the journal is missing or belongs to another game
+static bool replay_journal(std::string const& fname, savedata_t& d, uint64_t game_hash)
+{
+    std::ifstream f(fname, std::ios::in | std::ios::binary);
+    if(f.fail())
+        return false;
+    std::vector<uint8_t> buf(
+        (std::istreambuf_iterator<char>(f)),
+        std::istreambuf_iterator<char>());
+
+    if(buf.size() < JOURNAL_HEADER_BYTES || memcmp(buf.data(), JOURNAL_ID, 8))
+        return false;
+    uint64_t hash = get_u32(&buf[8]) | (uint64_t(get_u32(&buf[12])) << 32);
+    if(hash != game_hash)
+        return false;
+
+    size_t i = JOURNAL_HEADER_BYTES;
+    while(buf.size() - i >= RECORD_HEADER_BYTES + 4)
+    {
+        uint8_t const* h = &buf[i];
+        uint32_t size = get_u32(h + 5);
+        if(buf.size() - i - RECORD_HEADER_BYTES - 4 < size)
+            break;
+        uint8_t const* data = h + RECORD_HEADER_BYTES;
+        if(get_u32(data + size) != record_checksum(h, data, size))
+            break;
+        apply_record(d, h[0], get_u32(h + 1), data, size);
+        i += RECORD_HEADER_BYTES + size + 4;
+    }
+    return true;
+}
+
+savedata_journal_t::~savedata_journal_t()
+{
+    close();
+}
+
+bool savedata_journal_t::open(arduboy_t& a, std::string const& fname)
+{
+    close();
+
+    bool found = false;
+    {
+        std::ifstream f(fname, std::ios::in | std::ios::binary);
+        if(!f.fail())
+            found = a.load_savedata(f);
+        else
+            a.savedata.clear();
+    }
+    a.savedata.game_hash = a.game_hash;
+
+    std::string jname = fname + ".journal";
+    savedata_t& d = a.savedata;
+    auto prev_eeprom = d.eeprom;
+    auto prev_sectors = d.fx_sectors;
+    bool replayed = replay_journal(jname, d, a.game_hash);
+    if(replayed)
+    {
+        // overwrite eeprom / fx with journaled data
+        if(d.eeprom.size() == a.cpu.eeprom.size() && d.eeprom != prev_eeprom)
+        {
+            memcpy(a.cpu.eeprom.data(), d.eeprom.data(), array_bytes(a.cpu.eeprom));
+            found = true;
+        }
+        for(auto const& kv : d.fx_sectors)
+        {
+            auto it = prev_sectors.find(kv.first);
+            if(it != prev_sectors.end() && it->second == kv.second)
+                continue;
+            a.fx.write_bytes(kv.first * w25q128_t::SECTOR_BYTES, kv.second.data(), kv.second.size());
+            found = true;
+        }
+    }
+
+    path = fname;
+    journal_path = jname;
+    game_hash = a.game_hash;
+    persisted_generation = d.generation;
+    persisted_eeprom = d.eeprom;
+    compact_data = d;
+    journal_bytes = 0;
+
+    // fold a leftover journal (e.g., after a crash) into the save file
+    if(replayed)
+        compact();
+
+#if ARDENS_SAVEDATA_THREAD
+    done = false;
+    busy = false;
+    flush_requested = false;
+    thread = std::thread([this]() { thread_func(); });
+#endif
+
+    return found;
+}
+
+void savedata_journal_t::update(arduboy_t& a)
+{
+    // savedata holds the movie's saves until playback is stopped
+    if(!is_open() || a.is_playing_movie())
+        return;
+    auto const& d = a.savedata;
+    if(d.generation == persisted_generation)
+        return;
+
+    std::vector<record_t> records;
+
+    if(d.eeprom_generation > persisted_generation || d.eeprom.size() != persisted_eeprom.size())
+    {
+        size_t n = d.eeprom.size();
+        persisted_eeprom.resize(n, 0xff);
+        size_t i = 0;
+        while(i < n)
+        {
+            if(d.eeprom[i] == persisted_eeprom[i])
+            {
+                ++i;
+                continue;
+            }
+            size_t j = i + 1;
+            size_t last = i;
+            while(j < n && j <= last + EEPROM_MERGE_GAP)
+            {
+                if(d.eeprom[j] != persisted_eeprom[j])
+                    last = j;
+                ++j;
+            }
+            record_t r;
+            r.type = RECORD_EEPROM;
+            r.index = uint32_t(i);
+            r.data.assign(d.eeprom.begin() + i, d.eeprom.begin() + last + 1);
+            records.push_back(std::move(r));
+            i = last + 1;
+        }
+        persisted_eeprom = d.eeprom;
+    }
+
+    for(auto const& kv : d.fx_sectors)
+    {
+        if(d.fx_sector_generation[kv.first] <= persisted_generation)
+            continue;
+        record_t r;
+        r.type = RECORD_FX_SECTOR;
+        r.index = kv.first;
+        r.data.assign(kv.second.begin(), kv.second.end());
+        records.push_back(std::move(r));
+    }
+
+    persisted_generation = d.generation;
+    if(records.empty())
+        return;
+
+#if ARDENS_SAVEDATA_THREAD
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& r : records)
+            pending.push_back(std::move(r));
+    }
+    cv.notify_one();
+#else
+    write_records(records);
+    if(journal_bytes >= COMPACT_BYTES)
+        compact();
+#endif
+}
+
+bool savedata_journal_t::start_journal()
+{
+    if(journal)
+        fclose(journal);
+    journal = fopen(journal_path.c_str(), "wb");
+    journal_bytes = 0;
+    if(!journal)
+        return false;
+    uint8_t h[JOURNAL_HEADER_BYTES];
+    memcpy(h, JOURNAL_ID, 8);
+    put_u32(&h[8], uint32_t(game_hash));
+    put_u32(&h[12], uint32_t(game_hash >> 32));
+    fwrite(h, 1, sizeof(h), journal);
+    fflush(journal);
+    journal_bytes = sizeof(h);
+    return true;
+}
+
+void savedata_journal_t::write_records(std::vector<record_t>& records)
+{
+    if(records.empty())
+        return;
+    if(!journal && !start_journal())
+        return;
+    for(auto const& r : records)
+    {
+        uint8_t h[RECORD_HEADER_BYTES];
+        h[0] = r.type;
+        put_u32(&h[1], r.index);
+        put_u32(&h[5], uint32_t(r.data.size()));
+        uint8_t c[4];
+        put_u32(c, record_checksum(h, r.data.data(), r.data.size()));
+        fwrite(h, 1, sizeof(h), journal);
+        fwrite(r.data.data(), 1, r.data.size(), journal);
+        fwrite(c, 1, sizeof(c), journal);
+        journal_bytes += sizeof(h) + r.data.size() + sizeof(c);
+        apply_record(compact_data, r.type, r.index, r.data.data(), r.data.size());
+    }
+    fflush(journal);
+}
+
+void savedata_journal_t::compact()
+{
+    // write the full save file next to the old one, then replace it
+    std::string tmp = path + ".tmp";
+    {
+        std::ostringstream ss;
+        compact_data.game_hash = game_hash;
+        save_savedata(ss, compact_data);
+        auto s = ss.str();
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f)
+            return;
+        bool ok = fwrite(s.data(), 1, s.size(), f) == s.size();
+        ok = (fclose(f) == 0) && ok;
+        if(!ok)
+        {
+            ::remove(tmp.c_str());
+            return;
+        }
+    }
+    // rename replaces the old file atomically on POSIX; on Windows it fails
+    // if the destination exists. the journal is only deleted once the new
+    // save file is in place: if the replace fails it is replayed next time
+    if(::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+#ifdef _WIN32
+        ::remove(path.c_str());
+        if(::rename(tmp.c_str(), path.c_str()) != 0)
+            return;
+#else
+        return;
+#endif
+    }
+
+    // the journal is started again with the next write
+    if(journal)
+    {
+        fclose(journal);
+        journal = nullptr;
+    }
+    ::remove(journal_path.c_str());
+    journal_bytes = 0;
+}
+
+#if ARDENS_SAVEDATA_THREAD
+void savedata_journal_t::thread_func()
+{
+    std::vector<record_t> records;
+    for(;;)
+    {
+        bool exiting;
+        bool flushing;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return done || flush_requested || !pending.empty(); });
+            records.swap(pending);
+            exiting = done;
+            flushing = flush_requested;
+            busy = true;
+        }
+        write_records(records);
+        records.clear();
+        if(journal_bytes > 0 && (exiting || flushing || journal_bytes >= COMPACT_BYTES))
+            compact();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy = false;
+            if(flushing && pending.empty())
+                flush_requested = false;
+        }
+        cv_idle.notify_all();
+        if(exiting) break;
+    }
+}
+#endif
+
+void savedata_journal_t::flush()
+{
+    if(!is_open())
+        return;
+#if ARDENS_SAVEDATA_THREAD
+    std::unique_lock<std::mutex> lock(mutex);
+    flush_requested = true;
+    cv.notify_one();
+    cv_idle.wait(lock, [this] { return !flush_requested && !busy; });
+#else
+    if(journal_bytes > 0)
+        compact();
+#endif
+}
+
+void savedata_journal_t::close()
+{
+    if(!is_open())
+        return;
+#if ARDENS_SAVEDATA_THREAD
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_one();
+    thread.join();
+    pending.clear();
+#else
+    if(journal_bytes > 0)
+        compact();
+#endif
+    if(journal)
+    {
+        fclose(journal);
+        journal = nullptr;
+    }
+    path.clear();
+    journal_path.clear();
+}
+
+void savedata_journal_t::remove()
+{
+    std::string fname = path;
+    std::string jname = journal_path;
+    close();
+    if(!fname.empty())
+    {
+        ::remove(fname.c_str());
+        ::remove(jname.c_str());
+    }
+}
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "absim.hpp"
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#ifndef __EMSCRIPTEN__
+#define ARDENS_SAVEDATA_THREAD 1
+#else
+#define ARDENS_SAVEDATA_THREAD 0
+#endif
+
+#if ARDENS_SAVEDATA_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace absim
+{
+
+// Incremental savedata persistence. Changed EEPROM bytes and FX sectors are
+// appended to a journal next to the save file (from a background thread
+// where available), and the journal is compacted into the save file once
+// it grows large and when it is closed.
+struct savedata_journal_t
+{
+    static constexpr size_t COMPACT_BYTES = 256 * 1024;
+
+    ~savedata_journal_t();
+
+    // close any open journal, load the save file and replay its journal
+    // into the device, then journal further changes to path
+    // returns true if any saved data was found
+    bool open(arduboy_t& a, std::string const& path);
+
+    // queue all savedata changes since the previous update
+    void update(arduboy_t& a);
+
+    // wait for queued writes and compact the journal into the save file
+    void flush();
+
+    // flush and stop journaling
+    void close();
+
+    // stop journaling and delete the save file and journal
+    void remove();
+
+    bool is_open() const { return !path.empty(); }
+
+private:
+
+    struct record_t
+    {
+        uint8_t type;
+        uint32_t index;
+        std::vector<uint8_t> data;
+    };
+
+    std::string path;
+    std::string journal_path;
+    uint64_t game_hash = 0;
+
+    // savedata as of the last update (owned by the main thread)
+    uint32_t persisted_generation = 0;
+    std::vector<uint8_t> persisted_eeprom;
+
+    // writer state (owned by the writer thread while it runs)
+    FILE* journal = nullptr;
+    size_t journal_bytes = 0;
+    savedata_t compact_data;
+
+    void write_records(std::vector<record_t>& records);
+    void compact();
+    bool start_journal();
+
+#if ARDENS_SAVEDATA_THREAD
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable cv_idle;
+    std::vector<record_t> pending;
+    bool busy = false;
+    bool flush_requested = false;
+    bool done = false;
+    void thread_func();
+#endif
+};
+
+}
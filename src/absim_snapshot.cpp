@@ -2,8 +2,10 @@
 
 #include <sstream>
 #include <tuple>
+#include <type_traits>
 
 #include <cstdio>
+#include <cstring>
 
 #include <bitsery/bitsery.h>
 #include <bitsery/brief_syntax.h>
@@ -114,14 +116,14 @@ void serialize(S& s, std::unique_ptr<T>& obj)
 namespace absim
 {
 
-bool compress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_bytes)
+bool compress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_bytes, bool fast)
 {
     dst.resize(mz_compressBound((mz_ulong)src_bytes));
     mz_ulong dst_size = (mz_ulong)dst.size();
     if(MZ_OK != mz_compress2(
         dst.data(), &dst_size,
         (uint8_t const*)src, (mz_ulong)src_bytes,
-        MZ_BEST_COMPRESSION))
+        fast ? MZ_BEST_SPEED : MZ_BEST_COMPRESSION))
     {
         dst.clear();
         return false;
@@ -168,25 +170,6 @@ bool uncompress_zlib(std::vector<uint8_t>& dst, void const* src, size_t src_byte
     return MZ_OK == mz_inflateEnd(&stream);
 }
 
-template<typename CharT>
-class vectorwrapbuf : public std::basic_streambuf<char, std::char_traits<char>>
-{
-    std::vector<CharT>& vec;
-public:
-    vectorwrapbuf(std::vector<CharT>& v)
-        : vec(v)
-    {
-        setg((char*)vec.data(), (char*)vec.data(), (char*)vec.data() + vec.size());
-    }
-    virtual pos_type seekpos(
-        pos_type pos,
-        std::ios_base::openmode which = std::ios_base::in | std::ios_base::out) override
-    {
-        setg((char*)vec.data(), (char*)vec.data() + pos, (char*)vec.data() + vec.size());
-        return pos;
-    }
-};
-
 template<class Archive>
 static std::string serdes_savestate(Archive& ar, arduboy_t& a)
 {
@@ -359,6 +342,30 @@ static std::string serdes_savestate(Archive& ar, arduboy_t& a)
     return "";
 }
 
+// savestates only record the fx sectors written by the game: put them back
+// into the flash so that writes made after the state was taken are undone.
+// sectors written before the load (prev_modified) that the state has no
+// data for get their loaded contents back
+static void restore_modified_fx_sectors(
+    arduboy_t& a, std::bitset<w25q128_t::NUM_SECTORS> const& prev_modified)
+{
+    if(a.fx.sectors_dirty)
+        a.fx.sectors_dirty_bits = a.fx.sectors_modified;
+
+    auto reload = prev_modified;
+    for(size_t i = 0; i < a.fx.NUM_SECTORS; ++i)
+        if(a.fx.sectors_modified_data[i])
+            reload.reset(i);
+    a.reload_fx_sectors(reload);
+
+    for(size_t i = 0; i < a.fx.NUM_SECTORS; ++i)
+    {
+        auto const& s = a.fx.sectors_modified_data[i];
+        if(!s) continue;
+        a.fx.write_bytes(i * a.fx.SECTOR_BYTES, s->data(), s->size());
+    }
+}
+
 template<bool is_load, class Archive>
 static std::string serdes_snapshot(Archive& ar, arduboy_t& a)
 {
@@ -367,9 +374,8 @@ static std::string serdes_snapshot(Archive& ar, arduboy_t& a)
 
     if(is_load)
     {
-        vectorwrapbuf<uint8_t> vb(a.prog_filedata);
-        std::istream is(&vb);
-        auto r = a.load_file(a.prog_filename.c_str(), is);
+        auto r = a.load_file(a.prog_filename.c_str(),
+            a.prog_filedata.data(), a.prog_filedata.size());
         if(!r.empty())
             return r;
     }
@@ -432,10 +438,211 @@ std::string arduboy_t::load_savestate(std::istream& f)
     if(version != SNAPSHOT_VERSION)
         return "Snapshot: incompatible version (created with " + version_str(version) + ")";
 
+    auto prev_modified = fx.sectors_modified;
     auto r = serdes_savestate(ar, *this);
+    if(r.empty())
+        restore_modified_fx_sectors(*this, prev_modified);
     return r;
 }
 
+// flat savestates: a memory image of the same fields as serdes_savestate,
+// with trivially copyable members memcpy'd as contiguous blocks and only
+// the modified fx sectors appended. structs are written field by field
+// through their serialize() members so that padding and layout are not
+// part of the format. intended for per-frame serialization (run-ahead,
+// rewind) and so not portable across endianness.
+
+constexpr std::array<char, 8> FLAT_SAVESTATE_ID =
+{
+    '_', 'A', 'B', 'F', 'L', 'A', 'T', '\0',
+};
+
+constexpr uint32_t FLAT_SAVESTATE_VERSION = 2;
+
+enum class flat_mode { measure, save, load };
+
+template<flat_mode mode>
+struct flat_archive_t
+{
+    uint8_t* p;
+    uint8_t* end;
+    size_t size;
+    bool ok;
+
+    flat_archive_t(void* data, size_t bytes)
+        : p((uint8_t*)data), end((uint8_t*)data + bytes), size(0), ok(true)
+    {}
+
+    void bytes(void* d, size_t n)
+    {
+        size += n;
+        if(mode == flat_mode::measure) return;
+        if(!ok || size_t(end - p) < n)
+        {
+            ok = false;
+            return;
+        }
+        if(mode == flat_mode::save)
+            memcpy(p, d, n);
+        else
+            memcpy(d, p, n);
+        p += n;
+    }
+
+    template<class T>
+    void operator()(T& t)
+    {
+        item(t, 0);
+    }
+
+    // serialize() members list several fields per call
+    template<class T, class U, class... Ts>
+    void operator()(T& t, U& u, Ts&... ts)
+    {
+        item(t, 0);
+        (*this)(u, ts...);
+    }
+
+    template<class T>
+    auto item(T& t, int) -> decltype(t.serialize(*this), void())
+    {
+        t.serialize(*this);
+    }
+
+    template<class T, size_t N>
+    auto item(std::array<T, N>& a, int) -> decltype(a[0].serialize(*this), void())
+    {
+        for(auto& t : a)
+            t.serialize(*this);
+    }
+
+    template<class T>
+    void item(T& t, long)
+    {
+        process(t, std::is_trivially_copyable<T>{});
+    }
+
+    template<class T>
+    void process(T& t, std::true_type)
+    {
+        bytes(&t, sizeof(T));
+    }
+
+    void process(std::string& s, std::false_type)
+    {
+        uint32_t n = uint32_t(s.size());
+        bytes(&n, sizeof(n));
+        if(mode == flat_mode::load)
+        {
+            if(!ok || size_t(end - p) < n)
+            {
+                ok = false;
+                return;
+            }
+            s.resize(n);
+        }
+        bytes(&s[0], n);
+    }
+
+    // sectors are stored as a count followed by (index, data) pairs
+    template<size_t N>
+    void process(std::array<std::unique_ptr<w25q128_t::sector_t>, N>& sectors, std::false_type)
+    {
+        uint32_t n = 0;
+        if(mode != flat_mode::load)
+            for(auto const& s : sectors)
+                if(s) ++n;
+        bytes(&n, sizeof(n));
+        if(mode == flat_mode::measure)
+        {
+            size += n * (sizeof(uint32_t) + sizeof(w25q128_t::sector_t));
+            return;
+        }
+        if(mode == flat_mode::save)
+        {
+            for(uint32_t i = 0; i < N; ++i)
+            {
+                if(!sectors[i]) continue;
+                bytes(&i, sizeof(i));
+                bytes(sectors[i]->data(), sectors[i]->size());
+            }
+            return;
+        }
+        std::bitset<N> present;
+        for(uint32_t j = 0; ok && j < n; ++j)
+        {
+            uint32_t i = 0;
+            bytes(&i, sizeof(i));
+            if(!ok || i >= N)
+            {
+                ok = false;
+                return;
+            }
+            auto& s = sectors[i];
+            if(!s) s = std::make_unique<w25q128_t::sector_t>();
+            bytes(s->data(), s->size());
+            present.set(i);
+        }
+        for(size_t i = 0; i < N; ++i)
+            if(!present.test(i)) sectors[i].reset();
+    }
+};
+
+size_t arduboy_t::savestate_flat_size()
+{
+    flat_archive_t<flat_mode::measure> ar(nullptr, 0);
+    uint32_t version = FLAT_SAVESTATE_VERSION;
+    auto id = FLAT_SAVESTATE_ID;
+    ar(id);
+    ar(version);
+    serdes_savestate(ar, *this);
+    return ar.size;
+}
+
+std::string arduboy_t::save_savestate_flat(void* data, size_t size)
+{
+    flat_archive_t<flat_mode::save> ar(data, size);
+    uint32_t version = FLAT_SAVESTATE_VERSION;
+    auto id = FLAT_SAVESTATE_ID;
+    ar(id);
+    ar(version);
+    serdes_savestate(ar, *this);
+    if(!ar.ok)
+        return "Savestate: buffer too small";
+    // zero any slack so the output is deterministic
+    memset(ar.p, 0, size_t(ar.end - ar.p));
+    return "";
+}
+
+std::string arduboy_t::load_savestate_flat(void const* data, size_t size)
+{
+    flat_archive_t<flat_mode::load> ar((void*)data, size);
+
+    std::array<char, 8> id;
+    ar(id);
+    if(!ar.ok || id != FLAT_SAVESTATE_ID)
+        return "Savestate: invalid identifier";
+
+    uint32_t version = 0;
+    ar(version);
+    if(version != FLAT_SAVESTATE_VERSION)
+        return "Savestate: incompatible version";
+
+    auto prev_modified = fx.sectors_modified;
+    serdes_savestate(ar, *this);
+    if(!ar.ok)
+        return "Savestate: truncated data";
+
+    restore_modified_fx_sectors(*this, prev_modified);
+    return "";
+}
+
+bool arduboy_t::is_savestate_flat(void const* data, size_t size)
+{
+    return size >= FLAT_SAVESTATE_ID.size() &&
+        !memcmp(data, FLAT_SAVESTATE_ID.data(), FLAT_SAVESTATE_ID.size());
+}
+
 bool arduboy_t::save_snapshot(std::ostream& f)
 {
     using Buffer = std::vector<uint8_t>;
@@ -515,20 +722,31 @@ std::string arduboy_t::load_snapshot(std::istream& f)
     return "";
 }
 
-void arduboy_t::save_savedata(std::ostream& f)
+void save_savedata(std::ostream& f, savedata_t& d)
 {
     using StreamAdapter = bitsery::OutputStreamAdapter;
     bitsery::Serializer<StreamAdapter> ar(f);
-    savedata.game_hash = game_hash;
-    ar(savedata);
+    ar(d);
 }
 
-bool arduboy_t::load_savedata(std::istream& f)
+bool load_savedata(std::istream& f, savedata_t& d)
 {
     using StreamAdapter = bitsery::InputStreamAdapter;
     bitsery::Deserializer<StreamAdapter> ar(f);
-    savedata.clear();
-    ar(savedata);
+    d.clear();
+    ar(d);
+    return ar.adapter().error() == bitsery::ReaderError::NoError;
+}
+
+void arduboy_t::save_savedata(std::ostream& f)
+{
+    savedata.game_hash = game_hash;
+    absim::save_savedata(f, savedata);
+}
+
+bool arduboy_t::load_savedata(std::istream& f)
+{
+    absim::load_savedata(f, savedata);
     if(savedata.game_hash != game_hash)
     {
         savedata.clear();
@@ -31,13 +31,17 @@ ARDENS_FORCEINLINE void atmega32u4_t::update_sound()
     }
     uint32_t samples = c / SOUND_CYCLES;
     sound_cycle = c % SOUND_CYCLES;
+    if(no_sound)
+        return;
+
+    if(sound_stereo)
+        samples *= 2;
 
     auto pins = sound_enabled;
 
     if(pins == 0)
     {
-        for(uint32_t i = 0; i < samples; ++i)
-            sound_buffer.push_back(0);
+        sound_buffer.insert(sound_buffer.end(), samples, int16_t(0));
         return;
     }
 
@@ -51,10 +55,7 @@ ARDENS_FORCEINLINE void atmega32u4_t::update_sound()
         if(pins & (1 << 1))
             x += (portc & (1 << 7)) ? -SOUND_GAIN / 2 : SOUND_GAIN / 2;
     }
-    for(uint32_t i = 0; i < samples; ++i)
-    {
-        sound_buffer.push_back(x);
-    }
+    sound_buffer.insert(sound_buffer.end(), samples, x);
 }
     
 }
@@ -0,0 +1,450 @@
+#include "absim_trace.hpp"
+
+namespace absim
+{
+
+constexpr char TRACE_MAGIC[8] = { 'A', 'R', 'D', 'T', 'R', 'A', 'C', 'E' };
+constexpr size_t TRACE_PC_BITMAP_BYTES = atmega32u4_t::PROG_SIZE_BYTES / 2 / 8;
+constexpr size_t TRACE_WRITE_BITMAP_BYTES = (atmega32u4_t::DATA_SIZE_BYTES + 7) / 8;
+constexpr size_t TRACE_CHUNK_HEADER_BYTES =
+    4 + 4 + 4 + 8 + 8 + 2 + TRACE_PC_BITMAP_BYTES + TRACE_WRITE_BITMAP_BYTES;
+
+static void put_varint(std::vector<uint8_t>& v, uint64_t x)
+{
+    while(x >= 0x80)
+    {
+        v.push_back(uint8_t(x | 0x80));
+        x >>= 7;
+    }
+    v.push_back(uint8_t(x));
+}
+
+static bool get_varint(uint8_t const*& p, uint8_t const* end, uint64_t& x)
+{
+    x = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t t = *p++;
+        x |= uint64_t(t & 0x7f) << shift;
+        if(!(t & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void put_le(uint8_t*& p, uint64_t x, int bytes)
+{
+    for(int i = 0; i < bytes; ++i)
+        *p++ = uint8_t(x >> (i * 8));
+}
+
+static uint64_t get_le(uint8_t const*& p, int bytes)
+{
+    uint64_t x = 0;
+    for(int i = 0; i < bytes; ++i)
+        x |= uint64_t(*p++) << (i * 8);
+    return x;
+}
+
+template<size_t N>
+static void put_bitmap(uint8_t*& p, std::bitset<N> const& b)
+{
+    for(size_t i = 0; i < (N + 7) / 8; ++i)
+    {
+        uint8_t t = 0;
+        for(size_t j = 0; j < 8 && i * 8 + j < N; ++j)
+            if(b.test(i * 8 + j)) t |= uint8_t(1 << j);
+        *p++ = t;
+    }
+}
+
+template<size_t N>
+static void get_bitmap(uint8_t const*& p, std::bitset<N>& b)
+{
+    b.reset();
+    for(size_t i = 0; i < (N + 7) / 8; ++i)
+    {
+        uint8_t t = *p++;
+        for(size_t j = 0; j < 8 && i * 8 + j < N; ++j)
+            if(t & (1 << j)) b.set(i * 8 + j);
+    }
+}
+
+trace_recorder_t::~trace_recorder_t()
+{
+    close();
+}
+
+std::string trace_recorder_t::open(std::string const& filename)
+{
+    close();
+    f.open(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if(f.fail())
+        return "Trace: Unable to open file";
+    uint8_t h[sizeof(TRACE_MAGIC) + 4];
+    uint8_t* p = h;
+    memcpy(p, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    p += sizeof(TRACE_MAGIC);
+    put_le(p, TRACE_VERSION, 4);
+    f.write((char const*)h, sizeof(h));
+
+    records = 0;
+    prev_pc = 0;
+    chunk.info.records = 0;
+    chunk.raw.clear();
+#if ARDENS_TRACE_THREAD
+    exiting = false;
+    thread = std::thread([this]() { thread_func(); });
+#endif
+    return "";
+}
+
+void trace_recorder_t::close()
+{
+    if(!f.is_open())
+        return;
+    flush_chunk();
+#if ARDENS_TRACE_THREAD
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exiting = true;
+    }
+    cv.notify_one();
+    thread.join();
+#endif
+    f.close();
+    pool.clear();
+}
+
+void trace_recorder_t::begin_chunk(uint64_t cycle)
+{
+    auto& info = chunk.info;
+    info.records = 0;
+    info.base_cycle = info.last_cycle = cycle;
+    info.prev_pc = prev_pc;
+    info.pcs.reset();
+    info.writes.reset();
+    chunk.raw.clear();
+    prev_cycle = cycle;
+}
+
+void trace_recorder_t::record(atmega32u4_t const& cpu, uint16_t pc, bool instr, int spi)
+{
+    uint8_t flags = 0;
+    if(instr) flags |= TRACE_INSTR;
+    if(!writes.empty()) flags |= TRACE_WRITES;
+    if(spi >= 0) flags |= TRACE_SPI;
+    if(cpu.just_interrupted) flags |= TRACE_INT;
+    if(flags == 0)
+        return;
+
+    uint64_t cycle = cpu.cycle_count;
+
+    // cycles only run forwards within a chunk: start a new one after a reset
+    // or time travel
+    if(chunk.info.records != 0 && cycle < prev_cycle)
+        flush_chunk();
+    if(chunk.info.records == 0)
+        begin_chunk(cycle);
+
+    auto& v = chunk.raw;
+    auto& info = chunk.info;
+    uint64_t dc = cycle - prev_cycle;
+    uint8_t c = dc < TRACE_CYCLES_VARINT ? uint8_t(dc) : TRACE_CYCLES_VARINT;
+    v.push_back(uint8_t(flags | (c << TRACE_CYCLES_SHIFT)));
+    if(c == TRACE_CYCLES_VARINT)
+        put_varint(v, dc - TRACE_CYCLES_VARINT);
+    if(instr)
+    {
+        int32_t d = int32_t(pc) - int32_t(prev_pc);
+        put_varint(v, (uint32_t(d) << 1) ^ uint32_t(d >> 31));
+        prev_pc = pc;
+        if(pc < info.pcs.size())
+            info.pcs.set(pc);
+    }
+    if(!writes.empty())
+    {
+        put_varint(v, writes.size());
+        for(auto const& w : writes)
+        {
+            put_varint(v, w.addr);
+            v.push_back(w.value);
+            if(w.addr < info.writes.size())
+                info.writes.set(w.addr);
+        }
+        writes.clear();
+    }
+    if(spi >= 0)
+        v.push_back(uint8_t(spi));
+
+    prev_cycle = cycle;
+    info.last_cycle = cycle;
+    ++info.records;
+    ++records;
+
+    if(v.size() >= TRACE_CHUNK_BYTES)
+        flush_chunk();
+}
+
+void trace_recorder_t::flush_chunk()
+{
+    if(chunk.info.records == 0)
+        return;
+#if ARDENS_TRACE_THREAD
+    std::vector<uint8_t> raw;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(std::move(chunk));
+        if(!pool.empty())
+        {
+            raw.swap(pool.back());
+            pool.pop_back();
+        }
+    }
+    cv.notify_one();
+    chunk.raw.swap(raw);
+#else
+    std::vector<uint8_t> compressed;
+    write_chunk(chunk, compressed);
+#endif
+    chunk.raw.clear();
+    chunk.raw.reserve(TRACE_CHUNK_BYTES + 64);
+    chunk.info.records = 0;
+}
+
+void trace_recorder_t::write_chunk(chunk_t& c, std::vector<uint8_t>& compressed)
+{
+    if(!compress_zlib(compressed, c.raw.data(), c.raw.size(), true))
+        return;
+    auto const& info = c.info;
+    uint8_t h[TRACE_CHUNK_HEADER_BYTES];
+    uint8_t* p = h;
+    put_le(p, compressed.size(), 4);
+    put_le(p, c.raw.size(), 4);
+    put_le(p, info.records, 4);
+    put_le(p, info.base_cycle, 8);
+    put_le(p, info.last_cycle, 8);
+    put_le(p, info.prev_pc, 2);
+    put_bitmap(p, info.pcs);
+    put_bitmap(p, info.writes);
+    f.write((char const*)h, sizeof(h));
+    f.write((char const*)compressed.data(), compressed.size());
+}
+
+#if ARDENS_TRACE_THREAD
+void trace_recorder_t::thread_func()
+{
+    std::vector<uint8_t> compressed;
+    for(;;)
+    {
+        chunk_t c;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return exiting || !pending.empty(); });
+            if(pending.empty())
+                break;
+            c = std::move(pending.front());
+            pending.pop_front();
+        }
+        write_chunk(c, compressed);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pool.push_back(std::move(c.raw));
+        }
+    }
+}
+#endif
+
+std::string trace_reader_t::open(std::string const& filename)
+{
+    chunks.clear();
+    f.close();
+    f.clear();
+    f.open(filename, std::ios::binary | std::ios::in);
+    if(f.fail())
+        return "Trace: Unable to open file";
+
+    uint8_t h[TRACE_CHUNK_HEADER_BYTES];
+    if(!f.read((char*)h, sizeof(TRACE_MAGIC) + 4) ||
+        memcmp(h, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+        return "Trace: Not a trace file";
+    uint8_t const* p = h + sizeof(TRACE_MAGIC);
+    if(get_le(p, 4) != TRACE_VERSION)
+        return "Trace: Unsupported version";
+
+    // index the chunks from their headers
+    while(f.read((char*)h, sizeof(h)))
+    {
+        trace_chunk_info_t info;
+        p = h;
+        info.compressed_bytes = (uint32_t)get_le(p, 4);
+        info.raw_bytes = (uint32_t)get_le(p, 4);
+        info.records = (uint32_t)get_le(p, 4);
+        info.base_cycle = get_le(p, 8);
+        info.last_cycle = get_le(p, 8);
+        info.prev_pc = (uint16_t)get_le(p, 2);
+        get_bitmap(p, info.pcs);
+        get_bitmap(p, info.writes);
+        info.offset = (uint64_t)f.tellg();
+        f.seekg(info.compressed_bytes, std::ios::cur);
+        if(!f) break;
+        chunks.push_back(info);
+    }
+    // a truncated final chunk (recording interrupted) is dropped
+    f.clear();
+    return "";
+}
+
+bool trace_reader_t::read_chunk(
+    size_t i,
+    std::vector<trace_record_t>& records,
+    std::vector<trace_write_t>& writes)
+{
+    records.clear();
+    writes.clear();
+    if(i >= chunks.size())
+        return false;
+    auto const& info = chunks[i];
+
+    std::vector<uint8_t> compressed(info.compressed_bytes);
+    std::vector<uint8_t> raw;
+    f.clear();
+    f.seekg((std::streamoff)info.offset);
+    if(!f.read((char*)compressed.data(), compressed.size()))
+        return false;
+    if(!uncompress_zlib(raw, compressed.data(), compressed.size()) ||
+        raw.size() != info.raw_bytes)
+        return false;
+
+    uint8_t const* p = raw.data();
+    uint8_t const* end = p + raw.size();
+    uint64_t cycle = info.base_cycle;
+    uint16_t pc = info.prev_pc;
+    records.reserve(info.records);
+    while(p < end)
+    {
+        trace_record_t r{};
+        uint8_t t = *p++;
+        uint64_t x = t >> TRACE_CYCLES_SHIFT;
+        if(x == TRACE_CYCLES_VARINT)
+        {
+            if(!get_varint(p, end, x)) return false;
+            x += TRACE_CYCLES_VARINT;
+        }
+        cycle += x;
+        r.cycle = cycle;
+        r.flags = t & ((1 << TRACE_CYCLES_SHIFT) - 1);
+        if(r.flags & TRACE_INSTR)
+        {
+            if(!get_varint(p, end, x)) return false;
+            int32_t d = int32_t(uint32_t(x) >> 1) ^ -int32_t(x & 1);
+            pc = uint16_t(pc + d);
+        }
+        r.pc = pc;
+        r.write_begin = r.write_end = (uint32_t)writes.size();
+        if(r.flags & TRACE_WRITES)
+        {
+            uint64_t n;
+            if(!get_varint(p, end, n)) return false;
+            for(uint64_t j = 0; j < n; ++j)
+            {
+                trace_write_t w;
+                if(!get_varint(p, end, x) || p >= end) return false;
+                w.addr = (uint16_t)x;
+                w.value = *p++;
+                writes.push_back(w);
+            }
+            r.write_end = (uint32_t)writes.size();
+        }
+        if(r.flags & TRACE_SPI)
+        {
+            if(p >= end) return false;
+            r.spi = *p++;
+        }
+        records.push_back(r);
+    }
+    return records.size() == info.records;
+}
+
+bool trace_reader_t::last_write_before(
+    uint16_t addr, uint64_t cycle,
+    trace_record_t& record, trace_write_t& write)
+{
+    std::vector<trace_record_t> records;
+    std::vector<trace_write_t> writes;
+    for(size_t i = chunks.size(); i-- > 0; )
+    {
+        auto const& info = chunks[i];
+        if(info.base_cycle >= cycle) continue;
+        if(addr < info.writes.size() && !info.writes.test(addr)) continue;
+        if(!read_chunk(i, records, writes)) continue;
+        for(size_t j = records.size(); j-- > 0; )
+        {
+            auto const& r = records[j];
+            if(r.cycle >= cycle) continue;
+            for(uint32_t k = r.write_end; k-- > r.write_begin; )
+            {
+                if(writes[k].addr != addr) continue;
+                record = r;
+                write = writes[k];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void trace_reader_t::entries(uint16_t pc, std::vector<trace_record_t>& result)
+{
+    std::vector<trace_record_t> records;
+    std::vector<trace_write_t> writes;
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        auto const& info = chunks[i];
+        if(pc < info.pcs.size() && !info.pcs.test(pc)) continue;
+        if(!read_chunk(i, records, writes)) continue;
+        uint16_t prev = info.prev_pc;
+        bool interrupted = false;
+        for(auto const& r : records)
+        {
+            if(r.flags & TRACE_INSTR)
+            {
+                // skips can advance up to three words
+                bool fallthrough = !interrupted && prev < r.pc && r.pc - prev <= 3;
+                if(r.pc == pc && !fallthrough)
+                    result.push_back(r);
+                prev = r.pc;
+                interrupted = false;
+            }
+            if(r.flags & TRACE_INT)
+                interrupted = true;
+        }
+    }
+}
+
+void trace_recorder_deleter_t::operator()(trace_recorder_t* r) const
+{
+    delete r;
+}
+
+#ifndef ARDENS_NO_DEBUGGER
+std::string arduboy_t::start_trace(std::string const& filename)
+{
+    stop_trace();
+    std::unique_ptr<trace_recorder_t, trace_recorder_deleter_t> t(new trace_recorder_t);
+    auto r = t->open(filename);
+    if(!r.empty())
+        return r;
+    trace.swap(t);
+    cpu.trace_writes = &trace->writes;
+    return "";
+}
+
+void arduboy_t::stop_trace()
+{
+    cpu.trace_writes = nullptr;
+    trace.reset();
+}
+#endif
+
+}
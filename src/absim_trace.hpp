@@ -0,0 +1,159 @@
+#pragma once
+
+#include "absim.hpp"
+
+#include <bitset>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef __EMSCRIPTEN__
+#define ARDENS_TRACE_THREAD 1
+#else
+#define ARDENS_TRACE_THREAD 0
+#endif
+
+#if ARDENS_TRACE_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace absim
+{
+
+// Execution trace file format (little endian):
+//
+//     "ARDTRACE", u32 version
+//     chunks, each
+//         u32 compressed bytes, u32 raw bytes, u32 records,
+//         u64 base cycle, u64 last cycle, u16 pc before the chunk,
+//         executed pc bitmap (PROG_SIZE_BYTES / 2 bits),
+//         written address bitmap (DATA_SIZE_BYTES bits),
+//         zlib-compressed records
+//
+// Each record is a flags byte whose high bits hold the cycle delta from the
+// previous record (or the chunk's base cycle), or TRACE_CYCLES_VARINT and a
+// varint of the delta minus that. Its fields follow in flag order:
+//     TRACE_INSTR   varint zigzag pc delta (words) from the previous
+//                   instruction
+//     TRACE_WRITES  varint count, then per write varint address and value
+//     TRACE_SPI     byte sent over SPI
+//     TRACE_INT     (no data) an interrupt was taken
+// A record's cycle is the cycle count once its step has completed: steps
+// with nothing to record (sleeping) are folded into the next delta.
+// Chunks decode independently, and their bitmaps let queries skip chunks.
+
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr size_t TRACE_CHUNK_BYTES = 1 << 20;
+
+constexpr uint8_t TRACE_INSTR  = 0x01;
+constexpr uint8_t TRACE_WRITES = 0x02;
+constexpr uint8_t TRACE_SPI    = 0x04;
+constexpr uint8_t TRACE_INT    = 0x08;
+constexpr int TRACE_CYCLES_SHIFT = 4;
+constexpr uint8_t TRACE_CYCLES_VARINT = 0xf;
+
+struct trace_chunk_info_t
+{
+    uint64_t offset; // of compressed records in file
+    uint32_t compressed_bytes;
+    uint32_t raw_bytes;
+    uint32_t records;
+    uint64_t base_cycle;
+    uint64_t last_cycle;
+    uint16_t prev_pc;
+    std::bitset<atmega32u4_t::PROG_SIZE_BYTES / 2> pcs;
+    std::bitset<atmega32u4_t::DATA_SIZE_BYTES> writes;
+};
+
+struct trace_record_t
+{
+    uint64_t cycle;
+    uint16_t pc;       // word address (valid with TRACE_INSTR)
+    uint8_t flags;
+    uint8_t spi;
+    uint32_t write_begin; // index into decoded writes
+    uint32_t write_end;
+};
+
+// Streams an execution trace to a file: records are encoded as the
+// emulator steps, and filled chunks are compressed and written on a
+// background thread where available.
+struct trace_recorder_t
+{
+    ~trace_recorder_t();
+
+    // returns error string on failure
+    std::string open(std::string const& filename);
+    void close();
+
+    // record one emulator step
+    // instr: whether an instruction executed at pc (word address)
+    // spi: byte sent over SPI, or -1
+    void record(atmega32u4_t const& cpu, uint16_t pc, bool instr, int spi);
+
+    // writes captured by the cpu during the current step
+    std::vector<trace_write_t> writes;
+
+    uint64_t records = 0;
+
+private:
+
+    struct chunk_t
+    {
+        trace_chunk_info_t info;
+        std::vector<uint8_t> raw;
+    };
+
+    std::ofstream f;
+    chunk_t chunk;
+    uint64_t prev_cycle = 0;
+    uint16_t prev_pc = 0;
+
+    void begin_chunk(uint64_t cycle);
+    void flush_chunk();
+    void write_chunk(chunk_t& c, std::vector<uint8_t>& compressed);
+
+    std::vector<std::vector<uint8_t>> pool;
+
+#if ARDENS_TRACE_THREAD
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<chunk_t> pending;
+    bool exiting = false;
+    void thread_func();
+#endif
+};
+
+// Reads and queries an execution trace file.
+struct trace_reader_t
+{
+    // returns error string on failure
+    std::string open(std::string const& filename);
+
+    std::vector<trace_chunk_info_t> chunks;
+
+    // decode a chunk's records and their writes
+    bool read_chunk(
+        size_t i,
+        std::vector<trace_record_t>& records,
+        std::vector<trace_write_t>& writes);
+
+    // the last write to addr before cycle
+    bool last_write_before(
+        uint16_t addr, uint64_t cycle,
+        trace_record_t& record, trace_write_t& write);
+
+    // executions of the instruction at word address pc that were not
+    // reached by falling through from the preceding instructions: calls,
+    // jumps and interrupts into a function's entry
+    void entries(uint16_t pc, std::vector<trace_record_t>& records);
+
+private:
+    std::ifstream f;
+};
+
+}
@@ -13,6 +13,7 @@ void w25q128_t::erase_all_data()
     for(auto& s : sectors) s.reset();
     write_bytes(0, ARDENS_BOOT_FLASHCART, sizeof(ARDENS_BOOT_FLASHCART));
     sectors_modified.reset();
+    sectors_dirty_bits.reset();
 }
 
 uint8_t w25q128_t::read_byte(size_t addr)
@@ -31,6 +32,7 @@ void w25q128_t::write_byte(size_t addr, uint8_t data)
     if(!sector)
     {
         sector = std::make_unique<sector_t>();
+        ++sector_allocs;
         memset(sector->data(), 0xff, SECTOR_BYTES);
     }
     (*sector)[byte_index] = data;
@@ -52,6 +54,7 @@ void w25q128_t::write_bytes(size_t addr, uint8_t const* data, size_t bytes)
         if(!sector)
         {
             sector = std::make_unique<sector_t>();
+            ++sector_allocs;
             if(num_bytes < SECTOR_BYTES)
                 memset(sector->data(), 0xff, SECTOR_BYTES);
         }
@@ -80,6 +83,7 @@ void w25q128_t::reset()
     current_addr = 0;
 
     sectors_dirty = false;
+    sectors_dirty_bits.reset();
 
     busy_error = false;
     for(auto& s : sectors_modified_data)
@@ -156,6 +160,7 @@ ARDENS_FORCEINLINE uint8_t w25q128_t::spi_transceive(uint8_t byte)
             track_page();
             uint32_t page = current_addr & 0xffff00;
             sectors_modified.set(current_addr >> 12);
+            sectors_dirty_bits.set(current_addr >> 12);
             sectors_dirty = true;
             program_byte(current_addr, byte);
             ++current_addr;
@@ -188,6 +193,7 @@ ARDENS_FORCEINLINE uint8_t w25q128_t::spi_transceive(uint8_t byte)
             auto& sector = sectors[current_addr / SECTOR_BYTES];
             memset(sector->data(), 0xff, SECTOR_BYTES);
             sectors_modified.set(current_addr >> 12);
+            sectors_dirty_bits.set(current_addr >> 12);
             sectors_dirty = true;
             busy_ps_rem = 100ull * 1000 * 1000 * 1000; // 100 ms
             erasing_sector = 0;
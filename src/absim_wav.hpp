@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace absim
+{
+
+// header of a mono 16-bit PCM wav file, shared by the debugger's audio
+// recording and the headless runner
+
+constexpr size_t WAV_HEADER_BYTES = 44;
+
+inline void wav_put_u16(uint8_t* p, uint32_t x)
+{
+    p[0] = uint8_t(x >> 0);
+    p[1] = uint8_t(x >> 8);
+}
+
+inline void wav_put_u32(uint8_t* p, uint32_t x)
+{
+    p[0] = uint8_t(x >> 0);
+    p[1] = uint8_t(x >> 8);
+    p[2] = uint8_t(x >> 16);
+    p[3] = uint8_t(x >> 24);
+}
+
+// (re)writes the header at the start of f: called with zero samples when
+// the file is opened and again with the final count when it is closed
+inline void write_wav_header(FILE* f, uint32_t freq, uint64_t num_samples)
+{
+    constexpr uint32_t CHANNELS = 1;
+    constexpr uint32_t BITS = 16;
+    constexpr uint32_t BLOCK_ALIGN = CHANNELS * BITS / 8;
+    uint64_t data_bytes = num_samples * BLOCK_ALIGN;
+    if(data_bytes > UINT32_MAX - WAV_HEADER_BYTES)
+        data_bytes = UINT32_MAX - WAV_HEADER_BYTES;
+
+    uint8_t h[WAV_HEADER_BYTES];
+    memcpy(&h[0], "RIFF", 4);
+    wav_put_u32(&h[4], uint32_t(data_bytes + WAV_HEADER_BYTES - 8));
+    memcpy(&h[8], "WAVE", 4);
+    memcpy(&h[12], "fmt ", 4);
+    wav_put_u32(&h[16], 16);
+    wav_put_u16(&h[20], 1); // PCM
+    wav_put_u16(&h[22], CHANNELS);
+    wav_put_u32(&h[24], freq);
+    wav_put_u32(&h[28], freq * BLOCK_ALIGN);
+    wav_put_u16(&h[32], BLOCK_ALIGN);
+    wav_put_u16(&h[34], BITS);
+    memcpy(&h[36], "data", 4);
+    wav_put_u32(&h[40], uint32_t(data_bytes));
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+}
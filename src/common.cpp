@@ -8,10 +8,10 @@
 
 #include "common.hpp"
 
-#include "absim_strstream.hpp"
 
 #include <fstream>
 #include <algorithm>
+#include <chrono>
 
 #include <string.h>
 #include <stdlib.h>
@@ -174,11 +174,11 @@ void platform_open_url(char const *url)
 extern "C" int load_file(
     char const* param, char const* filename, uint8_t const* data, size_t size)
 {
-    absim::istrstream f((char const*)data, size);
     bool save = !strcmp(param, "save");
-    dropfile_err = arduboy.load_file(filename, f, save);
+    dropfile_err = arduboy.load_file(filename, data, size, save);
     autoset_from_device_type();
-    if(dropfile_err.empty())
+    // movies bring their own savedata
+    if(dropfile_err.empty() && !ends_with(filename, ".ardmovie"))
     {
         load_savedata();
 #ifndef ARDENS_DIST
@@ -309,6 +309,12 @@ extern "C" int setparam(char const* name, char const* value)
         update_settings();
         r = 1;
     }
+    else if(!strcmp(name, "ra") || !strcmp(name, "runahead"))
+    {
+        settings.runahead = std::clamp<int>(nvalue, 0, RUNAHEAD_MAX);
+        update_settings();
+        r = 1;
+    }
     else if(!strcmp(name, "i") || !strcmp(name, "intscale"))
     {
         settings.display_integer_scale = bvalue;
@@ -715,6 +721,28 @@ void frame_logic()
 
         constexpr uint64_t MS_TO_PS = 1000000000ull;
         uint64_t dtps = dt * MS_TO_PS * 1000 / simulation_slowdown;
+        bool turbo =
+            !ImGui::GetIO().WantCaptureKeyboard &&
+            ImGui::IsKeyDown(ImGuiKey_Tab) &&
+            !gif_recording;
+        if(turbo)
+        {
+            arduboy.runahead_reset();
+            int speed = TURBO_SPEEDS[settings.turbo];
+            if(speed != 0)
+                arduboy.advance_turbo(dtps * speed);
+            else if(dtps > 0)
+            {
+                // uncapped: run without rendering for most of the host frame
+                using clock = std::chrono::steady_clock;
+                auto end = clock::now() + std::chrono::milliseconds(dt * 3 / 4);
+                constexpr uint64_t CHUNK_PS = 10 * MS_TO_PS;
+                while(clock::now() < end && !arduboy.paused)
+                    arduboy.advance_turbo(CHUNK_PS, false);
+                arduboy.advance_turbo(dtps);
+            }
+            dtps = 0;
+        }
         if(gif_recording)
         {
             constexpr uint64_t DT_20_MS = 20 * MS_TO_PS;
@@ -729,8 +757,15 @@ void frame_logic()
             }
             gif_ps_rem += dtps;
         }
+#ifdef ARDENS_PLAYER
+        arduboy.runahead_frames = gif_recording ? 0 : (uint32_t)settings.runahead;
+        if(dtps > 0)
+            arduboy.advance_runahead(dtps * SPEEDUP,
+                arduboy.cpu.data[0x23], arduboy.cpu.data[0x2c], arduboy.cpu.data[0x2f]);
+#else
         if(dtps > 0)
             arduboy.advance(dtps * SPEEDUP);
+#endif
 
         check_save_savedata();
 
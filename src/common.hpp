@@ -206,6 +206,9 @@ void scalenx(uint8_t* dst, uint8_t const* src, bool rgba);
 std::string savedata_filename();
 void load_savedata();
 void check_save_savedata(); // save savedata if necessary
+bool savedata_exists();
+void flush_savedata(); // write all savedata changes to the save file
+void delete_savedata();
 
 // defined in window_data_space.cpp
 void symbol_tooltip(
@@ -229,6 +232,7 @@ void window_fx_data(bool& open);
 void window_fx_internals(bool& open);
 void window_eeprom(bool& open);
 void window_cpu_usage(bool& open);
+void window_stats(bool& open);
 void window_led(bool& open);
 void window_savefile(bool& open);
 void window_serial(bool& open);
@@ -1,10 +1,11 @@
 #include "libretro.h"
 
 #include "../absim.hpp"
+#include "../absim_savedata.hpp"
 #include "../absim_strstream.hpp"
 
 #include <algorithm>
-#include <fstream>
+#include <chrono>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -13,6 +14,8 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 constexpr double FPS = 60.0;
 
@@ -31,11 +34,23 @@ static retro_input_descriptor INPUT_DESCS[] =
     {0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT, "Right"},
     {0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A, "A"},
     {0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B, "B"},
+    {0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R2, "Fast-forward"},
     {0, RETRO_DEVICE_NONE, 0, 0, nullptr}
 };
 
+static retro_variable const CORE_OPTIONS[] =
+{
+    { "ardens_pixel_format", "Pixel format (restart); XRGB8888|RGB565" },
+    { "ardens_runahead", "Run-ahead frames; 0|1|2|3|4" },
+    { "ardens_turbo", "Fast-forward speed (hold R2); 4x|2x|8x|16x|Uncapped" },
+    { nullptr, nullptr }
+};
+
 static std::unique_ptr<absim::arduboy_t> arduboy;
 
+// savedata changes are appended to a journal from a background thread
+static absim::savedata_journal_t journal;
+
 static void log_default(retro_log_level level, const char* fmt, ...)
 {
     FILE* out =
@@ -54,9 +69,21 @@ static retro_audio_sample_batch_t func_audio_batch;
 static retro_input_poll_t         func_input_poll;
 static retro_input_state_t        func_input_state;
 
-static std::array<uint32_t, 128 * 64> video_buf;
+// display pixels are 8-bit grayscale: convert through a lookup table
+// into whichever format the frontend accepted
+static unsigned pixel_format = RETRO_PIXEL_FORMAT_XRGB8888;
+static std::array<uint32_t, 256> lut_xrgb8888;
+static std::array<uint16_t, 256> lut_rgb565;
+static std::array<uint32_t, 128 * 64> video_buf_xrgb8888;
+static std::array<uint16_t, 128 * 64> video_buf_rgb565;
+
+// last frame sent to the frontend, for frame duping
+static std::array<uint8_t, 128 * 64> prev_pixels;
+static bool prev_pixels_valid = false;
+static bool can_dupe = false;
 
-static std::vector<int16_t> audio_buf;
+// samples per frame at 60 FPS, with headroom (stereo)
+constexpr size_t AUDIO_RESERVE_SAMPLES = 4096;
 
 constexpr size_t SAVE_RAM_BYTES =
     sizeof(arduboy->cpu.eeprom) + absim::w25q128_t::DATA_BYTES;
@@ -73,18 +100,80 @@ static std::string savedata_filename()
 
 static void load_savedata()
 {
+    need_save = false;
     if(!save_path) return;
 
     auto fname = savedata_filename();
-    std::ifstream f(fname, std::ios::in | std::ios::binary);
-    if(!f.fail())
-    {
+    if(journal.open(*arduboy, fname))
         func_log(RETRO_LOG_INFO, "Loaded from %s\n", fname.c_str());
-        arduboy->load_savedata(f);
+    else
+        func_log(RETRO_LOG_INFO, "No save file found at %s\n", fname.c_str());
+}
+
+static char const* get_option(char const* key)
+{
+    retro_variable var = { key, nullptr };
+    if(!func_env(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+        return nullptr;
+    return var.value;
+}
+
+// fast-forward multiplier while R2 is held (0: uncapped)
+static int turbo_speed = 4;
+
+static void update_options()
+{
+    char const* turbo = get_option("ardens_turbo");
+    turbo_speed = turbo ? atoi(turbo) : 4;
+
+    char const* value = get_option("ardens_runahead");
+    uint32_t frames = value ? (uint32_t)atoi(value) : 0;
+    if(frames != arduboy->runahead_frames)
+    {
+        arduboy->runahead_frames = frames;
+        arduboy->runahead_reset();
+    }
+}
+
+static void init_pixel_luts()
+{
+    for(uint32_t i = 0; i < 256; ++i)
+    {
+        lut_xrgb8888[i] = i | (i << 8) | (i << 16);
+        lut_rgb565[i] = uint16_t(((i >> 3) << 11) | ((i >> 2) << 5) | (i >> 3));
+    }
+}
+
+template<class T, size_t N>
+static void convert_pixels(
+    std::array<T, N>& dst, std::array<T, 256> const& lut, uint8_t const* src)
+{
+    for(size_t i = 0; i < N; ++i)
+        dst[i] = lut[src[i]];
+}
+
+static void send_video()
+{
+    auto const& pixels = arduboy->display.filtered_pixels;
+    if(can_dupe && prev_pixels_valid &&
+        !memcmp(prev_pixels.data(), pixels.data(), pixels.size()))
+    {
+        // unchanged frame: let the frontend reuse the previous one
+        func_video(nullptr, 128, 64, 0);
+        return;
+    }
+    memcpy(prev_pixels.data(), pixels.data(), pixels.size());
+    prev_pixels_valid = true;
+
+    if(pixel_format == RETRO_PIXEL_FORMAT_RGB565)
+    {
+        convert_pixels(video_buf_rgb565, lut_rgb565, pixels.data());
+        func_video(video_buf_rgb565.data(), 128, 64, sizeof(uint16_t) * 128);
     }
     else
     {
-        func_log(RETRO_LOG_INFO, "No save file found at %s\n", fname.c_str());
+        convert_pixels(video_buf_xrgb8888, lut_xrgb8888, pixels.data());
+        func_video(video_buf_xrgb8888.data(), 128, 64, sizeof(uint32_t) * 128);
     }
 }
 
@@ -108,11 +197,23 @@ void retro_init()
     else
         func_log(RETRO_LOG_INFO, "Save path: %s\n", save_path);
 
+    {
+        bool dupe = false;
+        can_dupe = func_env(RETRO_ENVIRONMENT_GET_CAN_DUPE, &dupe) && dupe;
+    }
+
+    init_pixel_luts();
+
     arduboy = std::make_unique<absim::arduboy_t>();
+
+    // the sound stage writes interleaved stereo directly for func_audio_batch
+    arduboy->cpu.sound_stereo = true;
+    arduboy->cpu.sound_buffer.reserve(AUDIO_RESERVE_SAMPLES);
 }
 
 void retro_deinit()
 {
+    journal.close();
     arduboy.reset();
 }
 
@@ -121,7 +222,12 @@ unsigned retro_api_version()
 	return RETRO_API_VERSION;
 }
 
-void retro_set_environment(retro_environment_t cb) { func_env = cb; }
+void retro_set_environment(retro_environment_t cb)
+{
+    func_env = cb;
+    func_env(RETRO_ENVIRONMENT_SET_VARIABLES, (void*)CORE_OPTIONS);
+}
+
 void retro_set_video_refresh(retro_video_refresh_t cb) { func_video = cb; }
 void retro_set_audio_sample(retro_audio_sample_t cb) { func_audio_sample = cb; }
 void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { func_audio_batch = cb; }
@@ -155,12 +261,17 @@ void retro_set_controller_port_device(unsigned port, unsigned device) {}
 
 void retro_reset()
 {
+    journal.update(*arduboy);
     arduboy->reset();
     load_savedata();
 }
 
 void retro_run()
 {
+    bool options_updated = false;
+    if(func_env(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &options_updated) && options_updated)
+        update_options();
+
     func_input_poll();
     bool btn_U = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP);
     bool btn_D = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_DOWN);
@@ -168,6 +279,7 @@ void retro_run()
     bool btn_R = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT);
     bool btn_A = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A);
     bool btn_B = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B);
+    bool btn_turbo = func_input_state(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R2);
 
     uint8_t pinf = 0xf0;
     uint8_t pine = 0x40;
@@ -185,36 +297,45 @@ void retro_run()
     if(btn_A) pine &= ~0x40;
     if(btn_B) pinb &= ~0x10;
 
-    arduboy->cpu.data[0x23] = pinb;
-    arduboy->cpu.data[0x2c] = pine;
-    arduboy->cpu.data[0x2f] = pinf;
-
     arduboy->frame_bytes_total = 1024;
     arduboy->cpu.enabled_autobreaks = 0;
     arduboy->allow_nonstep_breakpoints = false;
     arduboy->display.enable_filter = true;
 
     constexpr uint64_t dtps = uint64_t(1e12 / FPS);
-    arduboy->advance(dtps);
-
-    for(size_t i = 0; i < video_buf.size(); ++i)
+    auto& audio_buf = arduboy->cpu.sound_buffer;
+    if(btn_turbo)
     {
-        uint32_t t = arduboy->display.filtered_pixels[i];
-        t |= (t << 8) | (t << 16);
-        video_buf[i] = t;
+        arduboy->runahead_reset();
+        arduboy->cpu.data[0x23] = pinb;
+        arduboy->cpu.data[0x2c] = pine;
+        arduboy->cpu.data[0x2f] = pinf;
+        if(turbo_speed != 0)
+            arduboy->advance_turbo(dtps * turbo_speed);
+        else
+        {
+            // uncapped: run without rendering for most of the frame's time
+            using clock = std::chrono::steady_clock;
+            auto end = clock::now() + std::chrono::microseconds(
+                uint64_t(1e6 / FPS * 3 / 4));
+            while(clock::now() < end)
+                arduboy->advance_turbo(dtps / 4, false);
+            arduboy->advance_turbo(dtps);
+        }
+
+        // keep the frontend's audio clock fed with a frame of silence
+        constexpr size_t SILENCE_FRAMES = size_t(
+            16e6 / double(absim::atmega32u4_t::SOUND_CYCLES) / FPS);
+        audio_buf.assign(SILENCE_FRAMES * 2, 0);
     }
-    func_video(video_buf.data(), 128, 64, sizeof(uint32_t) * 128);
+    else
+        arduboy->advance_runahead(dtps, pinb, pine, pinf);
+
+    send_video();
 
+    if(!audio_buf.empty())
+        func_audio_batch(audio_buf.data(), audio_buf.size() / 2);
     audio_buf.clear();
-    for(auto sample : arduboy->cpu.sound_buffer)
-    {
-        audio_buf.push_back(sample);
-        audio_buf.push_back(sample);
-    }
-    arduboy->cpu.sound_buffer.clear();
-    func_audio_batch(
-        audio_buf.data(),
-        audio_buf.size() / 2);
     arduboy->cpu.serial_bytes.clear();
 
     // Do we need to save?
@@ -225,52 +346,44 @@ void retro_run()
         arduboy->savedata_dirty = false;
     }
 
-    if(save_path && need_save && arduboy->cpu.cycle_count >= need_save_cycle)
+    if(need_save && arduboy->cpu.cycle_count >= need_save_cycle)
     {
         need_save = false;
-        std::string fname = savedata_filename();
-        std::ofstream f(fname, std::ios::out | std::ios::binary);
-        if(!f.fail())
-        {
-            arduboy->save_savedata(f);
-            f.close();
-            func_log(RETRO_LOG_INFO, "Saved to %s\n", fname.c_str());
-        }
-        else
-            func_log(RETRO_LOG_ERROR, "Could not save to %s\n", fname.c_str());
+        journal.update(*arduboy);
     }
 }
 
-static size_t compute_serialize_size()
+// with run-ahead the current state is a prediction: states are taken of
+// the confirmed frame instead (an uncompressed flat state)
+static std::vector<uint8_t> const* confirmed_state()
 {
-    std::ostringstream ss;
-    arduboy->save_savestate(ss);
-    size_t size = ss.str().size();
-
-    // calculate the theoretical maximum serialize size:
-    // if all fx sectors are present (each sector is 4097 bytes serialized)
-    size_t num_sectors = 0;
-    for(auto const& s : arduboy->fx.sectors)
-        if(s) ++num_sectors;
-    num_sectors = std::min<size_t>(num_sectors, 4096);
-    size += (4096 - num_sectors) * 4097;
-
-    func_log(RETRO_LOG_INFO, "Calculated serialize size: %u\n", (unsigned)size);
-    return size;
+    auto const& v = arduboy->runahead_confirmed.state;
+    return v.empty() ? nullptr : &v;
 }
 
 size_t retro_serialize_size()
 {
-    static size_t size = size_t(-1);
-    if(size == size_t(-1))
-        size = compute_serialize_size();
+    size_t size = arduboy->savestate_flat_size();
+    if(auto* v = confirmed_state())
+        size = std::max(size, v->size());
     return size;
 }
 
 bool retro_serialize(void* data, size_t size)
 {
-    absim::ostrstream s((char*)data, (std::streamsize)size);
-    std::string err = arduboy->save_savestate(s);
+    std::string err;
+    if(auto* v = confirmed_state())
+    {
+        if(size < v->size())
+            err = "Savestate: buffer too small";
+        else
+        {
+            memcpy(data, v->data(), v->size());
+            memset((uint8_t*)data + v->size(), 0, size - v->size());
+        }
+    }
+    else
+        err = arduboy->save_savestate_flat(data, size);
     if(err.empty()) return true;
     func_log(RETRO_LOG_ERROR, "Error during serialize: %s\n", err.c_str());
     return false;
@@ -278,8 +391,16 @@ bool retro_serialize(void* data, size_t size)
 
 bool retro_unserialize(const void* data, size_t size)
 {
-    absim::istrstream s((char const*)data, (std::streamsize)size);
-    std::string err = arduboy->load_savestate(s);
+    std::string err;
+    arduboy->runahead_reset();
+    if(absim::arduboy_t::is_savestate_flat(data, size))
+        err = arduboy->load_savestate_flat(data, size);
+    else
+    {
+        // states saved by older versions of the core
+        absim::istrstream s((char const*)data, (std::streamsize)size);
+        err = arduboy->load_savestate(s);
+    }
     if(err.empty()) return true;
     func_log(RETRO_LOG_ERROR, "Error during unserialize: %s\n", err.c_str());
     return false;
@@ -291,11 +412,25 @@ void retro_cheat_set(unsigned index, bool enabled, const char* code) {}
 bool retro_load_game(const struct retro_game_info* game)
 {
     int format = RETRO_PIXEL_FORMAT_XRGB8888;
-    if(!func_env(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format))
+    {
+        char const* value = get_option("ardens_pixel_format");
+        if(value && !strcmp(value, "RGB565"))
+            format = RETRO_PIXEL_FORMAT_RGB565;
+    }
+    if(format != RETRO_PIXEL_FORMAT_XRGB8888 &&
+        !func_env(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format))
+    {
+        func_log(RETRO_LOG_WARN, "Could not set pixel format, using XRGB8888\n");
+        format = RETRO_PIXEL_FORMAT_XRGB8888;
+    }
+    if(format == RETRO_PIXEL_FORMAT_XRGB8888 &&
+        !func_env(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &format))
     {
         func_log(RETRO_LOG_ERROR, "Could not set pixel format\n");
         return false;
     }
+    pixel_format = (unsigned)format;
+    prev_pixels_valid = false;
     if(!func_env(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, INPUT_DESCS))
     {
         func_log(RETRO_LOG_ERROR, "Could not set input descriptors\n");
@@ -306,14 +441,21 @@ bool retro_load_game(const struct retro_game_info* game)
         func_log(RETRO_LOG_ERROR, "Game format issue\n");
         return false;
     }
-    absim::istrstream f((char const*)game->data, game->size);
-    std::string err = arduboy->load_file(game->path, f);
+    std::string err = arduboy->load_file(
+        game->path, (uint8_t const*)game->data, game->size);
     if(!err.empty())
     {
         func_log(RETRO_LOG_ERROR, "%s\n", err.c_str());
         return false;
     }
     load_savedata();
+    update_options();
+
+    // the serialize size grows when the game writes to new fx sectors
+    uint64_t quirks =
+        RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE |
+        RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT;
+    func_env(RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS, &quirks);
     return true;
 }
 
@@ -324,7 +466,10 @@ bool retro_load_game_special(
     return false;
 }
 
-void retro_unload_game() {}
+void retro_unload_game()
+{
+    journal.close();
+}
 
 unsigned retro_get_region()
 {
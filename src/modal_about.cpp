@@ -28,7 +28,6 @@ Drap and drop an [Arduboy game](https://community.arduboy.com/c/games/35) (hex/e
   * [Bitsery](https://github.com/fraillt/bitsery) (MIT)
   * [stb_image_write](https://github.com/nothings/stb/blob/master/stb_image_write.h) (Public Domain)
   * [GIF encoder](https://github.com/lecram/gifenc) (Public Domain)
-  * [AudioFile](https://github.com/adamstark/AudioFile) (MIT)
   * [Emscripten Browser File Library](https://github.com/Armchair-Software/emscripten-browser-file) (MIT)
 
 *License*
@@ -3,51 +3,209 @@
 #endif
 
 #include "common.hpp"
+#include "absim_wav.hpp"
 
-#include "AudioFile/AudioFile.h"
+#include <stdio.h>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#ifndef __EMSCRIPTEN__
+#define WAV_WRITER_THREAD 1
+#else
+#define WAV_WRITER_THREAD 0
+#endif
+
+#if WAV_WRITER_THREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 bool wav_recording = false;
 static char wav_fname[256];
 
-static AudioFile<int16_t> af;
+// samples are collected into fixed-size chunks which are recycled after
+// being written out, so memory use stays constant for long recordings
+constexpr size_t WAV_CHUNK_SAMPLES = 64 * 1024;
 
-void send_wav_audio()
+struct wav_chunk_t
 {
-    if(!wav_recording) return;
-    af.samples[0].insert(
-        af.samples[0].end(),
-        arduboy.cpu.sound_buffer.begin(),
-        arduboy.cpu.sound_buffer.end());
+    std::array<int16_t, WAV_CHUNK_SAMPLES> samples;
+    size_t size;
+};
+using wav_chunk_ptr = std::unique_ptr<wav_chunk_t>;
+
+static FILE* wav_file = nullptr;
+static uint64_t wav_samples_written = 0;
+static wav_chunk_ptr wav_chunk;
+
+#if WAV_WRITER_THREAD
+static std::thread wav_thread;
+static std::mutex wav_mutex;
+static std::condition_variable wav_cv;
+static std::vector<wav_chunk_ptr> wav_pending;
+static std::vector<wav_chunk_ptr> wav_free;
+static bool wav_thread_done = false;
+#endif
+
+static void write_wav_chunk(wav_chunk_t& c)
+{
+#ifdef ARDENS_BE
+    for(size_t i = 0; i < c.size; ++i)
+    {
+        uint16_t x = uint16_t(c.samples[i]);
+        c.samples[i] = int16_t(uint16_t((x >> 8) | (x << 8)));
+    }
+#endif
+    fwrite(c.samples.data(), sizeof(int16_t), c.size, wav_file);
 }
 
-void wav_recording_toggle()
+#if WAV_WRITER_THREAD
+static void wav_thread_func()
 {
-    std::vector<std::vector<int16_t>> blank(1);
-    if(wav_recording)
+    std::vector<wav_chunk_ptr> chunks;
+    for(;;)
     {
-        send_wav_audio();
-#ifdef __EMSCRIPTEN__
-        af.save("recording.wav");
-        file_download("recording.wav", wav_fname, "audio/x-wav");
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(wav_mutex);
+            wav_cv.wait(lock, [] { return wav_thread_done || !wav_pending.empty(); });
+            chunks.swap(wav_pending);
+            done = wav_thread_done;
+        }
+        for(auto& c : chunks)
+            write_wav_chunk(*c);
+        {
+            std::lock_guard<std::mutex> lock(wav_mutex);
+            for(auto& c : chunks)
+                wav_free.push_back(std::move(c));
+        }
+        chunks.clear();
+        if(done) break;
+    }
+}
+#endif
+
+static wav_chunk_ptr acquire_wav_chunk()
+{
+    wav_chunk_ptr c;
+#if WAV_WRITER_THREAD
+    {
+        std::lock_guard<std::mutex> lock(wav_mutex);
+        if(!wav_free.empty())
+        {
+            c = std::move(wav_free.back());
+            wav_free.pop_back();
+        }
+    }
+#endif
+    if(!c)
+        c = std::make_unique<wav_chunk_t>();
+    c->size = 0;
+    return c;
+}
+
+static void flush_wav_chunk()
+{
+    if(!wav_chunk || wav_chunk->size == 0)
+        return;
+    wav_samples_written += wav_chunk->size;
+#if WAV_WRITER_THREAD
+    {
+        std::lock_guard<std::mutex> lock(wav_mutex);
+        wav_pending.push_back(std::move(wav_chunk));
+    }
+    wav_cv.notify_one();
+    wav_chunk = acquire_wav_chunk();
 #else
-        af.save(wav_fname);
+    write_wav_chunk(*wav_chunk);
+    wav_chunk->size = 0;
 #endif
-        af.samples.swap(blank);
+}
+
+static void send_wav_samples(int16_t const* samples, size_t n)
+{
+    while(n > 0)
+    {
+        size_t t = std::min(n, WAV_CHUNK_SAMPLES - wav_chunk->size);
+        memcpy(&wav_chunk->samples[wav_chunk->size], samples, t * sizeof(int16_t));
+        wav_chunk->size += t;
+        samples += t;
+        n -= t;
+        if(wav_chunk->size == WAV_CHUNK_SAMPLES)
+            flush_wav_chunk();
     }
-    else
+}
+
+void send_wav_audio()
+{
+    if(!wav_recording) return;
+    auto const& buf = arduboy.cpu.sound_buffer;
+    send_wav_samples(buf.data(), buf.size());
+}
+
+static void wav_recording_start()
+{
+    time_t rawtime;
+    struct tm* ti;
+    time(&rawtime);
+    ti = localtime(&rawtime);
+    (void)snprintf(wav_fname, sizeof(wav_fname),
+        "recording_%04d%02d%02d%02d%02d%02d.wav",
+        ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday,
+        ti->tm_hour + 1, ti->tm_min, ti->tm_sec);
+
+    char const* fname = wav_fname;
+#ifdef __EMSCRIPTEN__
+    fname = "recording.wav";
+#endif
+    wav_file = fopen(fname, "wb");
+    if(!wav_file)
+        return;
+    absim::write_wav_header(wav_file, AUDIO_FREQ, 0);
+
+    wav_samples_written = 0;
+    wav_chunk = acquire_wav_chunk();
+#if WAV_WRITER_THREAD
+    wav_thread_done = false;
+    wav_thread = std::thread(wav_thread_func);
+#endif
+    wav_recording = true;
+    send_wav_audio();
+}
+
+static void wav_recording_stop()
+{
+    send_wav_audio();
+    flush_wav_chunk();
+#if WAV_WRITER_THREAD
     {
-        time_t rawtime;
-        struct tm* ti;
-        time(&rawtime);
-        ti = localtime(&rawtime);
-        (void)snprintf(wav_fname, sizeof(wav_fname),
-            "recording_%04d%02d%02d%02d%02d%02d.wav",
-            ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday,
-            ti->tm_hour + 1, ti->tm_min, ti->tm_sec);
-        af.samples.swap(blank);
-        af.setBitDepth(16);
-        af.setSampleRate(AUDIO_FREQ);
-        send_wav_audio();
+        std::lock_guard<std::mutex> lock(wav_mutex);
+        wav_thread_done = true;
     }
-    wav_recording = !wav_recording;
+    wav_cv.notify_one();
+    wav_thread.join();
+    wav_free.clear();
+#endif
+    wav_chunk.reset();
+
+    // patch RIFF header with final sizes
+    absim::write_wav_header(wav_file, AUDIO_FREQ, wav_samples_written);
+    fclose(wav_file);
+    wav_file = nullptr;
+    wav_recording = false;
+
+#ifdef __EMSCRIPTEN__
+    file_download("recording.wav", wav_fname, "audio/x-wav");
+#endif
+}
+
+void wav_recording_toggle()
+{
+    if(wav_recording)
+        wav_recording_stop();
+    else
+        wav_recording_start();
 }
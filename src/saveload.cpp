@@ -1,11 +1,12 @@
 #include "common.hpp"
 
-#include <fstream>
+#include "absim_savedata.hpp"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
 
+#include <filesystem>
 #include <inttypes.h>
 
 constexpr uint64_t SAVE_INTERVAL_MS = 500;
@@ -13,6 +14,18 @@ constexpr uint64_t SAVE_INTERVAL_MS = 500;
 static bool need_save = false;
 static uint64_t need_save_time;
 
+// changes are journaled incrementally instead of rewriting the save file
+static absim::savedata_journal_t journal;
+
+static void sync_savedata_fs()
+{
+#ifdef __EMSCRIPTEN__
+    EM_ASM(
+        FS.syncfs(function(err) {});
+    );
+#endif
+}
+
 std::string savedata_filename()
 {
     char buf[128];
@@ -23,12 +36,36 @@ std::string savedata_filename()
 void load_savedata()
 {
     auto fname = savedata_filename();
-    std::ifstream f(fname, std::ios::in | std::ios::binary);
-    if(!f.fail())
-    {
+    need_save = false;
+    if(journal.open(arduboy, fname))
         printf("Loaded %s\n", fname.c_str());
-        arduboy.load_savedata(f);
-    }
+}
+
+bool savedata_exists()
+{
+    auto fname = savedata_filename();
+    std::error_code ec{};
+    return
+        std::filesystem::exists(fname, ec) ||
+        std::filesystem::exists(fname + ".journal", ec);
+}
+
+void flush_savedata()
+{
+    journal.update(arduboy);
+    journal.flush();
+    sync_savedata_fs();
+}
+
+void delete_savedata()
+{
+    auto fname = savedata_filename();
+    journal.remove();
+    std::error_code ec{};
+    std::filesystem::remove(fname, ec);
+    std::filesystem::remove(fname + ".journal", ec);
+    need_save = false;
+    sync_savedata_fs();
 }
 
 void check_save_savedata()
@@ -43,18 +80,7 @@ void check_save_savedata()
     if(need_save && ms_since_start >= need_save_time)
     {
         need_save = false;
-        auto fname = savedata_filename();
-        std::ofstream f(fname, std::ios::out | std::ios::binary);
-        if(!f.fail())
-        {
-            arduboy.save_savedata(f);
-            f.close();
-#ifdef __EMSCRIPTEN__
-            EM_ASM(
-                FS.syncfs(function(err) {});
-            );
-#endif
-            printf("Saved %s\n", fname.c_str());
-        }
+        journal.update(arduboy);
+        sync_savedata_fs();
     }
 }
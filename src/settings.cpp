@@ -44,6 +44,7 @@ static void settings_read_line(
     ARDENS_BOOL_SETTING(open_fx_internals);
     ARDENS_BOOL_SETTING(open_eeprom);
     ARDENS_BOOL_SETTING(open_cpu_usage);
+    ARDENS_BOOL_SETTING(open_stats);
     ARDENS_BOOL_SETTING(open_led);
     ARDENS_BOOL_SETTING(open_savefile);
     ARDENS_BOOL_SETTING(open_serial);
@@ -53,6 +54,7 @@ static void settings_read_line(
 
     ARDENS_BOOL_SETTING(profiler_cycle_counts);
     ARDENS_BOOL_SETTING(profiler_group_symbols);
+    ARDENS_BOOL_SETTING(profiler_call_tree);
     ARDENS_BOOL_SETTING(enable_step_breaks);
     ARDENS_BOOL_SETTING(fullzoom);
     ARDENS_BOOL_SETTING(display_integer_scale);
@@ -85,6 +87,8 @@ static void settings_read_line(
     ARDENS_INT_SETTING(recording_orientation, 0, 3);
     ARDENS_INT_SETTING(uiscale, 0, 6);
     ARDENS_INT_SETTING(volume, 0, 200);
+    ARDENS_INT_SETTING(runahead, 0, RUNAHEAD_MAX);
+    ARDENS_INT_SETTING(turbo, 0, TURBO_MAX);
 
 #undef ARDENS_BOOL_SETTING
 #undef ARDENS_INT_SETTING
@@ -116,6 +120,7 @@ static void settings_write_all(ImGuiContext* ctx, ImGuiSettingsHandler* handler,
     ARDENS_BOOL_SETTING(open_fx_internals);
     ARDENS_BOOL_SETTING(open_eeprom);
     ARDENS_BOOL_SETTING(open_cpu_usage);
+    ARDENS_BOOL_SETTING(open_stats);
     ARDENS_BOOL_SETTING(open_led);
     ARDENS_BOOL_SETTING(open_savefile);
     ARDENS_BOOL_SETTING(open_serial);
@@ -125,6 +130,7 @@ static void settings_write_all(ImGuiContext* ctx, ImGuiSettingsHandler* handler,
 
     ARDENS_BOOL_SETTING(profiler_cycle_counts);
     ARDENS_BOOL_SETTING(profiler_group_symbols);
+    ARDENS_BOOL_SETTING(profiler_call_tree);
     ARDENS_BOOL_SETTING(enable_step_breaks);
     ARDENS_BOOL_SETTING(fullzoom);
     ARDENS_BOOL_SETTING(display_integer_scale);
@@ -157,6 +163,8 @@ static void settings_write_all(ImGuiContext* ctx, ImGuiSettingsHandler* handler,
     ARDENS_INT_SETTING(recording_orientation, 0, 3);
     ARDENS_INT_SETTING(uiscale, 0, 6);
     ARDENS_INT_SETTING(volume, 0, 200);
+    ARDENS_INT_SETTING(runahead, 0, RUNAHEAD_MAX);
+    ARDENS_INT_SETTING(turbo, 0, TURBO_MAX);
 
 #undef ARDENS_BOOL_SETTING
 #undef ARDENS_INT_SETTING
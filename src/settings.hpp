@@ -35,6 +35,11 @@ enum
 };
 
 constexpr int RECORDING_ZOOM_MAX = 4;
+constexpr int RUNAHEAD_MAX = 4;
+
+// fast-forward speeds (0: uncapped)
+constexpr int TURBO_SPEEDS[] = { 2, 4, 8, 16, 0 };
+constexpr int TURBO_MAX = sizeof(TURBO_SPEEDS) / sizeof(TURBO_SPEEDS[0]) - 1;
 
 struct settings_t
 {
@@ -57,6 +62,7 @@ struct settings_t
     bool open_fx_internals = false;
     bool open_eeprom = false;
     bool open_cpu_usage = false;
+    bool open_stats = false;
     bool open_led = false;
     bool open_savefile = false;
     bool open_serial = false;
@@ -74,6 +80,7 @@ struct settings_t
     bool display_auto_filter = true;
     bool profiler_cycle_counts = false;
     bool profiler_group_symbols = false;
+    bool profiler_call_tree = false;
     bool enable_step_breaks = true;
     bool nondeterminism = false;
     bool frame_based_cpu_usage = true;
@@ -114,6 +121,12 @@ struct settings_t
 
     int volume = 100;
 
+    // frames of run-ahead (player only)
+    int runahead = 0;
+
+    // index into TURBO_SPEEDS (fast-forward while Tab is held)
+    int turbo = 1;
+
     bool recording_sameasdisplay = true;
 };
 
@@ -127,6 +127,45 @@ void modal_settings()
                 if(Checkbox("##nondeterminism", &settings.nondeterminism))
                     update_settings();
 
+                static char const* const TURBO_ITEMS[] =
+                {
+                    "2x", "4x", "8x", "16x", "Uncapped",
+                };
+                constexpr int NUM_TURBO_ITEMS = sizeof(TURBO_ITEMS) / sizeof(TURBO_ITEMS[0]);
+                static_assert(NUM_TURBO_ITEMS == TURBO_MAX + 1, "");
+                TableNextRow();
+                TableSetColumnIndex(0);
+                AlignTextToFramePadding();
+                TextUnformatted("Fast-Forward Speed");
+                if(IsItemHovered())
+                {
+                    BeginTooltip();
+                    TextUnformatted("Speed while Tab is held (sound and display filtering are skipped)");
+                    EndTooltip();
+                }
+                TableSetColumnIndex(1);
+                SetNextItemWidth(-1.f);
+                if(Combo("##turbo", &settings.turbo,
+                    TURBO_ITEMS, NUM_TURBO_ITEMS, NUM_TURBO_ITEMS))
+                    update_settings();
+
+#ifdef ARDENS_PLAYER
+                TableNextRow();
+                TableSetColumnIndex(0);
+                AlignTextToFramePadding();
+                TextUnformatted("Run-Ahead Frames");
+                if(IsItemHovered())
+                {
+                    BeginTooltip();
+                    TextUnformatted("Reduce input latency by simulating ahead and rolling back when the buttons change");
+                    EndTooltip();
+                }
+                TableSetColumnIndex(1);
+                SetNextItemWidth(-1.f);
+                if(SliderInt("##runahead", &settings.runahead, 0, RUNAHEAD_MAX))
+                    update_settings();
+#endif
+
                 EndTable();
             }
             EndTabItem();
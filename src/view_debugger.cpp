@@ -73,6 +73,7 @@ void view_debugger()
                 ImGui::MenuItem("Simulation", nullptr, &settings.open_simulation);
                 ImGui::MenuItem("Profiler", nullptr, &settings.open_profiler);
                 ImGui::MenuItem("CPU Usage", nullptr, &settings.open_cpu_usage);
+                ImGui::MenuItem("Stats", nullptr, &settings.open_stats);
                 ImGui::MenuItem("Serial Monitor", nullptr, &settings.open_serial);
                 ImGui::Separator();
                 if(ImGui::BeginMenu("Display"))
@@ -202,6 +203,7 @@ void view_debugger()
             window_fx_internals(settings.open_fx_internals);
             window_eeprom(settings.open_eeprom);
             window_cpu_usage(settings.open_cpu_usage);
+            window_stats(settings.open_stats);
             window_led(settings.open_led);
             window_savefile(settings.open_savefile);
             window_serial(settings.open_serial);
@@ -69,25 +69,16 @@ static bool dwarf_symbol_tooltip(uint16_t addr, absim::elf_data_symbol_t const&
         return false;
     uint16_t offset = uint16_t(addr - sym.addr);
 
+    if(!arduboy.elf->debug_ready()) return false;
     auto* dwarf = arduboy.elf->dwarf_ctx.get();
     if(!dwarf) return false;
 
-    // just do a full search for global
-    char const* name = nullptr;
-    llvm::DWARFDie type;
-    for(auto const& kv : arduboy.elf->globals)
-    {
-        auto const& g = kv.second;
-        if(prog != g.text) continue;
-        auto* cu = dwarf->getCompileUnitForOffset(g.cu_offset);
-        if(!cu) continue;
-        type = cu->getDIEForOffset(g.type);
-        if(!(addr >= g.addr && addr < g.addr + absim::dwarf_size(type)))
-            continue;
-        name = kv.first.c_str();
-        break;
-    }
-    if(!name) return false;
+    auto* global = arduboy.elf->global_for_addr(addr, prog);
+    if(!global) return false;
+    auto* cu = dwarf->getCompileUnitForOffset(global->second.cu_offset);
+    if(!cu) return false;
+    char const* name = global->first.c_str();
+    llvm::DWARFDie type = cu->getDIEForOffset(global->second.type);
 
     absim::dwarf_primitive_t prim;
     prim.bit_offset = 0;
@@ -14,6 +14,12 @@ constexpr float HIGHLIGHT_DURATION = 2.f;
 // defined in window_data_space
 void hover_data_space(uint16_t addr);
 
+// the loaded elf, once its debug info has been built
+static absim::elf_data_t* debug_elf()
+{
+    return arduboy.elf && arduboy.elf->debug_ready() ? arduboy.elf.get() : nullptr;
+}
+
 static std::string prog_addr_name(uint16_t addr)
 {
     if(addr / 4 < absim::INT_VECTOR_INFO.size())
@@ -27,14 +33,14 @@ static std::string prog_addr_name(uint16_t addr)
     {
         if(addr == sym->addr)
             return sym->name.c_str();
-        if(arduboy.elf)
+        if(auto* elf = debug_elf())
         {
-            auto index = arduboy.elf->addr_to_disassembled_index(addr);
-            auto const& a = arduboy.elf->asm_with_source[index];
+            auto index = elf->addr_to_disassembled_index(addr);
+            auto const& a = elf->asm_with_source[index];
             if(a.type == a.SYMBOL)
             {
-                auto it = arduboy.elf->text_symbols.find(a.addr);
-                if(it != arduboy.elf->text_symbols.end())
+                auto it = elf->text_symbols.find(a.addr);
+                if(it != elf->text_symbols.end())
                     return it->second.name;
             }
         }
@@ -45,16 +51,17 @@ static std::string prog_addr_name(uint16_t addr)
 
 static absim::disassembled_instr_t const& dis_instr(int row)
 {
-    return arduboy.elf && row < arduboy.elf->asm_with_source.size() ?
-        arduboy.elf->asm_with_source[row] :
+    auto const* elf = debug_elf();
+    return elf && row < elf->asm_with_source.size() ?
+        elf->asm_with_source[row] :
         arduboy.cpu.disassembled_prog[row];
 }
 
 static char const* get_prog_addr_source_line(uint16_t addr)
 {
-    if(!arduboy.elf)
+    if(!debug_elf())
         return nullptr;
-    auto const& elf = *arduboy.elf;
+    auto const& elf = *debug_elf();
     auto it = elf.source_lines.find(addr);
     if(it == elf.source_lines.end())
         return nullptr;
@@ -103,8 +110,8 @@ static std::string disassembly_arg_str(
 
 static void copy_disassembly_to_clipboard()
 {
-    int num = arduboy.elf ?
-        (int)arduboy.elf->asm_with_source.size() :
+    int num = debug_elf() ?
+        (int)debug_elf()->asm_with_source.size() :
         (int)arduboy.cpu.num_instrs;
     std::ostringstream ss;
     for(int i = 0; i < num; ++i)
@@ -196,8 +203,8 @@ static void register_tooltip(int reg, bool pointer = false)
 
 static int find_index_of_addr(uint16_t addr)
 {
-    return arduboy.elf ?
-        (int)arduboy.elf->addr_to_disassembled_index(addr) :
+    return debug_elf() ?
+        (int)debug_elf()->addr_to_disassembled_index(addr) :
         (int)arduboy.cpu.addr_to_disassembled_index(addr);
 }
 
@@ -218,9 +225,9 @@ static void prog_addr_symbol_line(uint16_t addr)
 static void prog_addr_source_line(uint16_t addr)
 {
     using namespace ImGui;
-    if(!arduboy.elf)
+    if(!debug_elf())
         return;
-    auto const& elf = *arduboy.elf;
+    auto const& elf = *debug_elf();
     auto it = elf.source_lines.find(addr);
     if(it == elf.source_lines.end())
         return;
@@ -576,8 +583,8 @@ void window_disassembly(bool& open)
             clipper.Begin(
                 show_full_range ?
                 (int)arduboy.cpu.num_instrs_total :
-                arduboy.elf ?
-                (int)arduboy.elf->asm_with_source.size() :
+                debug_elf() ?
+                (int)debug_elf()->asm_with_source.size() :
                 (int)arduboy.cpu.num_instrs,
                 GetTextLineHeightWithSpacing());
             while(clipper.Step())
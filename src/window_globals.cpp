@@ -221,57 +221,30 @@ struct local_var_t
 };
 
 static void gather_locals(
-    llvm::DWARFDie die,
+    absim::elf_data_t const& e,
     std::vector<local_var_t>& locals)
 {
-    if(!die.isValid()) return;
+    auto* scope = e.scope_for_pc(uint16_t(arduboy.cpu.pc * 2));
+    if(!scope) return;
+    auto* dwarf = e.dwarf_ctx.get();
 
-    uint64_t pc = uint64_t(arduboy.cpu.pc) * 2;
-
-    llvm::DWARFAddressRangesVector ranges;
-    ranges.push_back({ 0, UINT64_MAX });
-    if(auto eranges = die.getAddressRanges())
-        ranges = std::move(*eranges);
-
-    for(auto child : die)
+    uint32_t found = UINT32_MAX;
+    for(auto const& loc : scope->locs)
     {
-        if(child.getTag() == llvm::dwarf::DW_TAG_inlined_subroutine ||
-            child.getTag() == llvm::dwarf::DW_TAG_lexical_block)
-        {
-            gather_locals(child, locals);
-        }
-        else if(child.getTag() == llvm::dwarf::DW_TAG_variable ||
-            child.getTag() == llvm::dwarf::DW_TAG_formal_parameter)
-        {
-            if(ranges.empty()) continue;
-            auto name = absim::dwarf_name(child);
-            auto tag = child.getTag();
-            if(auto elocs = child.getLocations(llvm::dwarf::DW_AT_location))
-            {
-                for(auto const& loc : *elocs)
-                {
-                    bool valid = false;
-                    for(auto const& range : ranges)
-                        if(pc >= range.LowPC && pc < range.HighPC)
-                            valid = true;
-                    if(!valid) continue;
-                    if(loc.Range && (pc < loc.Range->LowPC || pc >= loc.Range->HighPC))
-                        continue;
-                    auto type = absim::dwarf_type(child);
-                    auto vd = absim::dwarf_evaluate_location(type, llvm::toStringRef(loc.Expr));
-                    if(!vd.data.empty())
-                    {
-                        locals.resize(locals.size() + 1);
-                        auto& local = locals.back();
-                        local.name = absim::dwarf_name(child);
-                        local.id = (uint32_t)child.getOffset();
-                        local.type = type;
-                        local.var_data = std::move(vd);
-                        break;
-                    }
-                }
-            }
-        }
+        if(loc.local == found) continue;
+        auto const& local = e.locals[loc.local];
+        llvm::DWARFDie type;
+        if(auto* cu = dwarf->getCompileUnitForOffset(local.type_cu))
+            type = cu->getDIEForOffset(local.type);
+        auto vd = absim::dwarf_evaluate_location(type, loc.expr);
+        if(vd.data.empty()) continue;
+        locals.resize(locals.size() + 1);
+        auto& v = locals.back();
+        v.name = local.name;
+        v.id = local.id;
+        v.type = type;
+        v.var_data = std::move(vd);
+        found = loc.local;
     }
 }
 
@@ -284,13 +257,11 @@ void window_locals(bool& open)
     if(Begin("Locals", &open, wflags) &&
         arduboy.cpu.decoded && arduboy.elf && arduboy.paused)
     {
-        auto& e = *arduboy.elf;
-        auto& dwarf = *e.dwarf_ctx;
-        uint64_t pc = uint64_t(arduboy.cpu.pc) * 2;
-
-        auto dies = dwarf.getDIEsForAddress(pc);
         std::vector<local_var_t> locals;
-        gather_locals(dies.FunctionDIE, locals);
+        if(arduboy.elf->debug_ready())
+            gather_locals(*arduboy.elf, locals);
+        else
+            TextDisabled("Indexing debug info...");
 
         ImGuiTableFlags flags = 0;
         flags |= ImGuiTableFlags_ScrollY;
@@ -327,7 +298,10 @@ void window_globals(bool& open)
     if(!open) return;
     SetNextWindowSize({ 400 * pixel_ratio, 400 * pixel_ratio }, ImGuiCond_FirstUseEver);
     ImGuiWindowFlags wflags = 0;
-    if(Begin("Globals", &open, wflags) && arduboy.cpu.decoded && arduboy.elf)
+    bool visible = Begin("Globals", &open, wflags) && arduboy.cpu.decoded && arduboy.elf;
+    if(visible && !arduboy.elf->debug_ready())
+        TextDisabled("Indexing debug info...");
+    else if(visible)
     {
         if(Button("Add variable..."))
             OpenPopup("##addvar");
@@ -3,7 +3,13 @@
 #include "common.hpp"
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
 
 static void hotspot_row(int i)
 {
@@ -86,6 +92,210 @@ static void show_hotspots()
     }
 }
 
+// children of each call tree node, sorted by inclusive cycles
+static std::vector<std::vector<uint32_t>> call_tree_children;
+static std::vector<uint32_t> call_tree_funcs;
+static size_t call_tree_nodes = 0;
+static uint64_t call_tree_total = 0;
+
+static void update_call_tree()
+{
+    auto const& cg = arduboy.profiler_callgraph;
+    if(cg.nodes.empty())
+    {
+        call_tree_children.clear();
+        call_tree_funcs.clear();
+        call_tree_nodes = 0;
+        return;
+    }
+    if(cg.nodes.size() == call_tree_nodes && cg.nodes[0].total == call_tree_total)
+        return;
+    call_tree_nodes = cg.nodes.size();
+    call_tree_total = cg.nodes[0].total;
+    call_tree_children.clear();
+    call_tree_children.resize(cg.nodes.size());
+    for(uint32_t i = 1; i < cg.nodes.size(); ++i)
+        call_tree_children[cg.nodes[i].parent].push_back(i);
+    for(auto& c : call_tree_children)
+    {
+        std::sort(c.begin(), c.end(), [&](uint32_t a, uint32_t b) {
+            return cg.nodes[a].total > cg.nodes[b].total;
+        });
+    }
+    call_tree_funcs.clear();
+    for(uint32_t i = 0; i < cg.funcs.size(); ++i)
+        if(cg.funcs[i].total != 0)
+            call_tree_funcs.push_back(i);
+    std::sort(call_tree_funcs.begin(), call_tree_funcs.end(), [&](uint32_t a, uint32_t b) {
+        return cg.funcs[a].total > cg.funcs[b].total;
+    });
+}
+
+static void cost_columns(uint64_t total, uint64_t self, uint64_t calls)
+{
+    using namespace ImGui;
+    double t = double(arduboy.cached_profiler_total_with_sleep);
+    if(t <= 0) t = 1;
+    TableSetColumnIndex(1);
+    if(settings.profiler_cycle_counts)
+        Text("%12" PRIu64, total);
+    else
+        Text("%6.2f%%", double(total) * 100 / t);
+    TableSetColumnIndex(2);
+    if(settings.profiler_cycle_counts)
+        Text("%12" PRIu64, self);
+    else
+        Text("%6.2f%%", double(self) * 100 / t);
+    TableSetColumnIndex(3);
+    Text("%" PRIu64, calls);
+}
+
+static void call_tree_row(uint32_t n)
+{
+    using namespace ImGui;
+    auto const& cg = arduboy.profiler_callgraph;
+    auto const& node = cg.nodes[n];
+    auto const& f = cg.funcs[node.func];
+    TableNextRow();
+    TableSetColumnIndex(0);
+    ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_SpanFullWidth;
+    if(call_tree_children[n].empty())
+        flags |= ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen;
+    PushID((int)n);
+    bool open = TreeNodeEx("##node", flags, "%s%s", f.isr ? "[ISR] " : "", f.name.c_str());
+    if(IsItemClicked() && !IsItemToggledOpen())
+        disassembly_scroll_addr = f.addr;
+    PopID();
+    cost_columns(node.total, node.self, node.calls);
+    if(open && !call_tree_children[n].empty())
+    {
+        for(uint32_t c : call_tree_children[n])
+            call_tree_row(c);
+        TreePop();
+    }
+}
+
+// functions by inclusive cycles, each with the callers it was reached from
+static void callers_row(uint32_t fi)
+{
+    using namespace ImGui;
+    auto const& cg = arduboy.profiler_callgraph;
+    auto const& f = cg.funcs[fi];
+    TableNextRow();
+    TableSetColumnIndex(0);
+    PushID((int)fi);
+    bool open = TreeNodeEx("##func", ImGuiTreeNodeFlags_SpanFullWidth,
+        "%s%s", f.isr ? "[ISR] " : "", f.name.c_str());
+    if(IsItemClicked() && !IsItemToggledOpen())
+        disassembly_scroll_addr = f.addr;
+    cost_columns(f.total, f.self, f.calls);
+    if(open)
+    {
+        struct caller_t { uint32_t func; uint64_t total, self, calls; };
+        std::vector<caller_t> callers;
+        for(uint32_t i = 1; i < cg.nodes.size(); ++i)
+        {
+            auto const& n = cg.nodes[i];
+            if(n.func != fi) continue;
+            uint32_t pf = n.parent == cg.ROOT ? UINT32_MAX : cg.nodes[n.parent].func;
+            auto it = std::find_if(callers.begin(), callers.end(),
+                [=](caller_t const& c) { return c.func == pf; });
+            if(it == callers.end())
+            {
+                callers.push_back({ pf, 0, 0, 0 });
+                it = callers.end() - 1;
+            }
+            it->total += n.total;
+            it->self += n.self;
+            it->calls += n.calls;
+        }
+        std::sort(callers.begin(), callers.end(), [](auto const& a, auto const& b) {
+            return a.total > b.total;
+        });
+        for(auto const& c : callers)
+        {
+            TableNextRow();
+            TableSetColumnIndex(0);
+            char const* name = c.func == UINT32_MAX ? "(root)" : cg.funcs[c.func].name.c_str();
+            Indent();
+            TextDisabled("from");
+            SameLine();
+            TextUnformatted(name);
+            Unindent();
+            cost_columns(c.total, c.self, c.calls);
+        }
+        TreePop();
+    }
+    PopID();
+}
+
+static void show_call_graph()
+{
+    using namespace ImGui;
+    update_call_tree();
+    if(call_tree_nodes <= 1) return;
+
+    static int mode = 0;
+    Separator();
+    RadioButton("Call Tree", &mode, 0);
+    SameLine();
+    RadioButton("Callers", &mode, 1);
+
+    ImGuiTableFlags flags = 0;
+    flags |= ImGuiTableFlags_ScrollY;
+    flags |= ImGuiTableFlags_RowBg;
+    flags |= ImGuiTableFlags_Resizable;
+    flags |= ImGuiTableFlags_BordersInnerV;
+    if(BeginTable("##callgraph", 4, flags))
+    {
+        TableSetupScrollFreeze(0, 1);
+        TableSetupColumn("Function", ImGuiTableColumnFlags_WidthStretch);
+        TableSetupColumn("Total", ImGuiTableColumnFlags_WidthFixed);
+        TableSetupColumn("Self", ImGuiTableColumnFlags_WidthFixed);
+        TableSetupColumn("Calls", ImGuiTableColumnFlags_WidthFixed);
+        TableHeadersRow();
+        if(mode == 0)
+        {
+            for(uint32_t c : call_tree_children[0])
+                call_tree_row(c);
+        }
+        else
+        {
+            for(uint32_t f : call_tree_funcs)
+                callers_row(f);
+        }
+        EndTable();
+    }
+}
+
+static void export_profile(bool callgrind)
+{
+    auto const& cg = arduboy.profiler_callgraph;
+    std::string data = callgrind ? cg.callgrind() : cg.folded_stacks();
+    char fname[256];
+    time_t rawtime;
+    struct tm* ti;
+    time(&rawtime);
+    ti = localtime(&rawtime);
+    (void)snprintf(fname, sizeof(fname),
+        callgrind ?
+        "callgrind.out.ardens_%04d%02d%02d%02d%02d%02d" :
+        "profile_%04d%02d%02d%02d%02d%02d.folded",
+        ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday,
+        ti->tm_hour + 1, ti->tm_min, ti->tm_sec);
+#ifdef __EMSCRIPTEN__
+    char const* tmp = callgrind ? "callgrind.out" : "profile.folded";
+    {
+        std::ofstream f(tmp, std::ios::binary);
+        f.write(data.data(), (std::streamsize)data.size());
+    }
+    file_download(tmp, fname, "text/plain");
+#else
+    std::ofstream f(fname, std::ios::binary);
+    f.write(data.data(), (std::streamsize)data.size());
+#endif
+}
+
 void window_profiler(bool& open)
 {
     using namespace ImGui;
@@ -124,8 +334,24 @@ void window_profiler(bool& open)
         if(Checkbox("Group by Symbol", &settings.profiler_group_symbols))
             update_settings();
         if(!arduboy.elf) EndDisabled();
+        SameLine();
+        if(Checkbox("Call Graph", &settings.profiler_call_tree))
+            update_settings();
 
-        show_hotspots();
+        if(settings.profiler_call_tree)
+        {
+            bool can_export = !arduboy.profiler_enabled && call_tree_nodes > 1;
+            if(!can_export) BeginDisabled();
+            if(Button("Export Flame Graph"))
+                export_profile(false);
+            SameLine();
+            if(Button("Export Callgrind"))
+                export_profile(true);
+            if(!can_export) EndDisabled();
+            show_call_graph();
+        }
+        else
+            show_hotspots();
     }
     End();
 }
@@ -5,10 +5,6 @@
 #include <filesystem>
 #include <inttypes.h>
 
-#ifdef __EMSCRIPTEN__
-#include <emscripten.h>
-#endif
-
 static char const* DELETE_POPUP = "Delete Save File";
 
 void window_savefile(bool& open)
@@ -25,13 +21,14 @@ void window_savefile(bool& open)
         auto fname = savedata_filename();
         Text("Hash: %016" PRIx64, arduboy.game_hash);
         NewLine();
-        if(std::filesystem::exists(fname))
+        if(savedata_exists())
         {
             TextUnformatted("Save file found.");
 #ifdef __EMSCRIPTEN__
             SameLine();
             if(SmallButton("Download"))
             {
+                flush_savedata();
                 file_download(
                     fname.c_str(),
                     std::filesystem::path(fname).filename().c_str(),
@@ -105,14 +102,7 @@ void window_savefile(bool& open)
         NewLine();
         if(Button("Delete"))
         {
-            auto fname = savedata_filename();
-            std::error_code ec{};
-            std::filesystem::remove(fname, ec);
-#ifdef __EMSCRIPTEN__
-            EM_ASM(
-                FS.syncfs(function(err) {});
-            );
-#endif
+            delete_savedata();
             CloseCurrentPopup();
             if(arduboy.cpu.decoded)
             {
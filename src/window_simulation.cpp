@@ -2,7 +2,11 @@
 
 #include "common.hpp"
 
+#include "absim_movie.hpp"
+
 #include <cmath>
+#include <ctime>
+#include <fstream>
 
 static int slider_val = 12;
 static int const SLIDERS[] = {
@@ -15,6 +19,8 @@ static int const SLIDERS[] = {
 };
 
 static float ttslider = 1.f;
+static std::string trace_error;
+static std::string movie_error;
 
 void window_simulation(bool& open)
 {
@@ -179,6 +185,8 @@ void window_simulation(bool& open)
         }
         float old_ttslider = ttslider;
         SliderFloat("###ttslider", &ttslider, 0.f, 1.f, buf);
+        if(old_ttslider != ttslider)
+            arduboy.wait_for_history();
         if(old_ttslider != ttslider && !arduboy.state_history.empty())
         {
             uint64_t cycles = arduboy.present_cycle - arduboy.state_history[0].cycle;
@@ -219,6 +227,87 @@ void window_simulation(bool& open)
 
         if(!was_paused)
             EndDisabled();
+
+        if(!arduboy.trace)
+        {
+            if(Button("Record Trace"))
+            {
+                time_t rawtime;
+                time(&rawtime);
+                struct tm* ti = localtime(&rawtime);
+                char fname[64];
+                (void)snprintf(fname, sizeof(fname),
+                    "trace_%04d%02d%02d%02d%02d%02d.ardtrace",
+                    ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday,
+                    ti->tm_hour, ti->tm_min, ti->tm_sec);
+                trace_error = arduboy.start_trace(fname);
+            }
+        }
+        else
+        {
+            if(Button("Stop Trace"))
+                arduboy.stop_trace();
+        }
+        if(IsItemHovered())
+        {
+            BeginTooltip();
+            TextUnformatted("Stream every executed instruction, memory write, SPI byte and interrupt to a file for Ardens_trace");
+            EndTooltip();
+        }
+        if(!trace_error.empty())
+        {
+            SameLine();
+            TextUnformatted(trace_error.c_str());
+        }
+
+        if(!arduboy.movie)
+        {
+            if(Button("Record Movie"))
+            {
+                arduboy.paused = false;
+                movie_error = arduboy.start_movie_recording(true);
+            }
+            if(IsItemHovered())
+            {
+                BeginTooltip();
+                TextUnformatted("Reset and record every input change to a file that replays the session exactly (drop it onto Ardens or use Ardens_headless -m)");
+                EndTooltip();
+            }
+        }
+        else if(arduboy.movie->mode == absim::movie_t::RECORDING)
+        {
+            if(Button("Stop Movie"))
+            {
+                time_t rawtime;
+                time(&rawtime);
+                struct tm* ti = localtime(&rawtime);
+                char fname[64];
+                (void)snprintf(fname, sizeof(fname),
+                    "movie_%04d%02d%02d%02d%02d%02d.ardmovie",
+                    ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday,
+                    ti->tm_hour, ti->tm_min, ti->tm_sec);
+                std::ofstream f(fname, std::ios::binary);
+                movie_error = arduboy.stop_movie_recording(f);
+            }
+        }
+        else
+        {
+            auto const& m = *arduboy.movie;
+            if(Button("Stop Movie"))
+                arduboy.stop_movie();
+            else
+            {
+                SameLine();
+                Text("%s: %d keyframes verified, %d desyncs",
+                    m.mode == absim::movie_t::PLAYING ? "Playing" : "Finished",
+                    (int)m.verified, (int)m.desyncs);
+            }
+        }
+        if(!movie_error.empty())
+        {
+            SameLine();
+            TextUnformatted(movie_error.c_str());
+        }
     }
     End();
 }
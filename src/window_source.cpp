@@ -95,26 +95,31 @@ void window_source(bool& open)
     {
         auto pc = arduboy.cpu.pc;
 
+        if(!arduboy.elf->debug_ready())
+            TextDisabled("Indexing debug info...");
 #ifdef ARDENS_LLVM
-        init_texteditor();
-        auto& dwarf = *arduboy.elf->dwarf_ctx;
-        //auto info = dwarf.getLineInfoForAddress(
-        //    { uint64_t(pc) * 2 },
-        //    { llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath });
-        auto info = get_line_info(dwarf, uint64_t(pc) * 2);
-       
-        auto it = arduboy.elf->source_file_names.find(info.FileName);
-        if(it != arduboy.elf->source_file_names.end() &&
-            it->second >= 0 && it->second < arduboy.elf->source_files.size())
+        else
         {
-            load_file_to_editor(arduboy.elf->source_files[it->second]);
-            editor.Render(info.FileName.c_str());
-            if(prev_pc != pc)
+            init_texteditor();
+            auto& dwarf = *arduboy.elf->dwarf_ctx;
+            //auto info = dwarf.getLineInfoForAddress(
+            //    { uint64_t(pc) * 2 },
+            //    { llvm::DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath });
+            auto info = get_line_info(dwarf, uint64_t(pc) * 2);
+       
+            auto it = arduboy.elf->source_file_names.find(info.FileName);
+            if(it != arduboy.elf->source_file_names.end() &&
+                it->second >= 0 && it->second < arduboy.elf->source_files.size())
             {
-                editor.SetCursorPosition({ 0, 0 });
-                editor.SetCursorPosition({ (int)info.Line - 1, 0 });
+                load_file_to_editor(arduboy.elf->source_files[it->second]);
+                editor.Render(info.FileName.c_str());
+                if(prev_pc != pc)
+                {
+                    editor.SetCursorPosition({ 0, 0 });
+                    editor.SetCursorPosition({ (int)info.Line - 1, 0 });
+                }
+                prev_pc = pc;
             }
-            prev_pc = pc;
         }
 #endif
      }
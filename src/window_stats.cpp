@@ -0,0 +1,175 @@
+#include "imgui.h"
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <vector>
+
+static void stat_row(char const* name, uint64_t value)
+{
+    using namespace ImGui;
+    TableNextRow();
+    TableSetColumnIndex(0);
+    TextUnformatted(name);
+    TableSetColumnIndex(1);
+    Text("%" PRIu64, value);
+}
+
+static void instr_table(absim::cpu_stats_t const& cs)
+{
+    using namespace ImGui;
+
+    constexpr ImGuiTableFlags tf =
+        ImGuiTableFlags_NoSavedSettings |
+        ImGuiTableFlags_RowBg |
+        ImGuiTableFlags_Borders |
+        ImGuiTableFlags_Sortable |
+        ImGuiTableFlags_ScrollY |
+        0;
+    if(!BeginTable("##instrs", 3, tf, { -1, 200 * pixel_ratio }))
+        return;
+    TableSetupScrollFreeze(0, 1);
+    TableSetupColumn("Instruction", ImGuiTableColumnFlags_WidthFixed);
+    TableSetupColumn("Count",
+        ImGuiTableColumnFlags_WidthFixed |
+        ImGuiTableColumnFlags_DefaultSort |
+        ImGuiTableColumnFlags_PreferSortDescending);
+    TableSetupColumn("%", ImGuiTableColumnFlags_WidthFixed);
+    TableHeadersRow();
+
+    // only counted while this window is open: percentages are of the
+    // counted instrs rather than of all executed ones
+    std::vector<size_t> ids;
+    uint64_t total = 0;
+    for(size_t i = 0; i < cs.instr_counts.size(); ++i)
+    {
+        if(cs.instr_counts[i] == 0) continue;
+        ids.push_back(i);
+        total += cs.instr_counts[i];
+    }
+
+    int col = 1;
+    bool asc = false;
+    if(auto* specs = TableGetSortSpecs(); specs && specs->SpecsCount > 0)
+    {
+        col = specs->Specs[0].ColumnIndex;
+        asc = specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+    }
+    std::sort(ids.begin(), ids.end(), [&](size_t a, size_t b) {
+        if(col == 0)
+            return asc ?
+                strcmp(absim::INSTR_ID_NAMES[a], absim::INSTR_ID_NAMES[b]) < 0 :
+                strcmp(absim::INSTR_ID_NAMES[a], absim::INSTR_ID_NAMES[b]) > 0;
+        return asc ?
+            cs.instr_counts[a] < cs.instr_counts[b] :
+            cs.instr_counts[a] > cs.instr_counts[b];
+    });
+
+    for(auto i : ids)
+    {
+        TableNextRow();
+        TableSetColumnIndex(0);
+        TextUnformatted(absim::INSTR_ID_NAMES[i]);
+        TableSetColumnIndex(1);
+        Text("%" PRIu64, cs.instr_counts[i]);
+        TableSetColumnIndex(2);
+        Text("%6.2f", total ? double(cs.instr_counts[i]) * 100 / total : 0.0);
+    }
+    EndTable();
+}
+
+static void window_contents()
+{
+    using namespace ImGui;
+
+    auto const& cs = arduboy.cpu.stats;
+    auto const& s = arduboy.stats;
+    uint64_t total = cs.merged_instrs + cs.unmerged_instrs;
+
+    if(Button("Reset"))
+        arduboy.reset_stats();
+    SameLine();
+    AlignTextToFramePadding();
+    Text("Merged: %6.2f%%", total ? double(cs.merged_instrs) * 100 / total : 0.0);
+
+    constexpr ImGuiTableFlags tf =
+        ImGuiTableFlags_NoSavedSettings |
+        ImGuiTableFlags_RowBg |
+        ImGuiTableFlags_Borders |
+        0;
+
+    if(CollapsingHeader("Execution", ImGuiTreeNodeFlags_DefaultOpen) &&
+        BeginTable("##execution", 2, tf))
+    {
+        stat_row("Unmerged instrs", cs.unmerged_instrs);
+        stat_row("Merged instrs", cs.merged_instrs);
+        stat_row("Merged batches", cs.merged_batches);
+        stat_row("  ended by IO", cs.merged_exit_io);
+        stat_row("  ended by event", cs.merged_exit_deadline);
+        stat_row("  ended by limit", cs.merged_exit_limit);
+        for(size_t i = 0; i < cs.merged_batch_lengths.size(); ++i)
+        {
+            if(cs.merged_batch_lengths[i] == 0) continue;
+            char name[32];
+            if(i + 1 < cs.merged_batch_lengths.size())
+                snprintf(name, sizeof(name), "  %u-%u instrs",
+                    1u << i, (2u << i) - 1);
+            else
+                snprintf(name, sizeof(name), "  %u+ instrs", 1u << i);
+            stat_row(name, cs.merged_batch_lengths[i]);
+        }
+        EndTable();
+    }
+
+    if(CollapsingHeader("Instructions"))
+        instr_table(cs);
+
+    if(CollapsingHeader("Peripherals") && BeginTable("##peripherals", 2, tf))
+    {
+        for(size_t i = 0; i < cs.queue_pops.size(); ++i)
+        {
+            if(cs.queue_pops[i] == 0) continue;
+            char name[32];
+            snprintf(name, sizeof(name), "%s updates", absim::PQUEUE_TYPE_NAMES[i]);
+            stat_row(name, cs.queue_pops[i]);
+        }
+        for(size_t i = 0; i < cs.interrupts.size(); ++i)
+        {
+            if(cs.interrupts[i] == 0) continue;
+            char name[32];
+            snprintf(name, sizeof(name), "Interrupt 0x%04x", unsigned(i * 4));
+            stat_row(name, cs.interrupts[i]);
+        }
+        stat_row("SPI display bytes", s.spi_display_bytes);
+        stat_row("SPI FX bytes", s.spi_fx_bytes);
+        stat_row("FX sector allocs", arduboy.fx.sector_allocs);
+        EndTable();
+    }
+
+    if(CollapsingHeader("History") && BeginTable("##history", 2, tf))
+    {
+        stat_row("Checkpoints", s.history_checkpoints);
+        stat_row("Encoded bytes", s.history_bytes);
+        TableNextRow();
+        TableSetColumnIndex(0);
+        TextUnformatted("Encode time");
+        TableSetColumnIndex(1);
+        Text("%.1f ms", double(s.history_encode_ns) * 1e-6);
+        EndTable();
+    }
+}
+
+void window_stats(bool& open)
+{
+    arduboy.cpu.count_instrs = open;
+    if(!open) return;
+
+    ImGui::SetNextWindowSize({ 300 * pixel_ratio, 400 * pixel_ratio }, ImGuiCond_FirstUseEver);
+    if(ImGui::Begin("Stats", &open) && arduboy.cpu.decoded)
+    {
+        window_contents();
+    }
+    ImGui::End();
+}
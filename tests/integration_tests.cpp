@@ -1,8 +1,19 @@
 #include <absim.hpp>
+#include <absim_savedata.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define WRITE_IMAGES 0
 
@@ -11,119 +22,431 @@
 #include "stb_image_write.h"
 #endif
 
-static std::unique_ptr<absim::arduboy_t> arduboy;
+// Runs every test case found in TESTS_DIR concurrently, each on its own
+// emulator instance:
+//
+//     integration_tests [-j <threads>] [-t <timeout s>] [<name>...]
+//
+// A directory <name> holding <name>.ino-arduboy-fx.hex is a serial test: the
+// sketch passes by sending a single 'P'. A directory holding image0.bin and
+// a .hex or .arduboy game is an image test: the display is compared against
+// imageN.bin after each step of a fixed input script. API tests (API_TESTS)
+// exercise emulator features on a game from one of the test directories.
 
-static int test(char const* name)
+namespace fs = std::filesystem;
+
+constexpr uint64_t MS = 1'000'000'000ull;
+constexpr int SERIAL_TEST_MS = 10000;
+constexpr int NUM_IMAGES = 10;
+
+enum test_type_t { TEST_SERIAL, TEST_IMAGE, TEST_API };
+
+struct test_case_t
 {
-    int r = 0;
+    test_type_t type;
+    std::string name;
+    std::string dir;
+    std::string game; // file name within the test directory
 
-    std::string fname =
-        std::string(TESTS_DIR "/") + name + "/" + name + ".ino-arduboy-fx.hex";
-    std::ifstream f(fname);
+    // results
+    bool pass = false;
+    bool timed_out = false;
+    uint64_t emulated_ms = 0;
+    double wall_secs = 0;
+};
 
-    auto err = arduboy->load_file("test.hex", f);
-    if(!err.empty()) return 1;
-    arduboy->reset();
-    auto const& d = arduboy->cpu.serial_bytes;
-    for(int i = 0; i < 10000; ++i) // up to ten seconds
+struct test_runner_t
+{
+    test_case_t& t;
+    std::chrono::steady_clock::time_point deadline = {};
+    std::unique_ptr<absim::arduboy_t> arduboy = nullptr;
+
+    // returns false on timeout
+    bool advance(int ms)
     {
-        arduboy->advance(1'000'000'000ull); // 1 ms
-        if(!d.empty()) break;
-        arduboy->cpu.sound_buffer.clear();
+        for(int i = 0; i < ms; ++i)
+        {
+            arduboy->advance(MS); // 1 ms
+            arduboy->cpu.sound_buffer.clear();
+            ++t.emulated_ms;
+            if(std::chrono::steady_clock::now() > deadline)
+            {
+                t.timed_out = true;
+                return false;
+            }
+        }
+        return true;
     }
 
-    bool pass = (d.size() == 1 && d[0] == 'P');
+    bool load()
+    {
+        fs::path p = fs::path(TESTS_DIR) / t.dir / t.game;
+        std::ifstream f(p, std::ios::binary);
+        auto err = arduboy->load_file(t.game.c_str(), f);
+        if(!err.empty()) return false;
+        arduboy->reset();
+        return true;
+    }
 
-    printf("   %-30s : %s\n", name, pass ? "PASS" : "FAIL");
-    return pass ? 0 : 1;
-}
+    bool serial_test()
+    {
+        if(!load()) return false;
+        auto const& d = arduboy->cpu.serial_bytes;
+        for(int i = 0; i < SERIAL_TEST_MS; ++i) // up to ten seconds
+        {
+            if(!advance(1)) return false;
+            if(!d.empty()) break;
+        }
+        return d.size() == 1 && d[0] == 'P';
+    }
 
-static void advance(int ms)
-{
-    for(int i = 0; i < ms; ++i)
+    bool compare_image(int n)
+    {
+        bool r = true;
+        char ifname[32];
+        snprintf(ifname, sizeof(ifname), "image%d.bin", n);
+        fs::path p = fs::path(TESTS_DIR) / t.name / ifname;
+        auto const& pixels = arduboy->display.filtered_pixels;
+#if WRITE_IMAGES
+        std::ofstream fi(p, std::ios::binary);
+        fi.write((char const*)pixels.data(), 8192);
+        p.replace_extension(".png");
+        stbi_write_png(p.string().c_str(), 128, 64, 1, pixels.data(), 128);
+#else
+        std::ifstream fi(p, std::ios::binary);
+        std::vector<char> id;
+        id.resize(8192);
+        fi.read(id.data(), 8192);
+        for(size_t i = 0; i < 8192; ++i)
+        {
+            bool w0 = (uint8_t)pixels[i] < 128;
+            bool w1 = (uint8_t)id[i] < 128;
+            if(w0 != w1)
+                r = false;
+        }
+#endif
+        return r;
+    }
+
+    bool image_test()
     {
-        arduboy->advance(1'000'000'000ull); // 1 ms
-        arduboy->cpu.sound_buffer.clear();
+        if(!load()) return false;
+        bool r = true;
+        auto& data = arduboy->cpu.data;
+
+        data[0x23] = 0x10;
+        data[0x2c] = 0x40;
+        data[0x2f] = 0xf0;
+        if(!advance(1000)) return false;
+        r &= compare_image(0);
+        for(int i = 1; i < NUM_IMAGES; ++i)
+        {
+            if(!advance(1000)) return false;
+            data[0x2c] = 0x00;
+            if(i != 1)
+                data[0x2f] = 0xa0;
+            if(!advance(100)) return false;
+            data[0x2c] = 0x40;
+            data[0x2f] = 0xf0;
+            if(!advance(1000)) return false;
+            r &= compare_image(i);
+        }
+        return r;
+    }
+
+    // what the flash does when the game erases and programs a whole sector
+    void write_fx_sector(size_t i, uint8_t x)
+    {
+        auto& fx = arduboy->fx;
+        std::vector<uint8_t> d(fx.SECTOR_BYTES, x);
+        fx.write_bytes(i * fx.SECTOR_BYTES, d.data(), d.size());
+        fx.sectors_modified.set(i);
+        fx.sectors_dirty_bits.set(i);
+        fx.sectors_dirty = true;
+    }
+
+    // what the eeprom does when the game writes a byte
+    void write_eeprom(size_t i, uint8_t x)
+    {
+        auto& cpu = arduboy->cpu;
+        cpu.eeprom[i] = x;
+        cpu.eeprom_modified_bytes.set(i);
+        cpu.eeprom_dirty = true;
+    }
+
+    std::vector<uint8_t> read_fx_sector(size_t i)
+    {
+        auto& fx = arduboy->fx;
+        std::vector<uint8_t> d(fx.SECTOR_BYTES);
+        for(size_t j = 0; j < d.size(); ++j)
+            d[j] = fx.read_byte(i * fx.SECTOR_BYTES + j);
+        return d;
     }
+
+    // a sector first written after a state was taken must get its game
+    // data back when the state is loaded
+    bool savestate_fx_test()
+    {
+        if(!load() || !advance(1000)) return false;
+        auto& fx = arduboy->fx;
+        size_t sector = fx.min_page * 256 / fx.SECTOR_BYTES + 1;
+        auto orig = read_fx_sector(sector);
+
+        std::vector<uint8_t> flat(arduboy->savestate_flat_size());
+        if(!arduboy->save_savestate_flat(flat.data(), flat.size()).empty())
+            return false;
+        std::stringstream ss;
+        if(!arduboy->save_savestate(ss).empty())
+            return false;
+
+        bool r = true;
+        for(int stream = 0; stream < 2; ++stream)
+        {
+            write_fx_sector(sector, 0x5a);
+            if(!advance(1)) return false;
+            if(fx.sectors_modified_data[sector] == nullptr)
+                return false;
+            auto err = stream ?
+                arduboy->load_savestate(ss) :
+                arduboy->load_savestate_flat(flat.data(), flat.size());
+            if(!err.empty()) return false;
+            r &= read_fx_sector(sector) == orig;
+            r &= fx.sectors_modified_data[sector] == nullptr;
+        }
+        return r;
+    }
+
+    // savedata written through a journal must be back after the journal is
+    // closed (compacting it into the save file) and reopened
+    bool savedata_journal_test()
+    {
+        auto fname = (fs::temp_directory_path() / ("ardens_journal_test_" +
+            std::to_string(std::random_device{}()) + ".save")).string();
+        if(!load()) return false;
+        size_t sector = arduboy->fx.NUM_SECTORS - 1;
+        bool r = true;
+        // the second pass replaces an existing save file
+        for(uint8_t x = 1; x <= 2 && r; ++x)
+        {
+            {
+                absim::savedata_journal_t j;
+                j.open(*arduboy, fname);
+                auto& cpu = arduboy->cpu;
+                cpu.eeprom[x] = x;
+                cpu.eeprom_modified_bytes.set(x);
+                cpu.eeprom_dirty = true;
+                write_fx_sector(sector, uint8_t(x * 0x11));
+                r &= advance(1);
+                j.update(*arduboy);
+            }
+            r &= !fs::exists(fname + ".journal") && !fs::exists(fname + ".tmp");
+
+            r &= load();
+            if(!r) break;
+            absim::savedata_journal_t j;
+            r &= j.open(*arduboy, fname);
+            for(uint8_t i = 1; i <= x; ++i)
+                r &= arduboy->cpu.eeprom[i] == i;
+            r &= read_fx_sector(sector) ==
+                std::vector<uint8_t>(arduboy->fx.SECTOR_BYTES, uint8_t(x * 0x11));
+        }
+        std::error_code ec;
+        fs::remove(fname, ec);
+        fs::remove(fname + ".journal", ec);
+        fs::remove(fname + ".tmp", ec);
+        return r;
+    }
+
+    // saves made while a movie plays, also after it has finished, must not
+    // be persisted, and stopping it puts back the user's savedata
+    bool movie_savedata_test()
+    {
+        if(!load()) return false;
+        size_t sector = arduboy->fx.NUM_SECTORS - 1;
+        auto& cpu = arduboy->cpu;
+
+        // record a power-on movie starting from other savedata
+        write_eeprom(1, 0xaa);
+        if(!advance(1)) return false;
+        std::stringstream ss;
+        if(!arduboy->start_movie_recording(true).empty()) return false;
+        if(!advance(100)) return false;
+        if(!arduboy->stop_movie_recording(ss).empty()) return false;
+
+        write_eeprom(1, 0x55);
+        write_fx_sector(sector, 0x33);
+        if(!advance(1)) return false;
+        arduboy->savedata_dirty = false;
+        auto user_sector = read_fx_sector(sector);
+
+        bool r = true;
+        if(!arduboy->start_movie_playback(ss).empty()) return false;
+        r &= cpu.eeprom[1] == 0xaa;
+        if(!advance(200)) return false;
+        write_eeprom(2, 0x77);
+        write_fx_sector(sector, 0x44);
+        if(!advance(1)) return false;
+        r &= !arduboy->savedata_dirty;
+
+        arduboy->stop_movie();
+        r &= cpu.eeprom[1] == 0x55 && cpu.eeprom[2] == 0xff;
+        r &= arduboy->savedata.eeprom.size() > 2 &&
+            arduboy->savedata.eeprom[1] == 0x55 &&
+            arduboy->savedata.eeprom[2] == 0xff;
+        r &= read_fx_sector(sector) == user_sector;
+        return r;
+    }
+
+    bool api_test();
+
+    void run(double timeout_secs)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        deadline = t0 + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout_secs));
+        arduboy = std::make_unique<absim::arduboy_t>();
+        arduboy->display.enable_filter = true;
+        t.pass =
+            t.type == TEST_SERIAL ? serial_test() :
+            t.type == TEST_IMAGE ? image_test() :
+            api_test();
+        arduboy.reset();
+        t.wall_secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - t0).count();
+    }
+};
+
+struct api_test_t
+{
+    char const* name;
+    char const* dir;
+    char const* game;
+    bool (test_runner_t::*fn)();
+};
+
+static api_test_t const API_TESTS[] =
+{
+    { "savestate_fx", "ardugolf_fx", "ardugolf_fx.arduboy", &test_runner_t::savestate_fx_test },
+    { "savedata_journal", "ardugolf_fx", "ardugolf_fx.arduboy", &test_runner_t::savedata_journal_test },
+    { "movie_savedata", "ardugolf_fx", "ardugolf_fx.arduboy", &test_runner_t::movie_savedata_test },
+};
+
+bool test_runner_t::api_test()
+{
+    for(auto const& a : API_TESTS)
+        if(t.name == a.name)
+            return (this->*a.fn)();
+    return false;
 }
 
-static int compare_image(char const* dir, int n)
+static std::vector<test_case_t> find_tests()
 {
-    int r = 0;
-    char ifname[256];
-    snprintf(ifname, sizeof(ifname), "%s/%s/image%d.bin", TESTS_DIR, dir, n);
-#if WRITE_IMAGES
-    std::ofstream fi(ifname, std::ios::binary);
-    fi.write((char const*)arduboy->display.filtered_pixels.data(), 8192);
-    snprintf(ifname, sizeof(ifname), "%s/%s/image%d.png", TESTS_DIR, dir, n);
-    stbi_write_png(ifname, 128, 64, 1, arduboy->display.filtered_pixels.data(), 128);
-#else
-    std::ifstream fi(ifname, std::ios::binary);
-    std::vector<char> id;
-    id.resize(8192);
-    fi.read(id.data(), 8192);
-    for(size_t i = 0; i < 8192; ++i)
+    std::vector<test_case_t> tests;
+    for(auto const& e : fs::directory_iterator(TESTS_DIR))
     {
-        bool w0 = (uint8_t)arduboy->display.filtered_pixels[i] < 128;
-        bool w1 = (uint8_t)id[i] < 128;
-        if(w0 != w1)
-            r = 1;
+        if(!e.is_directory()) continue;
+        auto name = e.path().filename().string();
+        auto serial_hex = name + ".ino-arduboy-fx.hex";
+        if(fs::exists(e.path() / serial_hex))
+        {
+            tests.push_back({ TEST_SERIAL, name, name, serial_hex });
+            continue;
+        }
+        if(!WRITE_IMAGES && !fs::exists(e.path() / "image0.bin"))
+            continue;
+        for(auto const& f : fs::directory_iterator(e.path()))
+        {
+            auto ext = f.path().extension();
+            if(ext != ".hex" && ext != ".arduboy") continue;
+            tests.push_back({ TEST_IMAGE, name, name, f.path().filename().string() });
+            break;
+        }
     }
-#endif
-    return r;
+    for(auto const& a : API_TESTS)
+        if(fs::exists(fs::path(TESTS_DIR) / a.dir / a.game))
+            tests.push_back({ TEST_API, a.name, a.dir, a.game });
+    std::sort(tests.begin(), tests.end(), [](auto const& a, auto const& b) {
+        if(a.type != b.type) return a.type < b.type;
+        return a.name < b.name;
+    });
+    return tests;
 }
 
-static int image_test(char const* dir, char const* game)
+static void usage()
 {
-    std::ifstream f(std::string(TESTS_DIR "/") + dir + "/" + game, std::ios::binary);
-    auto err = arduboy->load_file(game, f);
-    int r = 0;
-    if(!err.empty()) r = 1;
-    arduboy->reset();
+    fprintf(stderr,
+        "usage: integration_tests [-j <threads>] [-t <timeout s>] [<name>...]\n");
+    exit(1);
+}
 
-    int n = 0;
+int main(int argc, char** argv)
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    double timeout_secs = 120.0;
+    std::vector<std::string> names;
 
-    arduboy->cpu.data[0x23] = 0x10;
-    arduboy->cpu.data[0x2c] = 0x40;
-    arduboy->cpu.data[0x2f] = 0xf0;
-    advance(1000);
-    r |= compare_image(dir, n++);
-    for(int i = 0; i < 9; ++i)
+    for(int i = 1; i < argc; ++i)
     {
-        advance(1000);
-        arduboy->cpu.data[0x2c] = 0x00;
-        if(i != 0)
-            arduboy->cpu.data[0x2f] = 0xa0;
-        advance(100);
-        arduboy->cpu.data[0x2c] = 0x40;
-        arduboy->cpu.data[0x2f] = 0xf0;
-        advance(1000);
-        r |= compare_image(dir, n++);
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if(a == "-j" && has_arg)
+            threads = std::max(1, atoi(argv[++i]));
+        else if(a == "-t" && has_arg)
+            timeout_secs = atof(argv[++i]);
+        else if(a.size() > 1 && a[0] == '-')
+            usage();
+        else
+            names.push_back(a);
     }
 
-    printf("   %-30s : %s\n", dir, r ? "FAIL" : "PASS");
+    auto tests = find_tests();
+    if(!names.empty())
+    {
+        tests.erase(std::remove_if(tests.begin(), tests.end(), [&](auto const& t) {
+            return std::find(names.begin(), names.end(), t.name) == names.end();
+        }), tests.end());
+    }
+    if(tests.empty())
+    {
+        fprintf(stderr, "no tests found in %s\n", TESTS_DIR);
+        return 1;
+    }
 
-    return r;
-}
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        size_t i;
+        while((i = next++) < tests.size())
+            test_runner_t{ tests[i] }.run(timeout_secs);
+    };
+    std::vector<std::thread> pool;
+    threads = std::min<unsigned>(threads, unsigned(tests.size()));
+    for(unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for(auto& t : pool)
+        t.join();
+    double wall_secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
 
-int main()
-{
     int r = 0;
-    arduboy = std::make_unique<absim::arduboy_t>();
-    arduboy->display.enable_filter = true;
-
-    printf("Integration tests...\n");
-    r |= test("float");
-    r |= test("instructions");
-    r |= test("signature");
-    r |= test("timer_tcnt_write");
-
-    printf("\nImage tests...\n");
-    r |= image_test("arduchess", "arduchess.hex");
-    r |= image_test("ardugolf", "ardugolf.hex");
-    r |= image_test("ardugolf_fx", "ardugolf_fx.arduboy");
-    r |= image_test("dazzledash", "dazzledash.arduboy");
-    r |= image_test("summercamp", "summercamp.arduboy");
+    int failed = 0;
+    for(size_t i = 0; i < tests.size(); ++i)
+    {
+        auto const& t = tests[i];
+        if(i == 0 || t.type != tests[i - 1].type)
+            printf("%s%s tests...\n", i == 0 ? "" : "\n",
+                t.type == TEST_SERIAL ? "Integration" :
+                t.type == TEST_IMAGE ? "Image" : "API");
+        printf("   %-30s : %s %6.1f s emulated %6.2f s wall\n",
+            t.name.c_str(),
+            t.pass ? "PASS" : t.timed_out ? "TIME" : "FAIL",
+            t.emulated_ms * 1e-3, t.wall_secs);
+        if(!t.pass)
+            r = 1, ++failed;
+    }
+    printf("\n%zu tests, %d failed, %.2f s on %u threads\n",
+        tests.size(), failed, wall_secs, threads);
 
     return r;
 }
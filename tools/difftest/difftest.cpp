@@ -0,0 +1,622 @@
+#include <absim.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../input_script.hpp"
+
+// Runs the same program and input under every execution engine in lockstep
+// and reports the first point at which their states diverge.
+//
+//     Ardens_difftest [options] <file> [<file>...]
+//     Ardens_difftest fuzz [options]
+//
+// The engines are stepped to common cycle counts (sync points): a merged
+// batch ends on an instruction boundary the unmerged engine also reaches.
+// At every sync point the program counters, registers and SRAM are
+// compared, and every -n sync points the full device state. A full state
+// mismatch is replayed from the last matching sync point to find the first
+// divergent one.
+//
+// The fuzz command runs random instruction streams generated with
+// decode_instr, starting from registers seeded with the edge case operands
+// of tests/instructions.
+
+using absim::arduboy_t;
+
+constexpr uint64_t MS = 1'000'000'000ull;
+constexpr uint64_t CYCLES_PER_MS = MS / arduboy_t::CYCLE_PS;
+
+// how far engines may run apart before giving up on a sync point
+constexpr uint64_t MAX_SYNC_CYCLES = 1 << 20;
+
+struct engine_t
+{
+    char const* name;
+    // called before each step
+    void(*configure)(arduboy_t& a);
+};
+
+// the first engine is the reference: its instructions are reported
+static engine_t const ENGINES[] =
+{
+    { "unmerged", [](arduboy_t& a) { a.cpu.no_merged = true; } },
+    { "merged", [](arduboy_t& a) { a.cpu.no_merged = false; } },
+};
+constexpr size_t NUM_ENGINES = sizeof(ENGINES) / sizeof(ENGINES[0]);
+
+struct checkpoint_t
+{
+    std::vector<uint8_t> states[NUM_ENGINES];
+    uint64_t syncs;
+    size_t next_event;
+};
+
+struct difftest_t
+{
+    std::unique_ptr<arduboy_t> a[NUM_ENGINES];
+
+    std::vector<input_event_t> events;
+    size_t next_event = 0;
+
+    uint64_t full_interval = 1000;
+    uint64_t syncs = 0;
+
+    // pcs (word addresses) each engine stepped from since the last sync point
+    std::vector<uint16_t> step_pcs[NUM_ENGINES];
+
+    bool verbose = true;
+
+    difftest_t()
+    {
+        for(auto& x : a)
+        {
+            x = std::make_unique<arduboy_t>();
+            x->display.enable_filter = false;
+        }
+    }
+
+    void set_pins(uint8_t pinb, uint8_t pine, uint8_t pinf)
+    {
+        for(auto& x : a)
+        {
+            x->cpu.data[0x23] = pinb;
+            x->cpu.data[0x2c] = pine;
+            x->cpu.data[0x2f] = pinf;
+        }
+    }
+
+    bool out_of_program() const
+    {
+        return a[0]->cpu.pc >= absim::atmega32u4_t::PROG_SIZE_BYTES / 2;
+    }
+
+    bool step(size_t i)
+    {
+        // execution stalls without advancing time once the pc leaves flash
+        if(a[i]->cpu.pc >= absim::atmega32u4_t::PROG_SIZE_BYTES / 2)
+            return false;
+        ENGINES[i].configure(*a[i]);
+        step_pcs[i].push_back(a[i]->cpu.pc);
+        return a[i]->step() != 0;
+    }
+
+    // advance the engines to a common cycle count
+    bool sync()
+    {
+        for(auto& p : step_pcs)
+            p.clear();
+        if(!step(0))
+            return false;
+        uint64_t start = a[0]->cpu.cycle_count;
+        for(;;)
+        {
+            uint64_t target = 0;
+            for(auto& x : a)
+                target = std::max(target, x->cpu.cycle_count);
+            if(target - start > MAX_SYNC_CYCLES)
+                return false;
+            bool synced = true;
+            for(size_t i = 0; i < NUM_ENGINES; ++i)
+            {
+                while(a[i]->cpu.cycle_count < target)
+                    if(!step(i))
+                        return false;
+                synced &= (a[i]->cpu.cycle_count == target);
+            }
+            if(synced)
+                return true;
+        }
+    }
+
+    void report_steps()
+    {
+        constexpr size_t MAX_REPORTED = 16;
+        for(size_t i = 0; i < NUM_ENGINES; ++i)
+        {
+            auto const& cpu = a[i]->cpu;
+            auto const& pcs = step_pcs[i];
+            printf("  %s steps since the last sync point (%zu):\n",
+                ENGINES[i].name, pcs.size());
+            // the first steps, where divergence starts, and the last
+            for(size_t n = 0; n < pcs.size(); ++n)
+            {
+                if(n == MAX_REPORTED / 2 && pcs.size() > MAX_REPORTED)
+                {
+                    printf("    ...\n");
+                    n = pcs.size() - MAX_REPORTED / 2;
+                }
+                uint16_t pc = pcs[n];
+                auto const& prog = cpu.no_merged ? cpu.decoded_prog : cpu.merged_prog;
+                auto const& instr = prog[pc < prog.size() ? pc : 0];
+                printf("    0x%04x  %s\n", pc * 2, absim::INSTR_ID_NAMES[instr.func]);
+            }
+        }
+    }
+
+    // compare program counters, registers and SRAM
+    bool compare_quick(size_t i)
+    {
+        auto const& c0 = a[0]->cpu;
+        auto const& c1 = a[i]->cpu;
+        bool r = true;
+        auto diff = [&](char const* what, unsigned x, unsigned y) {
+            if(x == y) return;
+            if(verbose)
+                printf("  %-12s %s 0x%04x, %s 0x%04x\n", what,
+                    ENGINES[0].name, x, ENGINES[i].name, y);
+            r = false;
+        };
+        diff("pc", c0.pc * 2, c1.pc * 2);
+        diff("active", c0.active, c1.active);
+        char name[16];
+        for(int n = 0; n < 32; ++n)
+        {
+            if(c0.data[n] == c1.data[n]) continue;
+            snprintf(name, sizeof(name), "r%d", n);
+            diff(name, c0.data[n], c1.data[n]);
+        }
+        diff("SREG", c0.data[0x5f], c1.data[0x5f]);
+        diff("SP", c0.data[0x5d] | (c0.data[0x5e] << 8), c1.data[0x5d] | (c1.data[0x5e] << 8));
+        for(size_t n = 0x100; n < c0.data.size(); ++n)
+        {
+            if(c0.data[n] == c1.data[n]) continue;
+            snprintf(name, sizeof(name), "[0x%04x]", unsigned(n));
+            diff(name, c0.data[n], c1.data[n]);
+        }
+        return r;
+    }
+
+    // compare the full device state
+    bool compare_full(std::vector<uint8_t> (&states)[NUM_ENGINES])
+    {
+        bool r = true;
+        for(size_t i = 0; i < NUM_ENGINES; ++i)
+        {
+            // these describe each engine's last step only, and are set
+            // again before the next one reads them
+            auto& cpu = a[i]->cpu;
+            auto& display = a[i]->display;
+            auto prev_sreg = cpu.prev_sreg;
+            auto executing_instr_pc = cpu.executing_instr_pc;
+            auto just_interrupted = cpu.just_interrupted;
+            auto vsync = display.vsync;
+            cpu.prev_sreg = a[0]->cpu.prev_sreg;
+            cpu.executing_instr_pc = a[0]->cpu.executing_instr_pc;
+            cpu.just_interrupted = a[0]->cpu.just_interrupted;
+            display.vsync = a[0]->display.vsync;
+            cpu.update_all();
+            a[i]->save_state_to_vector(states[i], false);
+            cpu.prev_sreg = prev_sreg;
+            cpu.executing_instr_pc = executing_instr_pc;
+            cpu.just_interrupted = just_interrupted;
+            display.vsync = vsync;
+            if(i == 0) continue;
+            auto const& s0 = states[0];
+            auto const& s1 = states[i];
+            if(s0 == s1) continue;
+            r = false;
+            if(!verbose) continue;
+            // io registers are the likeliest culprits and sit at the start
+            // of the state, so name them
+            auto const& c0 = a[0]->cpu;
+            auto const& c1 = a[i]->cpu;
+            bool named = false;
+            for(size_t n = 0x20; n < 0x100; ++n)
+            {
+                if(c0.data[n] == c1.data[n]) continue;
+                printf("  io[0x%02x]     %s 0x%02x, %s 0x%02x\n", unsigned(n),
+                    ENGINES[0].name, c0.data[n], ENGINES[i].name, c1.data[n]);
+                named = true;
+            }
+            if(!named)
+            {
+                size_t n = 0;
+                size_t size = std::min(s0.size(), s1.size());
+                while(n < size && s0[n] == s1[n])
+                    ++n;
+                printf("  %s and %s states differ at byte %zu of %zu\n",
+                    ENGINES[0].name, ENGINES[i].name, n, s0.size());
+            }
+        }
+        return r;
+    }
+
+    void apply_events()
+    {
+        uint64_t cycle = a[0]->cpu.cycle_count;
+        while(next_event < events.size() &&
+            events[next_event].ms * CYCLES_PER_MS <= cycle)
+        {
+            auto const& e = events[next_event++];
+            set_pins(e.pinb, e.pine, e.pinf);
+        }
+    }
+
+    // returns true if the engines ran to end_cycle without diverging
+    bool run(uint64_t end_cycle)
+    {
+        checkpoint_t good;
+        checkpoint_t temp;
+        good.syncs = syncs;
+        good.next_event = next_event;
+        for(size_t i = 0; i < NUM_ENGINES; ++i)
+            a[i]->save_state_to_vector(good.states[i], false);
+        uint64_t interval = full_interval;
+        bool replaying = false;
+
+        while(a[0]->cpu.cycle_count < end_cycle)
+        {
+            // the engines agreed up to here, nothing left to compare
+            if(out_of_program())
+                break;
+            apply_events();
+            uint64_t prev_cycle = a[0]->cpu.cycle_count;
+            if(!sync())
+            {
+                printf("engines failed to reach a common cycle after cycle %" PRIu64 "\n",
+                    prev_cycle);
+                for(size_t i = 0; i < NUM_ENGINES; ++i)
+                    printf("  %-10s cycle %" PRIu64 " pc 0x%04x\n", ENGINES[i].name,
+                        a[i]->cpu.cycle_count, a[i]->cpu.pc * 2);
+                report_steps();
+                return false;
+            }
+            ++syncs;
+            uint64_t cycle = a[0]->cpu.cycle_count;
+
+            bool quick = true;
+            for(size_t i = 1; i < NUM_ENGINES; ++i)
+                quick &= compare_quick(i);
+            if(!quick)
+            {
+                printf("diverged at cycle %" PRIu64 " (sync point %" PRIu64 ", previous at cycle %" PRIu64 ")\n",
+                    cycle, syncs, prev_cycle);
+                verbose = true;
+                report_steps();
+                return false;
+            }
+
+            if(syncs % interval != 0)
+                continue;
+
+            verbose = replaying;
+            bool full = compare_full(temp.states);
+            verbose = true;
+            if(full)
+            {
+                std::swap(good.states, temp.states);
+                good.syncs = syncs;
+                good.next_event = next_event;
+                continue;
+            }
+            if(replaying)
+            {
+                printf("state diverged at cycle %" PRIu64 " (sync point %" PRIu64 ", previous at cycle %" PRIu64 ")\n",
+                    cycle, syncs, prev_cycle);
+                report_steps();
+                return false;
+            }
+
+            // replay from the last matching state comparing every sync point
+            for(size_t i = 0; i < NUM_ENGINES; ++i)
+                a[i]->load_state_from_vector(good.states[i]);
+            syncs = good.syncs;
+            next_event = good.next_event;
+            interval = 1;
+            replaying = true;
+        }
+        return true;
+    }
+};
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: Ardens_difftest [options] <file> [<file>...]\n"
+        "  -t <ms>        emulated time to run (default 10000)\n"
+        "  -i <script>    timed input script\n"
+        "  -n <syncs>     compare full state every n sync points (default 1000)\n"
+        "       Ardens_difftest fuzz [options]\n"
+        "  -c <cases>     number of random programs (default 1000)\n"
+        "  -s <seed>      first case's seed (default 1)\n"
+        "  -w <words>     instruction words per program (default 256)\n"
+        "  -k <cycles>    cycles to run each program (default 20000)\n");
+    exit(1);
+}
+
+// random instruction streams
+
+// instructions that leave the generated block or stop execution
+static bool fuzz_excluded(absim::avr_instr_t const& i)
+{
+    switch(i.func)
+    {
+    case absim::INSTR_UNKNOWN:
+    case absim::INSTR_RCALL:
+    case absim::INSTR_CALL:
+    case absim::INSTR_ICALL:
+    case absim::INSTR_RET:
+    case absim::INSTR_RETI:
+    case absim::INSTR_RJMP:
+    case absim::INSTR_JMP:
+    case absim::INSTR_IJMP:
+    case absim::INSTR_SLEEP:
+    case absim::INSTR_SPM:
+    case absim::INSTR_BREAK:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// edge case operands, as used by tests/instructions
+static uint8_t const FUZZ_OPERANDS[] =
+{
+    0x00, 0x01, 0x0f, 0x10, 0x11, 0x7f, 0x80, 0x81, 0xff,
+};
+
+struct fuzz_gen_t
+{
+    std::mt19937 rng;
+    std::vector<uint16_t> words;
+
+    unsigned rand(unsigned n) { return unsigned(rng() % n); }
+    unsigned reg() { return rand(32); }
+    unsigned upper_reg() { return 16 + rand(16); }
+    unsigned even_reg() { return rand(16) * 2; }
+    unsigned imm() { return rand(2) ? FUZZ_OPERANDS[rand(9)] : rand(256); }
+
+    void rd_rr(uint16_t op, unsigned d, unsigned r)
+    {
+        words.push_back(uint16_t(op | (r & 0x10) << 5 | d << 4 | (r & 0xf)));
+    }
+    void rd_k(uint16_t op, unsigned d, unsigned k)
+    {
+        words.push_back(uint16_t(op | (k & 0xf0) << 4 | (d - 16) << 4 | (k & 0xf)));
+    }
+
+    // sequences merge_instrs fuses
+    void mergeable()
+    {
+        unsigned d = even_reg(), r = even_reg();
+        switch(rand(7))
+        {
+        case 0: // ldi + ldi
+            rd_k(0xe000, upper_reg(), imm());
+            rd_k(0xe000, upper_reg(), imm());
+            break;
+        case 1: // dec + brne
+            words.push_back(uint16_t(0x940a | reg() << 4));
+            words.push_back(uint16_t(0xf401 | (-int(rand(4) + 1) & 0x7f) << 3));
+            break;
+        case 2: // add + adc
+            rd_rr(0x0c00, d, r);
+            rd_rr(0x1c00, d + 1, r + 1);
+            break;
+        case 3: // sub + sbc
+            rd_rr(0x1800, d, r);
+            rd_rr(0x0800, d + 1, r + 1);
+            break;
+        case 4: // cp + cpc
+            rd_rr(0x1400, d, r);
+            rd_rr(0x0400, d + 1, r + 1);
+            break;
+        case 5: // subi + sbci
+        {
+            unsigned u = 16 + rand(8) * 2;
+            rd_k(0x5000, u, imm());
+            rd_k(0x4000, u + 1, imm());
+            break;
+        }
+        case 6: // delay
+            for(unsigned n = 2 + rand(6); n > 0; --n)
+                words.push_back(0x0000);
+            break;
+        }
+    }
+
+    void instr()
+    {
+        for(;;)
+        {
+            uint16_t w0 = uint16_t(rng());
+            uint16_t w1 = uint16_t(rng());
+            absim::avr_instr_t i;
+            absim::decode_instr(i, w0, w1);
+            if(fuzz_excluded(i))
+                continue;
+            words.push_back(w0);
+            if(absim::instr_is_two_words(i))
+                words.push_back(w1);
+            return;
+        }
+    }
+
+    // a nop sled into the block, the block, and a nop sled into a jump back
+    // to the block's start, so that branches and skips stay inside
+    void program(unsigned block_words)
+    {
+        constexpr unsigned SLED = 64;
+        words.assign(SLED, 0x0000);
+        while(words.size() < SLED + block_words)
+        {
+            if(rand(4) == 0)
+                mergeable();
+            else
+                instr();
+        }
+        words.resize(words.size() + SLED, 0x0000);
+        int k = int(SLED) - int(words.size()) - 1;
+        words.push_back(uint16_t(0xc000 | (k & 0xfff)));
+    }
+};
+
+static void fuzz_setup(arduboy_t& a, std::vector<uint16_t> const& words, uint32_t seed)
+{
+    auto& cpu = a.cpu;
+    memset(&cpu.prog, 0, sizeof(cpu.prog));
+    for(size_t n = 0; n < words.size(); ++n)
+    {
+        cpu.prog[n * 2 + 0] = uint8_t(words[n] >> 0);
+        cpu.prog[n * 2 + 1] = uint8_t(words[n] >> 8);
+    }
+    cpu.last_addr = uint16_t(words.size() * 2);
+    cpu.program_loaded = true;
+    a.flashcart_loaded = false;
+    a.cfg.bootloader = false;
+    a.reset();
+
+    std::mt19937 rng(seed);
+    for(int n = 0; n < 32; ++n)
+        cpu.data[n] = FUZZ_OPERANDS[rng() % 9];
+    for(size_t n = 0x100; n < cpu.data.size(); ++n)
+        cpu.data[n] = uint8_t(rng());
+    // pointer registers into SRAM
+    for(int n = 26; n < 32; n += 2)
+        cpu.data[n + 1] = uint8_t(0x01 + rng() % 0x0a);
+    cpu.data[0x5d] = 0xff;
+    cpu.data[0x5e] = 0x0a;
+    cpu.data[0x5f] = uint8_t(rng() & 0x7f);
+}
+
+static int fuzz(int argc, char** argv)
+{
+    uint64_t cases = 1000;
+    uint32_t seed = 1;
+    unsigned block_words = 256;
+    uint64_t cycles = 20000;
+    for(int i = 2; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if(a == "-c" && has_arg)
+            cases = strtoull(argv[++i], nullptr, 0);
+        else if(a == "-s" && has_arg)
+            seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+        else if(a == "-w" && has_arg)
+            block_words = (unsigned)strtoul(argv[++i], nullptr, 0);
+        else if(a == "-k" && has_arg)
+            cycles = strtoull(argv[++i], nullptr, 0);
+        else
+            usage();
+    }
+    if(block_words == 0 || block_words > 8192)
+        usage();
+
+    difftest_t t;
+    // short programs: compare full state often, mismatches replay anyway
+    t.full_interval = 64;
+    fuzz_gen_t gen;
+    uint64_t escaped = 0;
+    for(uint64_t c = 0; c < cases; ++c, ++seed)
+    {
+        gen.rng.seed(seed);
+        gen.program(block_words);
+        for(auto& a : t.a)
+            fuzz_setup(*a, gen.words, seed);
+        t.syncs = 0;
+        if(!t.run(cycles))
+        {
+            printf("case with seed %" PRIu32 " diverged\n", seed);
+            return 1;
+        }
+        if(t.out_of_program())
+            ++escaped;
+    }
+    printf("%" PRIu64 " cases, no divergence (%" PRIu64 " left flash early)\n",
+        cases, escaped);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc >= 2 && strcmp(argv[1], "fuzz") == 0)
+        return fuzz(argc, argv);
+
+    uint64_t run_ms = 10000;
+    char const* input_fname = nullptr;
+    std::vector<char const*> files;
+    difftest_t t;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if(a == "-t" && has_arg)
+            run_ms = strtoull(argv[++i], nullptr, 10);
+        else if(a == "-i" && has_arg)
+            input_fname = argv[++i];
+        else if(a == "-n" && has_arg)
+            t.full_interval = std::max<uint64_t>(1, strtoull(argv[++i], nullptr, 10));
+        else if(a.size() > 1 && a[0] == '-')
+            usage();
+        else
+            files.push_back(argv[i]);
+    }
+    if(files.empty())
+        usage();
+
+    for(auto& x : t.a)
+    {
+        for(char const* fname : files)
+        {
+            std::ifstream f(fname, std::ios::binary);
+            if(!f.good())
+            {
+                fprintf(stderr, "unable to open %s\n", fname);
+                return 1;
+            }
+            auto err = x->load_file(fname, f);
+            if(!err.empty())
+            {
+                fprintf(stderr, "%s: %s\n", fname, err.c_str());
+                return 1;
+            }
+        }
+    }
+
+    if(input_fname && !load_input_script(input_fname, t.events))
+    {
+        fprintf(stderr, "unable to load input script %s\n", input_fname);
+        return 1;
+    }
+
+    t.set_pins(0x10, 0x40, 0xf0);
+    if(!t.run(run_ms * CYCLES_PER_MS))
+        return 1;
+    if(t.out_of_program())
+        printf("program counter left flash at cycle %" PRIu64 "\n",
+            t.a[0]->cpu.cycle_count);
+    printf("%" PRIu64 " cycles, %" PRIu64 " sync points, no divergence\n",
+        t.a[0]->cpu.cycle_count, t.syncs);
+    return 0;
+}
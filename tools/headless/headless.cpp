@@ -0,0 +1,671 @@
+#include <absim.hpp>
+#include <absim_movie.hpp>
+#include <absim_wav.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "../input_script.hpp"
+
+// Runs games without a window or frame pacing.
+//
+//     Ardens_headless [options] <file> [<file>...]
+//
+// See input_script.hpp for the timed input script format and absim_movie.hpp
+// for input movies, which replay a recorded session exactly: playback checks
+// the movie's keyframes and exits with status 2 if it desynced.
+//
+// Corpus mode (-c) runs every game in a directory on its own instance, with
+// the input script <game>.txt when present, and hashes each displayed frame.
+// The hash streams go into one index (-o), or are compared against one (-x),
+// reporting the first differing frame per game: exit status 3 on differences.
+//
+// Index file format (little endian):
+//
+//     "ARDFRIDX", u32 version, u64 run time (ms), u32 games, each
+//         u16 name bytes, name, u64 game hash, u32 runs, each
+//             u64 frame hash, u32 frames (consecutive identical frames)
+
+static std::unique_ptr<absim::arduboy_t> arduboy;
+
+constexpr uint64_t MS = 1'000'000'000ull;
+constexpr uint32_t AUDIO_FREQ = 16000000 / absim::atmega32u4_t::SOUND_CYCLES;
+
+// never advance further than this at once, to bound sound_buffer growth
+constexpr uint64_t MAX_STEP_PS = 100 * MS;
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: Ardens_headless [options] <file> [<file>...]\n"
+        "  -t <ms>        emulated time to run (default 10000, or to the end of\n"
+        "                 the movie)\n"
+        "  -i <script>    timed input script\n"
+        "  -m <movie>     play an input movie\n"
+        "  -k <ms>        seek the movie to this time before running\n"
+        "  -w <movie>     record the run from power-on as an input movie\n"
+        "  -f <path>      dump frames: <path>NNNNNN.png, or a raw stream of\n"
+        "                 128x64 8-bit frames if path ends in .raw or is -\n"
+        "  -r <fps>       frame capture rate (default 60)\n"
+        "  -a <file.wav>  write audio\n"
+        "  -s <file>      write serial output (- for stdout)\n"
+        "  -j <file>      write runtime stats as JSON (- for stdout)\n"
+        "  -q             don't print emulation speed\n"
+        "corpus mode:\n"
+        "  -c <dir>       hash the frames of every game in dir (.hex, .arduboy)\n"
+        "  -o <index>     write the frame hash index\n"
+        "  -x <index>     compare against a frame hash index\n"
+        "  -p <threads>   parallel games (default: all cores)\n");
+    exit(1);
+}
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t INDEX_VERSION = 1;
+
+struct frame_run_t
+{
+    uint64_t hash;
+    uint32_t frames;
+};
+
+struct corpus_game_t
+{
+    std::string name;
+    uint64_t game_hash;
+    std::vector<frame_run_t> runs;
+    std::string error;
+};
+
+static corpus_game_t run_corpus_game(fs::path const& path, uint64_t run_ms)
+{
+    corpus_game_t g{ path.filename().string(), 0 };
+
+    auto a = std::make_unique<absim::arduboy_t>();
+    std::ifstream f(path, std::ios::binary);
+    g.error = a->load_file(path.string().c_str(), f);
+    if(!g.error.empty())
+        return g;
+    g.game_hash = a->game_hash;
+
+    std::vector<input_event_t> events;
+    auto script = path;
+    script.replace_extension(".txt");
+    if(fs::exists(script) && !load_input_script(script.string().c_str(), events))
+    {
+        g.error = "unable to load input script " + script.filename().string();
+        return g;
+    }
+
+    a->display.enable_filter = false;
+    a->display.hash_frames = true;
+    a->frame_bytes_total = 1024;
+    auto& cpu = a->cpu;
+    cpu.data[0x23] = 0x10;
+    cpu.data[0x2c] = 0x40;
+    cpu.data[0x2f] = 0xf0;
+
+    uint64_t end_ps = run_ms * MS;
+    size_t next_event = 0;
+    uint64_t ps = 0;
+    while(ps < end_ps)
+    {
+        while(next_event < events.size() && events[next_event].ms * MS <= ps)
+        {
+            auto const& e = events[next_event++];
+            cpu.data[0x23] = e.pinb;
+            cpu.data[0x2c] = e.pine;
+            cpu.data[0x2f] = e.pinf;
+        }
+
+        uint64_t step = std::min(end_ps, ps + MAX_STEP_PS);
+        if(next_event < events.size())
+            step = std::min(step, events[next_event].ms * MS);
+        step -= ps;
+
+        a->paused = false;
+        a->advance(step);
+        ps += step;
+
+        for(uint64_t h : a->display.frame_hashes)
+        {
+            if(!g.runs.empty() && g.runs.back().hash == h)
+                ++g.runs.back().frames;
+            else
+                g.runs.push_back({ h, 1 });
+        }
+        a->display.frame_hashes.clear();
+        cpu.sound_buffer.clear();
+        cpu.serial_bytes.clear();
+    }
+    return g;
+}
+
+static void put_le(std::string& d, uint64_t x, int n)
+{
+    for(int i = 0; i < n; ++i)
+        d.push_back(char(uint8_t(x >> (i * 8))));
+}
+
+static bool save_index(char const* fname, uint64_t run_ms,
+    std::vector<corpus_game_t> const& games)
+{
+    std::string d = "ARDFRIDX";
+    put_le(d, INDEX_VERSION, 4);
+    put_le(d, run_ms, 8);
+    put_le(d, games.size(), 4);
+    for(auto const& g : games)
+    {
+        put_le(d, g.name.size(), 2);
+        d += g.name;
+        put_le(d, g.game_hash, 8);
+        put_le(d, g.runs.size(), 4);
+        for(auto const& r : g.runs)
+        {
+            put_le(d, r.hash, 8);
+            put_le(d, r.frames, 4);
+        }
+    }
+    std::ofstream f(fname, std::ios::binary);
+    f.write(d.data(), std::streamsize(d.size()));
+    return f.good();
+}
+
+static std::string load_index(char const* fname, uint64_t& run_ms,
+    std::vector<corpus_game_t>& games)
+{
+    std::ifstream f(fname, std::ios::binary);
+    if(!f.good())
+        return "unable to open";
+    std::string d(std::istreambuf_iterator<char>(f), {});
+    size_t i = 0;
+    bool ok = true;
+    auto le = [&](int n) {
+        uint64_t x = 0;
+        if(i + n > d.size())
+            return ok = false, x;
+        for(int j = 0; j < n; ++j)
+            x |= uint64_t(uint8_t(d[i++])) << (j * 8);
+        return x;
+    };
+    if(d.compare(0, 8, "ARDFRIDX") != 0)
+        return "invalid identifier";
+    i = 8;
+    if(le(4) != INDEX_VERSION)
+        return "incompatible version";
+    run_ms = le(8);
+    uint64_t n = le(4);
+    for(uint64_t k = 0; ok && k < n; ++k)
+    {
+        corpus_game_t g;
+        size_t name_bytes = size_t(le(2));
+        if(i + name_bytes > d.size())
+            break;
+        g.name = d.substr(i, name_bytes);
+        i += name_bytes;
+        g.game_hash = le(8);
+        uint64_t runs = le(4);
+        if(runs > (d.size() - i) / 12)
+            break;
+        g.runs.resize(size_t(runs));
+        for(auto& r : g.runs)
+        {
+            r.hash = le(8);
+            r.frames = uint32_t(le(4));
+        }
+        games.push_back(std::move(g));
+    }
+    if(!ok || games.size() != n)
+        return "truncated data";
+    return "";
+}
+
+// returns the first frame that differs, or UINT64_MAX if none
+static uint64_t first_difference(
+    std::vector<frame_run_t> const& a, std::vector<frame_run_t> const& b)
+{
+    uint64_t frame = 0;
+    size_t ia = 0, ib = 0;
+    uint32_t na = 0, nb = 0; // frames used of the current runs
+    while(ia < a.size() && ib < b.size())
+    {
+        if(a[ia].hash != b[ib].hash)
+            return frame;
+        uint32_t n = std::min(a[ia].frames - na, b[ib].frames - nb);
+        frame += n;
+        if((na += n) == a[ia].frames)
+            ++ia, na = 0;
+        if((nb += n) == b[ib].frames)
+            ++ib, nb = 0;
+    }
+    return ia == a.size() && ib == b.size() ? UINT64_MAX : frame;
+}
+
+static int run_corpus(char const* dir, char const* index_out, char const* index_in,
+    uint64_t run_ms, bool run_ms_set, unsigned threads, bool quiet)
+{
+    std::vector<corpus_game_t> expected;
+    if(index_in)
+    {
+        uint64_t index_ms = 0;
+        auto err = load_index(index_in, index_ms, expected);
+        if(!err.empty())
+        {
+            fprintf(stderr, "%s: %s\n", index_in, err.c_str());
+            return 1;
+        }
+        if(!run_ms_set)
+            run_ms = index_ms;
+        else if(run_ms != index_ms)
+        {
+            fprintf(stderr, "%s: recorded with -t %" PRIu64 "\n", index_in, index_ms);
+            return 1;
+        }
+    }
+
+    std::vector<fs::path> paths;
+    std::error_code ec;
+    for(auto const& e : fs::directory_iterator(dir, ec))
+    {
+        auto ext = e.path().extension();
+        if(e.is_regular_file() && (ext == ".hex" || ext == ".arduboy"))
+            paths.push_back(e.path());
+    }
+    if(ec || paths.empty())
+    {
+        fprintf(stderr, "no games found in %s\n", dir);
+        return 1;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<corpus_game_t> games(paths.size());
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        size_t i;
+        while((i = next++) < paths.size())
+            games[i] = run_corpus_game(paths[i], run_ms);
+    };
+    std::vector<std::thread> pool;
+    threads = std::min<unsigned>(threads, unsigned(paths.size()));
+    for(unsigned i = 1; i < threads; ++i)
+        pool.emplace_back(worker);
+    worker();
+    for(auto& t : pool)
+        t.join();
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+
+    int r = 0;
+    size_t errors = 0, differ = 0, missing = 0;
+    uint64_t frames = 0;
+    for(auto const& g : games)
+    {
+        if(!g.error.empty())
+        {
+            fprintf(stderr, "%s: %s\n", g.name.c_str(), g.error.c_str());
+            ++errors, r = 1;
+            continue;
+        }
+        for(auto const& run : g.runs)
+            frames += run.frames;
+        if(!index_in)
+            continue;
+        auto it = std::find_if(expected.begin(), expected.end(),
+            [&](auto const& e) { return e.name == g.name; });
+        if(it == expected.end())
+        {
+            printf("   %-30s : not in index\n", g.name.c_str());
+            ++missing;
+            continue;
+        }
+        if(it->game_hash != g.game_hash)
+        {
+            printf("   %-30s : game changed\n", g.name.c_str());
+            ++differ;
+            continue;
+        }
+        uint64_t f = first_difference(it->runs, g.runs);
+        if(f != UINT64_MAX)
+        {
+            printf("   %-30s : first differs at frame %" PRIu64 "\n", g.name.c_str(), f);
+            ++differ;
+        }
+    }
+    if(differ != 0 && r == 0)
+        r = 3;
+
+    if(index_out && !save_index(index_out, run_ms, games))
+    {
+        fprintf(stderr, "unable to write %s\n", index_out);
+        return 1;
+    }
+
+    fflush(stdout);
+    if(!quiet || r != 0)
+    {
+        fprintf(stderr, "%zu games, %" PRIu64 " frames, %zu differ, %zu not in index, "
+            "%zu errors, %.2f s on %u threads\n",
+            games.size(), frames, differ, missing, errors, secs, threads);
+    }
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t run_ms = 10000;
+    bool run_ms_set = false;
+    double fps = 60.0;
+    char const* input_fname = nullptr;
+    char const* movie_fname = nullptr;
+    char const* record_fname = nullptr;
+    uint64_t seek_ms = 0;
+    char const* frames_path = nullptr;
+    char const* audio_fname = nullptr;
+    char const* serial_fname = nullptr;
+    char const* stats_fname = nullptr;
+    char const* corpus_dir = nullptr;
+    char const* index_out = nullptr;
+    char const* index_in = nullptr;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool quiet = false;
+    std::vector<char const*> files;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        bool has_arg = i + 1 < argc;
+        if(a == "-t" && has_arg)
+            run_ms = strtoull(argv[++i], nullptr, 10), run_ms_set = true;
+        else if(a == "-i" && has_arg)
+            input_fname = argv[++i];
+        else if(a == "-m" && has_arg)
+            movie_fname = argv[++i];
+        else if(a == "-k" && has_arg)
+            seek_ms = strtoull(argv[++i], nullptr, 10);
+        else if(a == "-w" && has_arg)
+            record_fname = argv[++i];
+        else if(a == "-f" && has_arg)
+            frames_path = argv[++i];
+        else if(a == "-r" && has_arg)
+            fps = atof(argv[++i]);
+        else if(a == "-a" && has_arg)
+            audio_fname = argv[++i];
+        else if(a == "-s" && has_arg)
+            serial_fname = argv[++i];
+        else if(a == "-j" && has_arg)
+            stats_fname = argv[++i];
+        else if(a == "-c" && has_arg)
+            corpus_dir = argv[++i];
+        else if(a == "-o" && has_arg)
+            index_out = argv[++i];
+        else if(a == "-x" && has_arg)
+            index_in = argv[++i];
+        else if(a == "-p" && has_arg)
+            threads = std::max(1, atoi(argv[++i]));
+        else if(a == "-q")
+            quiet = true;
+        else if(a.size() > 1 && a[0] == '-')
+            usage();
+        else
+            files.push_back(argv[i]);
+    }
+    if(corpus_dir)
+    {
+        if(!files.empty())
+            usage();
+        return run_corpus(corpus_dir, index_out, index_in, run_ms, run_ms_set, threads, quiet);
+    }
+    if(files.empty() || !(fps > 0.0))
+        usage();
+
+    arduboy = std::make_unique<absim::arduboy_t>();
+    for(char const* fname : files)
+    {
+        std::ifstream f(fname, std::ios::binary);
+        if(!f.good())
+        {
+            fprintf(stderr, "unable to open %s\n", fname);
+            return 1;
+        }
+        auto err = arduboy->load_file(fname, f);
+        if(!err.empty())
+        {
+            fprintf(stderr, "%s: %s\n", fname, err.c_str());
+            return 1;
+        }
+    }
+    arduboy->display.enable_filter = false;
+    arduboy->frame_bytes_total = 1024;
+    arduboy->cpu.count_instrs = stats_fname != nullptr;
+
+    std::vector<input_event_t> events;
+    if(input_fname && !load_input_script(input_fname, events))
+    {
+        fprintf(stderr, "unable to load input script %s\n", input_fname);
+        return 1;
+    }
+
+    auto& cpu = arduboy->cpu;
+    cpu.data[0x23] = 0x10;
+    cpu.data[0x2c] = 0x40;
+    cpu.data[0x2f] = 0xf0;
+
+    constexpr uint64_t CYCLE_PS = absim::arduboy_t::CYCLE_PS;
+    constexpr uint64_t CYCLES_PER_MS = MS / CYCLE_PS;
+    uint64_t end_ps = run_ms * MS;
+    if(movie_fname)
+    {
+        std::ifstream f(movie_fname, std::ios::binary);
+        auto err = arduboy->start_movie_playback(f);
+        if(err.empty() && seek_ms != 0)
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            err = arduboy->seek_movie(arduboy->movie->start_cycle + seek_ms * CYCLES_PER_MS);
+            double secs = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - t0).count();
+            if(!quiet)
+                fprintf(stderr, "seeked to %" PRIu64 " ms in %.3f s\n", seek_ms, secs);
+        }
+        if(!err.empty())
+        {
+            fprintf(stderr, "%s: %s\n", movie_fname, err.c_str());
+            return 1;
+        }
+        if(!run_ms_set)
+        {
+            // stop on the step boundary where the recording stopped
+            uint64_t end = arduboy->movie->end_cycle;
+            end_ps = 0;
+            if(end > cpu.cycle_count)
+            {
+                end_ps = (end - cpu.cycle_count) * CYCLE_PS - arduboy->ps_rem +
+                    absim::arduboy_t::PS_BUFFER - CYCLE_PS;
+            }
+        }
+    }
+    if(record_fname)
+    {
+        auto err = arduboy->start_movie_recording(true);
+        if(!err.empty())
+        {
+            fprintf(stderr, "%s: %s\n", record_fname, err.c_str());
+            return 1;
+        }
+    }
+
+    FILE* raw_frames = nullptr;
+    std::string png_prefix;
+    if(frames_path)
+    {
+        std::string p = frames_path;
+        if(p == "-")
+            raw_frames = stdout;
+        else if(p.size() >= 4 && p.compare(p.size() - 4, 4, ".raw") == 0)
+            raw_frames = fopen(frames_path, "wb");
+        else
+            png_prefix = p;
+        if(png_prefix.empty() && !raw_frames)
+        {
+            fprintf(stderr, "unable to open %s\n", frames_path);
+            return 1;
+        }
+    }
+
+    FILE* audio = nullptr;
+    uint64_t audio_samples = 0;
+    if(audio_fname)
+    {
+        audio = fopen(audio_fname, "wb");
+        if(!audio)
+        {
+            fprintf(stderr, "unable to open %s\n", audio_fname);
+            return 1;
+        }
+        absim::write_wav_header(audio, AUDIO_FREQ, 0);
+    }
+
+    FILE* serial = nullptr;
+    if(serial_fname)
+    {
+        serial = strcmp(serial_fname, "-") == 0 ? stdout : fopen(serial_fname, "wb");
+        if(!serial)
+        {
+            fprintf(stderr, "unable to open %s\n", serial_fname);
+            return 1;
+        }
+    }
+
+    uint64_t const frame_ps = uint64_t(1e12 / fps);
+    uint64_t next_frame_ps = frame_ps;
+    uint64_t frames = 0;
+    size_t next_event = 0;
+    uint64_t ps = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t cycles0 = cpu.cycle_count;
+
+    while(ps < end_ps)
+    {
+        while(next_event < events.size() && events[next_event].ms * MS <= ps)
+        {
+            auto const& e = events[next_event++];
+            cpu.data[0x23] = e.pinb;
+            cpu.data[0x2c] = e.pine;
+            cpu.data[0x2f] = e.pinf;
+        }
+
+        uint64_t step = std::min(end_ps, ps + MAX_STEP_PS);
+        if(frames_path)
+            step = std::min(step, next_frame_ps);
+        if(next_event < events.size())
+            step = std::min(step, events[next_event].ms * MS);
+        step -= ps;
+
+        arduboy->paused = false;
+        arduboy->advance(step);
+        ps += step;
+
+        if(frames_path && ps >= next_frame_ps)
+        {
+            next_frame_ps += frame_ps;
+            auto const& pixels = arduboy->display.filtered_pixels;
+            if(raw_frames)
+                fwrite(pixels.data(), 1, pixels.size(), raw_frames);
+            else
+            {
+                char fname[32];
+                snprintf(fname, sizeof(fname), "%06" PRIu64 ".png", frames);
+                stbi_write_png((png_prefix + fname).c_str(), 128, 64, 1, pixels.data(), 128);
+            }
+            ++frames;
+        }
+
+        auto& sound = cpu.sound_buffer;
+        if(audio && !sound.empty())
+        {
+            fwrite(sound.data(), sizeof(int16_t), sound.size(), audio);
+            audio_samples += sound.size();
+        }
+        sound.clear();
+
+        auto& sb = cpu.serial_bytes;
+        if(serial && !sb.empty())
+            fwrite(sb.data(), 1, sb.size(), serial);
+        sb.clear();
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    uint64_t cycles = cpu.cycle_count - cycles0;
+
+    if(audio)
+    {
+        absim::write_wav_header(audio, AUDIO_FREQ, audio_samples);
+        fclose(audio);
+    }
+    if(raw_frames && raw_frames != stdout)
+        fclose(raw_frames);
+    if(serial && serial != stdout)
+        fclose(serial);
+
+    int r = 0;
+    if(record_fname)
+    {
+        std::ofstream f(record_fname, std::ios::binary);
+        auto err = arduboy->stop_movie_recording(f);
+        if(!err.empty())
+        {
+            fprintf(stderr, "%s: %s\n", record_fname, err.c_str());
+            return 1;
+        }
+    }
+    if(movie_fname)
+    {
+        auto const& m = *arduboy->movie;
+        if(m.desyncs != 0)
+            r = 2;
+        if(!quiet || m.desyncs != 0)
+            fprintf(stderr, "movie: %" PRIu64 " keyframes verified, %" PRIu64 " desyncs\n",
+                m.verified, m.desyncs);
+    }
+
+    if(stats_fname)
+    {
+        auto json = arduboy->stats_json();
+        FILE* f = strcmp(stats_fname, "-") == 0 ? stdout : fopen(stats_fname, "wb");
+        if(!f)
+        {
+            fprintf(stderr, "unable to open %s\n", stats_fname);
+            return 1;
+        }
+        fwrite(json.data(), 1, json.size(), f);
+        fputc('\n', f);
+        if(f != stdout)
+            fclose(f);
+    }
+
+    if(!quiet)
+    {
+        double mhz = secs > 0 ? double(cycles) / secs * 1e-6 : 0.0;
+        fprintf(stderr, "%" PRIu64 " cycles in %.3f s: %.1f MHz (%.1fx realtime)\n",
+            cycles, secs, mhz, mhz / 16.0);
+    }
+
+    return r;
+}
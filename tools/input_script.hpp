@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Input scripts hold one "<ms> <buttons>" line per change of input, where
+// buttons is any of UDLRAB (or - for none) held from that time on. Blank
+// lines and lines starting with # are ignored:
+//
+//     # start the game, then hold right and jump
+//     500  A
+//     600  -
+//     1000 R
+//     1200 RA
+
+struct input_event_t
+{
+    uint64_t ms;
+    uint8_t pinb, pine, pinf;
+};
+
+inline bool load_input_script(char const* filename, std::vector<input_event_t>& events)
+{
+    std::ifstream f(filename);
+    if(!f.good())
+        return false;
+    std::string line;
+    int n = 0;
+    while(std::getline(f, line))
+    {
+        ++n;
+        std::istringstream ss(line);
+        std::string ms, buttons;
+        if(!(ss >> ms) || ms[0] == '#')
+            continue;
+        ss >> buttons;
+        input_event_t e{ strtoull(ms.c_str(), nullptr, 10), 0x10, 0x40, 0xf0 };
+        for(char c : buttons)
+        {
+            switch(c)
+            {
+            case 'U': case 'u': e.pinf &= ~0x80; break;
+            case 'R': case 'r': e.pinf &= ~0x40; break;
+            case 'L': case 'l': e.pinf &= ~0x20; break;
+            case 'D': case 'd': e.pinf &= ~0x10; break;
+            case 'A': case 'a': e.pine &= ~0x40; break;
+            case 'B': case 'b': e.pinb &= ~0x10; break;
+            case '-': break;
+            default:
+                fprintf(stderr, "%s:%d: unknown button '%c'\n", filename, n, c);
+                return false;
+            }
+        }
+        events.push_back(e);
+    }
+    std::stable_sort(events.begin(), events.end(),
+        [](auto const& a, auto const& b) { return a.ms < b.ms; });
+    return true;
+}
@@ -0,0 +1,178 @@
+#include <absim.hpp>
+#include <absim_trace.hpp>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fstream>
+
+// Records and queries execution traces.
+//
+//     Ardens_trace record <game> <trace> [ms]
+//     Ardens_trace info <trace>
+//     Ardens_trace last-write <trace> <data addr> <cycle>
+//     Ardens_trace entries <trace> <prog byte addr or symbol> [elf]
+
+static absim::arduboy_t arduboy;
+
+constexpr uint64_t MS = 1'000'000'000ull;
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: Ardens_trace record <game> <trace> [ms]\n"
+        "       Ardens_trace info <trace>\n"
+        "       Ardens_trace last-write <trace> <data addr> <cycle>\n"
+        "       Ardens_trace entries <trace> <prog byte addr or symbol> [elf]\n");
+    exit(1);
+}
+
+static bool load_file(char const* filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if(!f.good())
+        return false;
+    auto r = arduboy.load_file(filename, f);
+    if(!r.empty())
+    {
+        fprintf(stderr, "%s\n", r.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void open_trace(absim::trace_reader_t& reader, char const* filename)
+{
+    auto r = reader.open(filename);
+    if(!r.empty())
+    {
+        fprintf(stderr, "%s\n", r.c_str());
+        exit(1);
+    }
+}
+
+static int record(int argc, char** argv)
+{
+    if(argc < 4)
+        usage();
+    if(!load_file(argv[2]))
+        return 1;
+    uint64_t ms = argc >= 5 ? strtoull(argv[4], nullptr, 0) : 10000;
+
+    arduboy.cpu.data[0x23] = 0x10;
+    arduboy.cpu.data[0x2c] = 0x40;
+    arduboy.cpu.data[0x2f] = 0xf0;
+
+    auto r = arduboy.start_trace(argv[3]);
+    if(!r.empty())
+    {
+        fprintf(stderr, "%s\n", r.c_str());
+        return 1;
+    }
+    while(arduboy.cpu.cycle_count < ms * 16000)
+    {
+        arduboy.paused = false;
+        arduboy.advance(1 * MS);
+    }
+    uint64_t records = arduboy.trace->records;
+    arduboy.stop_trace();
+    printf("%" PRIu64 " records\n", records);
+    return 0;
+}
+
+static int info(int argc, char** argv)
+{
+    if(argc < 3)
+        usage();
+    absim::trace_reader_t reader;
+    open_trace(reader, argv[2]);
+    uint64_t records = 0, raw = 0, compressed = 0;
+    for(auto const& c : reader.chunks)
+    {
+        records += c.records;
+        raw += c.raw_bytes;
+        compressed += c.compressed_bytes;
+        printf("cycles %12" PRIu64 " - %12" PRIu64 ": %u records, %u bytes\n",
+            c.base_cycle, c.last_cycle, c.records, c.compressed_bytes);
+    }
+    printf("%zu chunks, %" PRIu64 " records, %" PRIu64 " bytes (%" PRIu64 " uncompressed)\n",
+        reader.chunks.size(), records, compressed, raw);
+    return 0;
+}
+
+static int last_write(int argc, char** argv)
+{
+    if(argc < 5)
+        usage();
+    absim::trace_reader_t reader;
+    open_trace(reader, argv[2]);
+    uint16_t addr = (uint16_t)strtoul(argv[3], nullptr, 0);
+    uint64_t cycle = strtoull(argv[4], nullptr, 0);
+    absim::trace_record_t r;
+    absim::trace_write_t w;
+    if(!reader.last_write_before(addr, cycle, r, w))
+    {
+        printf("no write to 0x%04x before cycle %" PRIu64 "\n", addr, cycle);
+        return 1;
+    }
+    printf("cycle %" PRIu64 ": pc 0x%04x wrote 0x%02x\n", r.cycle, r.pc * 2, w.value);
+    return 0;
+}
+
+static int entries(int argc, char** argv)
+{
+    if(argc < 4)
+        usage();
+    absim::trace_reader_t reader;
+    open_trace(reader, argv[2]);
+
+    char* end = nullptr;
+    unsigned long addr = strtoul(argv[3], &end, 0);
+    if(*end != '\0')
+    {
+        // look up symbol
+        if(argc < 5 || !load_file(argv[4]) || !arduboy.elf)
+        {
+            fprintf(stderr, "symbol lookup requires an ELF file\n");
+            return 1;
+        }
+        bool found = false;
+        for(auto const& [a, sym] : arduboy.elf->text_symbols)
+        {
+            if(sym.name != argv[3]) continue;
+            addr = a;
+            found = true;
+            break;
+        }
+        if(!found)
+        {
+            fprintf(stderr, "symbol not found: %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    std::vector<absim::trace_record_t> records;
+    reader.entries(uint16_t(addr / 2), records);
+    for(auto const& r : records)
+        printf("cycle %" PRIu64 "\n", r.cycle);
+    printf("%zu entries to 0x%04lx\n", records.size(), addr);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+        usage();
+    std::string cmd = argv[1];
+    if(cmd == "record")
+        return record(argc, argv);
+    if(cmd == "info")
+        return info(argc, argv);
+    if(cmd == "last-write")
+        return last_write(argc, argv);
+    if(cmd == "entries")
+        return entries(argc, argv);
+    usage();
+    return 1;
+}